@@ -0,0 +1,206 @@
+#include "dehydrator.h"
+#include <stdio.h>
+#include <time.h>
+#include <malloc.h>
+
+// Microbenchmark of the dehydrator engine, linked without Redis:
+//   make -C src bench && ./src/bench [elements]
+// every configuration pushes `elements` elements, looks them all up, pulls
+// half of them, asks for the time to next expiration and polls the rest out.
+// besides the time of each step it reports the allocations per pushed element
+// and the memory the dehydrator holds per element once they are all pushed.
+
+
+//##########################################################
+//#
+//#                 Counting Allocator
+//#
+//#########################################################
+
+static size_t allocations = 0;
+static size_t allocated_bytes = 0;
+static size_t held_bytes = 0; // usable size of the live allocations
+
+static void* _countingAlloc(size_t bytes)
+{
+    ++allocations;
+    allocated_bytes += bytes;
+    void* ptr = malloc(bytes);
+    held_bytes += malloc_usable_size(ptr);
+    return ptr;
+}
+
+static void* _countingRealloc(void* ptr, size_t bytes)
+{
+    ++allocations;
+    allocated_bytes += bytes;
+    held_bytes -= malloc_usable_size(ptr);
+    ptr = realloc(ptr, bytes);
+    held_bytes += malloc_usable_size(ptr);
+    return ptr;
+}
+
+static void _countingFree(void* ptr)
+{
+    held_bytes -= malloc_usable_size(ptr);
+    free(ptr);
+}
+
+
+//##########################################################
+//#
+//#                     Benchmark
+//#
+//#########################################################
+
+static long long _nowNs(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+
+#define BENCH_IDS_INT 0
+#define BENCH_IDS_STRING 1
+#define BENCH_IDS_GENERATED 2
+
+// the id of the i-th element, string ids are made non numeric so they stay
+// strings in AUTO mode, generated ones look like GIDPUSH ids of one node
+static size_t _benchId(int ids, long long i, char* id)
+{
+    if (ids == BENCH_IDS_GENERATED)
+    {
+        uint64_t words[2] = {0x18F2A3B4C5DULL << 16, (0xA1B2C3ULL << GENERATED_ID_COUNTER_BITS) | (uint64_t)i};
+        return format_generated_id((const char*)words, id);
+    }
+    return sprintf(id, (ids == BENCH_IDS_STRING) ? "id:%lld" : "%lld", i);
+}
+
+
+static void _bench(int engine, int ids, long long elements, long long ttls, size_t payload)
+{
+    char* element = malloc(payload + 1);
+    memset(element, 'x', payload);
+    element[payload] = '\0';
+    char id[32];
+    size_t id_len;
+
+    long long now = 0;
+    size_t held_before = held_bytes;
+    Dehydrator* dehy = _createDehydrator(engine, (ids == BENCH_IDS_INT) ? DEHYDRATOR_IDS_AUTO : DEHYDRATOR_IDS_STRING, now);
+
+    // push
+    allocations = 0;
+    allocated_bytes = 0;
+    TimeoutQueue* last_queue = NULL;
+    long long start = _nowNs();
+    for (long long i = 0; i < elements; ++i)
+    {
+        long long ttl = 1000 + (i % ttls) * 10;
+        id_len = _benchId(ids, i, id);
+        _pushElement(dehy, ttl, now + ttl, element, payload, id, id_len, &last_queue);
+    }
+    long long push_ns = _nowNs() - start;
+    size_t push_allocations = allocations;
+    size_t push_bytes = allocated_bytes;
+    size_t push_held = held_bytes - held_before;
+
+    // look every element up
+    start = _nowNs();
+    long long found = 0;
+    for (long long i = 0; i < elements; ++i)
+    {
+        id_len = _benchId(ids, i, id);
+        found += (_getNodeForID(dehy, id, id_len) != NULL);
+    }
+    long long look_ns = _nowNs() - start;
+
+    // pull every other element
+    start = _nowNs();
+    long long pulled = 0;
+    for (long long i = 0; i < elements; i += 2)
+    {
+        id_len = _benchId(ids, i, id);
+        ElementListNode* node = _getNodeForID(dehy, id, id_len);
+        _unlinkNode(dehy, node);
+        _removeNodeFromMapping(dehy, node);
+        deleteNode(dehy, node);
+        ++pulled;
+    }
+    long long pull_ns = _nowNs() - start;
+
+    start = _nowNs();
+    long long next = _dehydratorNextExpiration(dehy);
+    long long ttn_ns = _nowNs() - start;
+
+    // poll out whatever is left once everything expired
+    start = _nowNs();
+    ElementList expired = {NULL, NULL, 0};
+    _dehydratorAdvance(dehy, now + 1000 + ttls * 10, &expired, -1);
+    long long polled = expired.len;
+    ElementListNode* node;
+    while ((node = _listPop(&expired)) != NULL)
+    {
+        _removeNodeFromMapping(dehy, node);
+        deleteNode(dehy, node);
+    }
+    long long poll_ns = _nowNs() - start;
+
+    deleteDehydrator(dehy);
+    free(element);
+
+    if ((found != elements) || (pulled + polled != elements) || (next < 0))
+    {
+        printf("ERROR: lost elements (found %lld, pulled %lld, polled %lld)\n", found, pulled, polled);
+        exit(1);
+    }
+    printf("%-6s %-6s %9lld %6lld %6zu | %8.1f %8.1f %8.1f %8.1f %8lld | %6.2f %8.1f %8.1f\n",
+        (engine == DEHYDRATOR_ENGINE_WHEEL) ? "wheel" : "queues",
+        (ids == BENCH_IDS_GENERATED) ? "gen" : (ids == BENCH_IDS_STRING) ? "string" : "int",
+        elements, ttls, payload,
+        (double)push_ns / elements, (double)look_ns / elements,
+        (double)pull_ns / pulled, (double)poll_ns / (polled ? polled : 1), ttn_ns,
+        (double)push_allocations / elements, (double)push_bytes / elements, (double)push_held / elements);
+}
+
+
+int main(int argc, char** argv)
+{
+    long long max_elements = (argc > 1) ? atoll(argv[1]) : 1000000;
+    if (max_elements <= 0)
+    {
+        printf("ERROR: elements must be a positive integer.\n");
+        return 1;
+    }
+
+    dehydrator_alloc = _countingAlloc;
+    dehydrator_realloc = _countingRealloc;
+    dehydrator_free = _countingFree;
+
+    int engines[] = {DEHYDRATOR_ENGINE_QUEUES, DEHYDRATOR_ENGINE_WHEEL};
+    int ids[] = {BENCH_IDS_INT, BENCH_IDS_STRING, BENCH_IDS_GENERATED};
+    long long ttls[] = {1, 100, 10000};
+    size_t payloads[] = {0, 16, 256};
+
+    printf("%-6s %-6s %9s %6s %6s | %8s %8s %8s %8s %8s | %6s %8s %8s\n",
+        "engine", "ids", "elements", "ttls", "bytes",
+        "push ns", "look ns", "pull ns", "poll ns", "ttn ns", "allocs", "bytes", "held");
+    for (int e = 0; e < 2; ++e)
+    {
+        for (int d = 0; d < 3; ++d)
+        {
+            for (long long n = 1000; n <= max_elements; n *= 10)
+            {
+                for (int t = 0; t < 3; ++t)
+                {
+                    for (int p = 0; p < 3; ++p)
+                    {
+                        _bench(engines[e], ids[d], n, ttls[t], payloads[p]);
+                    }
+                }
+            }
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,2251 @@
+#include "dehydrator.h"
+#include <stdio.h>
+#include <limits.h>
+#include <time.h>
+#include <unistd.h>
+
+
+void* (*dehydrator_alloc)(size_t bytes) = malloc;
+void* (*dehydrator_realloc)(void* ptr, size_t bytes) = realloc;
+void (*dehydrator_free)(void* ptr) = free;
+
+
+//##########################################################
+//#
+//#                    C Utilities
+//#
+//#########################################################
+
+char* string_append(char* a, const char* b)
+{
+    char* retstr = dehydrator_alloc(strlen(a)+strlen(b)+1);
+    strcpy(retstr, a);
+    strcat(retstr, b);
+    // printf("printing: %s", retstr);
+    dehydrator_free(a);
+    return retstr;
+}
+
+
+// parse a string holding an integer in its canonical decimal form (so that
+// printing it back gives the same string), returns 1 on success
+int parse_int_id(const char* str, size_t len, long long* value)
+{
+    if ((len == 0) || (len > 20)) { return 0; }
+    int negative = (str[0] == '-');
+    size_t i = negative ? 1 : 0;
+    if (i == len) { return 0; }
+    if ((str[i] == '0') && ((len > i + 1) || negative)) { return 0; } // leading zeros and "-0"
+
+    // accumulate as a negative number so LLONG_MIN fits too
+    long long result = 0;
+    for (; i < len; ++i)
+    {
+        int digit = str[i] - '0';
+        if ((digit < 0) || (digit > 9)) { return 0; }
+        if (result < (LLONG_MIN + digit) / 10) { return 0; } // overflow
+        result = result * 10 - digit;
+    }
+    if (!negative)
+    {
+        if (result == LLONG_MIN) { return 0; }
+        result = -result;
+    }
+    *value = result;
+    return 1;
+}
+
+
+// generated ids are written as a leading digit and two chunks of
+// BASE36_CHUNK_DIGITS digits, each chunk fits in 64 bits. they are printed
+// in chunks of BASE36_PRINT_DIGITS digits, which fit in 32 bits, so the
+// 128 bit value is only ever divided a 32 bit limb at a time. 128 bit
+// divisions would need libgcc, which the module is not linked with
+#define BASE36_CHUNK 4738381338321616896ULL // 36^12
+#define BASE36_CHUNK_DIGITS 12
+#define BASE36_PRINT_CHUNK 2176782336ULL // 36^6
+#define BASE36_PRINT_DIGITS 6
+
+
+// parse a string holding a generated id (GENERATED_ID_LENGTH uppercase base36
+// digits of a value that fits in 128 bits) into its GENERATED_ID_BYTES binary
+// value, printing it back gives the same string. returns 1 on success
+int parse_generated_id(const char* str, size_t len, char* id)
+{
+    if (len != GENERATED_ID_LENGTH) { return 0; }
+    uint64_t parts[3] = {0, 0, 0};
+    size_t i;
+    for (i = 0; i < len; ++i)
+    {
+        char c = str[i];
+        int digit;
+        if ((c >= '0') && (c <= '9')) { digit = c - '0'; }
+        else if ((c >= 'A') && (c <= 'Z')) { digit = c - 'A' + 10; }
+        else { return 0; }
+        int part = (i == 0) ? 0 : (i <= BASE36_CHUNK_DIGITS) ? 1 : 2;
+        parts[part] = parts[part] * 36 + digit;
+    }
+    // value = (parts[0] * 36^12 + parts[1]) * 36^12 + parts[2], the first
+    // product is under 2^68 so it takes a 64 bit high word of at most 4 bits
+    unsigned __int128 high = (unsigned __int128)parts[0] * BASE36_CHUNK + parts[1];
+    unsigned __int128 low = (unsigned __int128)(uint64_t)high * BASE36_CHUNK + parts[2];
+    unsigned __int128 top = (unsigned __int128)(uint64_t)(high >> 64) * BASE36_CHUNK + (uint64_t)(low >> 64);
+    if ((top >> 64) != 0) { return 0; } // beyond 128 bits
+    uint64_t words[2] = {(uint64_t)top, (uint64_t)low};
+    memcpy(id, words, GENERATED_ID_BYTES);
+    return 1;
+}
+
+
+// print the binary value of a generated id into `buf`, GENERATED_ID_LENGTH
+// digits and a NUL. returns the length
+size_t format_generated_id(const char* id, char* buf)
+{
+    static const char digits[] = "0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZ";
+    uint64_t words[2];
+    memcpy(words, id, GENERATED_ID_BYTES);
+    uint32_t limbs[4] = {(uint32_t)(words[0] >> 32), (uint32_t)words[0],
+                         (uint32_t)(words[1] >> 32), (uint32_t)words[1]};
+
+    // each pass divides the value by BASE36_PRINT_CHUNK, most significant limb
+    // first, and prints the remainder as the next chunk of digits from the end
+    int pos = GENERATED_ID_LENGTH;
+    buf[pos] = '\0';
+    while (pos > 0)
+    {
+        uint64_t rem = 0;
+        int limb, i;
+        for (limb = 0; limb < 4; ++limb)
+        {
+            uint64_t cur = (rem << 32) | limbs[limb];
+            limbs[limb] = (uint32_t)(cur / BASE36_PRINT_CHUNK);
+            rem = cur % BASE36_PRINT_CHUNK;
+        }
+        for (i = 0; (i < BASE36_PRINT_DIGITS) && (pos > 0); ++i)
+        {
+            buf[--pos] = digits[rem % 36];
+            rem /= 36;
+        }
+    }
+    return GENERATED_ID_LENGTH;
+}
+
+
+static uint64_t id_node = 0;
+static uint64_t id_counter = 0;
+static int id_seeded = 0;
+
+
+static void _seedIdGenerator(void)
+{
+    FILE* urandom = fopen("/dev/urandom", "rb");
+    if ((urandom == NULL) || (fread(&id_node, sizeof(id_node), 1, urandom) != 1))
+    {
+        struct timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        id_node = ((uint64_t)ts.tv_nsec << 24) ^ ((uint64_t)ts.tv_sec << 8) ^ (uint64_t)getpid();
+    }
+    if (urandom != NULL) { fclose(urandom); }
+    id_node &= (1ULL << GENERATED_ID_NODE_BITS) - 1;
+    id_seeded = 1;
+}
+
+
+// write a new unique id into `buf` (GENERATED_ID_LENGTH digits and a NUL),
+// generated at unix time `now` in ms. ids of the same node sort by time
+void _generateId(long long now, char* buf)
+{
+    if (!id_seeded) { _seedIdGenerator(); }
+
+    // the timestamp fills the high word down to the top bits of the node id
+    uint64_t counter = id_counter++ & ((1ULL << GENERATED_ID_COUNTER_BITS) - 1);
+    uint64_t words[2];
+    words[0] = (((uint64_t)now & ((1ULL << 48) - 1)) << 16) | (id_node >> (64 - GENERATED_ID_COUNTER_BITS));
+    words[1] = (id_node << GENERATED_ID_COUNTER_BITS) | counter;
+    char id[GENERATED_ID_BYTES];
+    memcpy(id, words, GENERATED_ID_BYTES);
+    format_generated_id(id, buf);
+}
+
+
+//##########################################################
+//#
+//#                   Slab Allocator
+//#
+//#########################################################
+
+void _slabPoolInit(SlabPool* pool, size_t object_size)
+{
+    pool->slabs = NULL;
+    pool->free_list = NULL;
+    pool->bump = NULL;
+    pool->bump_end = NULL;
+    // keep every object pointer aligned, and large enough to hold the free list link
+    object_size = (object_size + sizeof(void*) - 1) & ~(sizeof(void*) - 1);
+    pool->object_size = (object_size < sizeof(void*)) ? sizeof(void*) : object_size;
+    pool->next_slab_objects = SLAB_MIN_OBJECTS;
+    pool->max_slab_objects = SLAB_MAX_OBJECTS;
+    pool->slab_count = 0;
+    pool->capacity = 0;
+    pool->used = 0;
+    pool->bytes = 0;
+}
+
+
+void* _slabAlloc(SlabPool* pool)
+{
+    void* object;
+    if (pool->free_list != NULL)
+    {
+        object = pool->free_list;
+        pool->free_list = *(void**)object;
+    }
+    else
+    {
+        if (pool->bump == pool->bump_end)
+        {
+            size_t objects = pool->next_slab_objects;
+            size_t slab_size = sizeof(Slab) + objects * pool->object_size;
+            Slab* slab = (Slab*)dehydrator_alloc(slab_size);
+            slab->next = pool->slabs;
+            slab->objects = objects;
+            pool->slabs = slab;
+            pool->bump = (char*)(slab + 1);
+            pool->bump_end = pool->bump + objects * pool->object_size;
+            pool->slab_count = pool->slab_count + 1;
+            pool->capacity = pool->capacity + objects;
+            pool->bytes = pool->bytes + slab_size;
+            if (pool->next_slab_objects < pool->max_slab_objects)
+            {
+                pool->next_slab_objects = pool->next_slab_objects * 2;
+            }
+        }
+        object = pool->bump;
+        pool->bump = pool->bump + pool->object_size;
+    }
+    pool->used = pool->used + 1;
+    return object;
+}
+
+
+void _slabFree(SlabPool* pool, void* object)
+{
+    *(void**)object = pool->free_list;
+    pool->free_list = object;
+    pool->used = pool->used - 1;
+}
+
+
+// let the slabs of the pool keep growing while it takes about `objects` more
+// objects, so a bulk of them is carved out of a few large slabs
+void _slabPoolExpect(SlabPool* pool, size_t objects)
+{
+    if (objects > SLAB_ARENA_MAX_OBJECTS) { objects = SLAB_ARENA_MAX_OBJECTS; }
+    if (objects > pool->max_slab_objects) { pool->max_slab_objects = objects; }
+}
+
+
+// return every slab to the allocator at once, invalidating all objects
+void _slabPoolRelease(SlabPool* pool)
+{
+    Slab* slab = pool->slabs;
+    while (slab != NULL)
+    {
+        Slab* next = slab->next;
+        dehydrator_free(slab);
+        slab = next;
+    }
+    _slabPoolInit(pool, pool->object_size);
+}
+
+
+char* printSlabPool(SlabPool* pool)
+{
+    char* pool_str = dehydrator_alloc(128*sizeof(char));
+    sprintf(pool_str, "used: %lld capacity: %lld slabs: %lld bytes: %lld",
+        pool->used, pool->capacity, pool->slab_count, pool->bytes);
+    return pool_str;
+}
+
+//##########################################################
+//#
+//#              Linked List Functions
+//#
+//#########################################################
+
+
+static inline int _nodeIsEmbedded(ElementListNode* node, const char* str)
+{
+    return (str >= node->data) && (str < node->data + node->size_class * NODE_EMBED_STEP);
+}
+
+
+// the back link of a timing wheel node, in the word after its embedded bytes.
+// only the node pools of wheel dehydrators have room for it
+static inline ElementListNode** _nodePrev(ElementListNode* node)
+{
+    return (ElementListNode**)(node->data + node->size_class * NODE_EMBED_STEP);
+}
+
+
+// copy a string into the node, after `offset` embedded bytes if it fits
+char* _nodeStoreString(ElementListNode* node, size_t offset, const char* str, size_t len)
+{
+    char* dest;
+    if (offset + len + 1 <= node->size_class * NODE_EMBED_STEP)
+    {
+        dest = node->data + offset;
+    }
+    else
+    {
+        dest = dehydrator_alloc(len + 1);
+    }
+    memcpy(dest, str, len);
+    dest[len] = '\0';
+    return dest;
+}
+
+
+//Creates a new Node and returns pointer to it.
+ElementListNode* _createNewNode(Dehydrator* dehydrator, const char* element, size_t element_len,
+                                const char* element_id, size_t element_id_len, long long expiration)
+{
+    // integer ids are kept in the node itself, generated ids are embedded in
+    // binary, otherwise the element id is embedded first and the element only if both fit
+    long long int_id = 0;
+    char generated_id[GENERATED_ID_BYTES];
+    int has_int_id = (dehydrator->id_mode != DEHYDRATOR_IDS_STRING) &&
+                     parse_int_id(element_id, element_id_len, &int_id);
+    int has_generated_id = (dehydrator->id_mode == DEHYDRATOR_IDS_STRING) &&
+                           parse_generated_id(element_id, element_id_len, generated_id);
+    size_t embedded_len = 0;
+    if (has_generated_id)
+    {
+        embedded_len = GENERATED_ID_BYTES;
+    }
+    else if ((!has_int_id) && (element_id_len + 1 <= NODE_EMBED_MAX))
+    {
+        embedded_len = element_id_len + 1;
+    }
+    if (embedded_len + element_len + 1 <= NODE_EMBED_MAX)
+    {
+        embedded_len = embedded_len + element_len + 1;
+    }
+    int size_class = (embedded_len + NODE_EMBED_STEP - 1) / NODE_EMBED_STEP;
+
+    ElementListNode* newNode
+        = (ElementListNode*)_slabAlloc(&(dehydrator->node_pools[size_class]));
+    newNode->size_class = size_class;
+    newNode->has_int_id = has_int_id;
+    newNode->has_generated_id = has_generated_id;
+    newNode->dead = 0;
+
+    size_t offset = 0;
+    if (has_int_id)
+    {
+        newNode->int_id = int_id;
+        newNode->element_id_len = 0;
+    }
+    else if (has_generated_id)
+    {
+        newNode->element_id = newNode->data;
+        memcpy(newNode->element_id, generated_id, GENERATED_ID_BYTES);
+        newNode->element_id_len = GENERATED_ID_BYTES;
+        offset = GENERATED_ID_BYTES;
+    }
+    else
+    {
+        newNode->element_id = _nodeStoreString(newNode, 0, element_id, element_id_len);
+        newNode->element_id_len = element_id_len;
+        offset = _nodeIsEmbedded(newNode, newNode->element_id) ? element_id_len + 1 : 0;
+    }
+    newNode->element = _nodeStoreString(newNode, offset, element, element_len);
+    newNode->element_len = element_len;
+    dehydrator->id_bytes += has_int_id ? sizeof(long long) : newNode->element_id_len;
+    dehydrator->element_bytes += element_len;
+    newNode->expiration = expiration;
+    newNode->slot = -1;
+    newNode->next = NULL;
+    return newNode;
+}
+
+
+// replace the element of a node, embedding it in place when it fits
+void _nodeSetElement(Dehydrator* dehydrator, ElementListNode* node, const char* element, size_t element_len)
+{
+    dehydrator->element_bytes += element_len - node->element_len;
+    if (!_nodeIsEmbedded(node, node->element))
+    {
+        dehydrator_free(node->element);
+    }
+    size_t offset = 0;
+    if (node->has_generated_id)
+    {
+        offset = GENERATED_ID_BYTES;
+    }
+    else if ((!node->has_int_id) && _nodeIsEmbedded(node, node->element_id))
+    {
+        offset = node->element_id_len + 1;
+    }
+    node->element = _nodeStoreString(node, offset, element, element_len);
+    node->element_len = element_len;
+}
+
+
+// the element id as a string, integer and generated ids are printed into
+// `buf` (ELEMENT_ID_BUF_SIZE bytes)
+const char* _nodeElementId(ElementListNode* node, char* buf, size_t* len)
+{
+    if (node->has_int_id)
+    {
+        *len = sprintf(buf, "%lld", node->int_id);
+        return buf;
+    }
+    if (node->has_generated_id)
+    {
+        *len = format_generated_id(node->element_id, buf);
+        return buf;
+    }
+    *len = node->element_id_len;
+    return node->element_id;
+}
+
+
+// free the strings too long to be embedded in the node
+void _nodeFreeStrings(ElementListNode* node)
+{
+    if ((!node->has_int_id) && (!_nodeIsEmbedded(node, node->element_id)))
+    {
+        dehydrator_free(node->element_id);
+    }
+    if (!_nodeIsEmbedded(node, node->element))
+    {
+        dehydrator_free(node->element);
+    }
+}
+
+
+// release what the node keeps besides itself
+static void _nodeDropContents(Dehydrator* dehydrator, ElementListNode* node)
+{
+    dehydrator->id_bytes -= node->has_int_id ? sizeof(long long) : node->element_id_len;
+    dehydrator->element_bytes -= node->element_len;
+    _nodeFreeStrings(node);
+}
+
+
+void deleteNode(Dehydrator* dehydrator, ElementListNode* node)
+{
+    // free everything else related to the node
+    _nodeDropContents(dehydrator, node);
+    _slabFree(&(dehydrator->node_pools[node->size_class]), node);
+}
+
+
+// free a dead node taken out of its queue, its contents went with the pull
+static void _reclaimDeadNode(Dehydrator* dehydrator, ElementListNode* node)
+{
+    dehydrator->dead = dehydrator->dead - 1;
+    _slabFree(&(dehydrator->node_pools[node->size_class]), node);
+}
+
+
+// insert a Node at tail of linked list, linking it forward only
+void _listPush(ElementList* list, ElementListNode* node)
+{
+    node->next = NULL;
+    if (list->tail == NULL)
+    {
+        list->head = node;
+    }
+    else
+    {
+        list->tail->next = node;
+    }
+    list->tail = node;
+    list->len = (list->len) + 1;
+}
+
+
+// pull and return the element at the first location
+ElementListNode* _listPop(ElementList* list) {
+   if ((list == NULL) || (list->head == NULL)) { return NULL; } // if list empty
+
+   //save current head
+   ElementListNode* node = list->head;
+
+   if (list->len == 1)
+   {
+       list->tail = NULL;
+       list->head = NULL;
+   }
+   else
+   {
+       // swap to new head, its back link is never read while it heads the list
+       list->head = list->head->next;
+   }
+
+   list->len = list->len - 1;
+   return node;
+
+}
+
+
+// insert a wheel node at the tail of its slot list, linking it both ways
+void _listPushLinked(ElementList* list, ElementListNode* node)
+{
+    *_nodePrev(node) = list->tail;
+    _listPush(list, node);
+}
+
+
+// remove a node from anywhere in a list of wheel nodes, the list is left
+// empty if it was the last one
+void _listUnlink(ElementList* list, ElementListNode* node)
+{
+    if (list->len == 1)
+    {
+        list->head = NULL;
+        list->tail = NULL;
+        list->len = 0;
+        return;
+    }
+
+    //hort circuit the node (carefull! pulling from tail or head)
+    ElementListNode* prev = *_nodePrev(node);
+    if (node == list->head)
+    {
+        list->head = list->head->next;
+    }
+    else
+    {
+        prev->next = node->next;
+    }
+
+    if (node == list->tail) {
+        list->tail = prev;
+        list->tail->next = NULL;
+    }
+    else
+    {
+        *_nodePrev(node->next) = prev;
+    }
+    list->len = list->len - 1;
+}
+
+
+// pull from list and return an element with the following id
+ElementListNode* _listFind(ElementList* list, const char* element_id)
+{
+    //start from head
+    ElementListNode* current = list->head;
+
+    if (current == NULL) { return NULL; } //list is empty
+
+    // iterate over queue and find the element that has id = element_id
+    char buf[ELEMENT_ID_BUF_SIZE];
+    size_t len;
+    while (current->dead || (strcmp(_nodeElementId(current, buf, &len), element_id) != 0))
+    {
+        if (current->next == NULL) { return NULL; } // got to tail
+        current = current->next; //move to next node
+    }
+
+    return current;
+}
+
+
+char* printNode(ElementListNode* node, long long expiration)
+{
+    if (node->dead)
+    {
+        char* node_str = (char*)dehydrator_alloc(80);
+        sprintf(node_str, "[dead,exp=%lld]", expiration);
+        return node_str;
+    }
+    char buf[ELEMENT_ID_BUF_SIZE];
+    size_t element_id_len;
+    const char* element_id = _nodeElementId(node, buf, &element_id_len);
+    char* node_str = (char*)dehydrator_alloc((element_id_len+node->element_len+50)*sizeof(char));
+    sprintf(node_str, "[id=%s,elem=%s,exp=%lld]", element_id, node->element, expiration);
+    return node_str;
+
+}
+
+
+char* printList(ElementList* list)
+{
+    char* list_str = dehydrator_alloc(32*sizeof(char));
+    ElementListNode* current = list->head;
+    sprintf(list_str, "(elements=%d)\n   head", list->len);
+    // iterate over queue and find the element that has id = element_id
+    while(current != NULL)
+    {
+        list_str = string_append(list_str, "->");
+        char* node_str = printNode(current, current->expiration);
+        list_str = string_append(list_str, node_str);
+        dehydrator_free(node_str);
+
+        current = current->next;  //move to next node
+    }
+    list_str = string_append(list_str, "\n   tail points to: ");
+    char buf[ELEMENT_ID_BUF_SIZE];
+    size_t len;
+    list_str = string_append(list_str, list->tail->dead ? "(dead)" : _nodeElementId(list->tail, buf, &len));
+    list_str = string_append(list_str,"\n");
+    return list_str;
+}
+
+
+//##########################################################
+//#
+//#              Timeout Queue Functions
+//#
+//#########################################################
+
+
+TimeoutQueue* _createNewQueue(Dehydrator* dehydrator, int ttl)
+{
+    TimeoutQueue* queue
+        = (TimeoutQueue*)_slabAlloc(&(dehydrator->queue_pool));
+    queue->head = NULL;
+    queue->tail = NULL;
+    queue->spare = NULL;
+    queue->ttl = ttl;
+    queue->len = 0;
+    queue->heap_index = -1;
+    return queue;
+}
+
+
+// free the blocks of a queue, not the nodes in them
+static void _queueFreeBlocks(TimeoutQueue* queue)
+{
+    QueueBlock* block = queue->head;
+    while (block != NULL)
+    {
+        QueueBlock* next = block->next;
+        dehydrator_free(block);
+        block = next;
+    }
+    dehydrator_free(queue->spare);
+}
+
+
+void deleteQueue(Dehydrator* dehydrator, TimeoutQueue* queue)
+{
+    QueueIterator iter;
+    ElementListNode* node;
+    _queueIterInit(queue, &iter);
+    while ((node = _queueIterNext(&iter)) != NULL)
+    {
+        if (node->dead)
+        {
+            _reclaimDeadNode(dehydrator, node);
+        }
+        else
+        {
+            deleteNode(dehydrator, node);
+        }
+    }
+    _queueFreeBlocks(queue);
+    _slabFree(&(dehydrator->queue_pool), queue);
+}
+
+
+static inline long long _queueHeadExpiration(TimeoutQueue* queue)
+{
+    return queue->head->epoch + queue->head->offsets[queue->head->start];
+}
+
+
+static inline long long _queueTailExpiration(TimeoutQueue* queue)
+{
+    return queue->tail->epoch + queue->tail->offsets[queue->tail->end - 1];
+}
+
+
+// the expiration of a node in a timeout queue, read off its entry
+long long _queueNodeExpiration(ElementListNode* node)
+{
+    return node->block->epoch + node->block->offsets[node->slot];
+}
+
+
+// chain a new tail block of `capacity` entries to the queue, or its spare one if it has it
+static QueueBlock* _queueAddBlock(TimeoutQueue* queue, int capacity)
+{
+    QueueBlock* block = queue->spare;
+    if (block != NULL)
+    {
+        queue->spare = NULL;
+    }
+    else
+    {
+        if (capacity < QUEUE_BLOCK_MIN_ENTRIES) { capacity = QUEUE_BLOCK_MIN_ENTRIES; }
+        if (capacity > QUEUE_BLOCK_MAX_ENTRIES) { capacity = QUEUE_BLOCK_MAX_ENTRIES; }
+        block = (QueueBlock*)dehydrator_alloc(sizeof(QueueBlock) +
+            capacity * (sizeof(ElementListNode*) + sizeof(uint32_t)));
+        block->queue = queue;
+        block->offsets = (uint32_t*)(block->nodes + capacity);
+        block->capacity = capacity;
+    }
+    block->start = 0;
+    block->end = 0;
+    block->live = 0;
+    block->next = NULL;
+    block->prev = queue->tail;
+    if (queue->tail == NULL)
+    {
+        queue->head = block;
+    }
+    else
+    {
+        queue->tail->next = block;
+    }
+    queue->tail = block;
+    return block;
+}
+
+
+// unchain a block with no entries left, keeping it as the queue's spare if
+// it is the largest size and the queue has none
+static void _queueReleaseBlock(Dehydrator* dehydrator, TimeoutQueue* queue, QueueBlock* block)
+{
+    if (block->prev == NULL)
+    {
+        queue->head = block->next;
+    }
+    else
+    {
+        block->prev->next = block->next;
+    }
+    if (block->next == NULL)
+    {
+        queue->tail = block->prev;
+    }
+    else
+    {
+        block->next->prev = block->prev;
+    }
+    if (block == dehydrator->compact_block)
+    {
+        dehydrator->compact_block = block->next;
+        dehydrator->compact_index = (block->next != NULL) ? block->next->start : 0;
+    }
+    if ((queue->spare == NULL) && (block->capacity == QUEUE_BLOCK_MAX_ENTRIES))
+    {
+        queue->spare = block;
+    }
+    else
+    {
+        dehydrator_free(block);
+    }
+}
+
+
+// size the first block of a new queue for the `entries` about to be pushed
+// to it, as on RDB load
+void _queueExpect(TimeoutQueue* queue, size_t entries)
+{
+    if (queue->tail == NULL)
+    {
+        _queueAddBlock(queue, (entries < QUEUE_BLOCK_MAX_ENTRIES) ? (int)entries : QUEUE_BLOCK_MAX_ENTRIES);
+    }
+}
+
+
+// insert a Node at the tail of the queue, it must not expire before the tail.
+// its expiration moves to the entry, the node's own is not read while queued
+void _queuePush(TimeoutQueue* queue, ElementListNode* node)
+{
+    QueueBlock* block = queue->tail;
+    if ((block == NULL) || (block->end == block->capacity) ||
+        ((block->end > 0) && ((node->expiration < block->epoch) ||
+                              (node->expiration - block->epoch > QUEUE_BLOCK_MAX_OFFSET))))
+    {
+        block = _queueAddBlock(queue, (block == NULL) ? QUEUE_BLOCK_MIN_ENTRIES : block->capacity * 2);
+    }
+    int index = block->end;
+    if (index == 0)
+    {
+        block->epoch = node->expiration;
+    }
+    block->offsets[index] = (uint32_t)(node->expiration - block->epoch);
+    block->nodes[index] = node;
+    block->end = index + 1;
+    block->live = block->live + 1;
+    queue->len = queue->len + 1;
+    node->block = block;
+    node->slot = index;
+}
+
+
+// clear the entry of a node leaving its queue. a block left with no entries
+// is released, unless it is the last one and the queue is to be dropped
+static void _queueClearEntry(Dehydrator* dehydrator, QueueBlock* block, int index)
+{
+    TimeoutQueue* queue = block->queue;
+    block->nodes[index] = NULL;
+    block->live = block->live - 1;
+    queue->len = queue->len - 1;
+    if (block->live == 0)
+    {
+        if (queue->head == queue->tail)
+        {
+            block->start = 0;
+            block->end = 0;
+        }
+        else
+        {
+            _queueReleaseBlock(dehydrator, queue, block);
+        }
+        return;
+    }
+
+    // keep both ends on taken entries, a trimmed tail is appended to again
+    if (index == block->start)
+    {
+        while (block->nodes[block->start] == NULL) { block->start = block->start + 1; }
+    }
+    if (index == block->end - 1)
+    {
+        while (block->nodes[block->end - 1] == NULL) { block->end = block->end - 1; }
+    }
+}
+
+
+void _queueIterInit(TimeoutQueue* queue, QueueIterator* iter)
+{
+    iter->block = queue->head;
+    iter->index = (queue->head != NULL) ? queue->head->start : 0;
+}
+
+
+// the next node of the queue, or NULL past its tail
+ElementListNode* _queueIterNext(QueueIterator* iter)
+{
+    while (iter->block != NULL)
+    {
+        while (iter->index < iter->block->end)
+        {
+            ElementListNode* node = iter->block->nodes[iter->index];
+            iter->index = iter->index + 1;
+            if (node != NULL) { return node; }
+        }
+        iter->block = iter->block->next;
+        iter->index = (iter->block != NULL) ? iter->block->start : 0;
+    }
+    return NULL;
+}
+
+
+char* printQueue(TimeoutQueue* queue)
+{
+    int blocks = 0;
+    QueueBlock* block;
+    for (block = queue->head; block != NULL; block = block->next)
+    {
+        ++blocks;
+    }
+    char* queue_str = dehydrator_alloc(64*sizeof(char));
+    sprintf(queue_str, "(elements=%d, blocks=%d)\n   head", queue->len, blocks);
+    QueueIterator iter;
+    ElementListNode* node;
+    _queueIterInit(queue, &iter);
+    while ((node = _queueIterNext(&iter)) != NULL)
+    {
+        queue_str = string_append(queue_str, "->");
+        char* node_str = printNode(node, _queueNodeExpiration(node));
+        queue_str = string_append(queue_str, node_str);
+        dehydrator_free(node_str);
+    }
+    queue_str = string_append(queue_str, "\n   tail points to: ");
+    if (queue->len > 0)
+    {
+        ElementListNode* tail = queue->tail->nodes[queue->tail->end - 1];
+        char buf[ELEMENT_ID_BUF_SIZE];
+        size_t len;
+        queue_str = string_append(queue_str, tail->dead ? "(dead)" : _nodeElementId(tail, buf, &len));
+    }
+    queue_str = string_append(queue_str,"\n");
+    return queue_str;
+}
+
+
+//##########################################################
+//#
+//#              Queue Heads Index Functions
+//#
+//#########################################################
+
+
+static inline int _headsLess(QueueHeads* heads, int a, int b)
+{
+    return _queueHeadExpiration(heads->queues[a]) < _queueHeadExpiration(heads->queues[b]);
+}
+
+
+static inline void _headsSwap(QueueHeads* heads, int a, int b)
+{
+    TimeoutQueue* tmp = heads->queues[a];
+    heads->queues[a] = heads->queues[b];
+    heads->queues[b] = tmp;
+    heads->queues[a]->heap_index = a;
+    heads->queues[b]->heap_index = b;
+}
+
+
+void _headsSiftUp(QueueHeads* heads, int index)
+{
+    while (index > 0)
+    {
+        int parent = (index - 1) / 2;
+        if (!_headsLess(heads, index, parent)) { break; }
+        _headsSwap(heads, index, parent);
+        index = parent;
+    }
+}
+
+
+void _headsSiftDown(QueueHeads* heads, int index)
+{
+    while (1)
+    {
+        int smallest = index;
+        int left = 2 * index + 1;
+        int right = left + 1;
+        if ((left < heads->len) && _headsLess(heads, left, smallest)) { smallest = left; }
+        if ((right < heads->len) && _headsLess(heads, right, smallest)) { smallest = right; }
+        if (smallest == index) { break; }
+        _headsSwap(heads, index, smallest);
+        index = smallest;
+    }
+}
+
+
+// index a queue that just became non-empty
+void _headsInsert(QueueHeads* heads, TimeoutQueue* queue)
+{
+    if (heads->len == heads->cap)
+    {
+        heads->cap = (heads->cap == 0) ? 16 : heads->cap * 2;
+        heads->queues = dehydrator_realloc(heads->queues, heads->cap * sizeof(TimeoutQueue*));
+    }
+    queue->heap_index = heads->len;
+    heads->queues[heads->len] = queue;
+    heads->len = heads->len + 1;
+    _headsSiftUp(heads, queue->heap_index);
+}
+
+
+void _headsRemove(QueueHeads* heads, TimeoutQueue* queue)
+{
+    int index = queue->heap_index;
+    if (index < 0) { return; }
+    heads->len = heads->len - 1;
+    if (index != heads->len)
+    {
+        _headsSwap(heads, index, heads->len);
+        _headsSiftDown(heads, index);
+        _headsSiftUp(heads, index);
+    }
+    queue->heap_index = -1;
+}
+
+
+// restore the heap order after the head of an indexed queue was replaced
+void _headsUpdate(QueueHeads* heads, TimeoutQueue* queue)
+{
+    _headsSiftDown(heads, queue->heap_index);
+    _headsSiftUp(heads, queue->heap_index);
+}
+
+
+TimeoutQueue* _headsTop(QueueHeads* heads)
+{
+    return (heads->len > 0) ? heads->queues[0] : NULL;
+}
+
+
+// the earliest head expiration after the top queue's, or -1 if there is none
+long long _headsSecondExpiration(QueueHeads* heads)
+{
+    long long next = -1;
+    int child;
+    for (child = 1; (child <= 2) && (child < heads->len); ++child)
+    {
+        long long expiration = _queueHeadExpiration(heads->queues[child]);
+        if ((next < 0) || (expiration < next))
+        {
+            next = expiration;
+        }
+    }
+    return next;
+}
+
+
+// remove an emptied timeout queue
+static void _dropQueue(Dehydrator* dehydrator, TimeoutQueue* queue)
+{
+    _headsRemove(&(dehydrator->queue_heads), queue);
+    khiter_t k = kh_get(16, dehydrator->timeout_queues, queue->ttl);
+    if (k != kh_end(dehydrator->timeout_queues))
+    {
+        kh_del(16, dehydrator->timeout_queues, k);
+    }
+    if ((dehydrator->compact_block != NULL) && (dehydrator->compact_block->queue == queue))
+    {
+        dehydrator->compact_block = NULL;
+    }
+    deleteQueue(dehydrator, queue);
+}
+
+
+// take a node out of its timeout queue through its entry, without looking
+// the queue up, dropping the queue once empty
+void _queuePull(Dehydrator* dehydrator, ElementListNode* node)
+{
+    QueueBlock* block = node->block;
+    TimeoutQueue* queue = block->queue;
+    int was_head = (block == queue->head) && (node->slot == block->start);
+    _queueClearEntry(dehydrator, block, node->slot);
+    if (queue->len == 0)
+    {
+        _dropQueue(dehydrator, queue);
+    }
+    else if (was_head)
+    {
+        _headsUpdate(&(dehydrator->queue_heads), queue);
+    }
+}
+
+//##########################################################
+//#
+//#              Timing Wheel Functions
+//#
+//#########################################################
+
+
+TimingWheel* _createTimingWheel(long long now)
+{
+    TimingWheel* wheel = (TimingWheel*)_dehydratorCalloc(1, sizeof(TimingWheel));
+    wheel->current = now;
+    return wheel;
+}
+
+
+// the nodes in the slots belong to the dehydrator's node pool and are
+// released along with it
+void deleteTimingWheel(TimingWheel* wheel)
+{
+    dehydrator_free(wheel);
+}
+
+
+// find the first set bit in a 64 bit word, going around from bit `from`
+static inline int _nextBitCyclic(uint64_t word, int from)
+{
+    uint64_t rotated = (from == 0) ? word : ((word >> from) | (word << (64 - from)));
+    return (from + __builtin_ctzll(rotated)) & 63;
+}
+
+
+// pick the slot for a given expiration, relative to the tick the wheel is on
+int _wheelSlotFor(TimingWheel* wheel, long long expiration)
+{
+    long long delta = expiration - wheel->current;
+    if (delta < 0)
+    {
+        // already expired, will be released on the very next advance
+        return WHEEL_OVERDUE_SLOT;
+    }
+    if (delta < WHEEL_ROOT_SIZE)
+    {
+        return expiration & (WHEEL_ROOT_SIZE - 1);
+    }
+
+    int level;
+    for (level = 1; level < WHEEL_LEVELS; ++level)
+    {
+        int shift = WHEEL_LEVEL_SHIFT(level);
+        if (delta < (1LL << (shift + WHEEL_LEVEL_BITS)))
+        {
+            return WHEEL_LEVEL_OFFSET(level) + ((expiration >> shift) & WHEEL_LEVEL_MASK);
+        }
+    }
+
+    // beyond the wheel horizon - park it in the last slot to be cascaded
+    // on the top level, it will be placed again once we get there
+    int shift = WHEEL_LEVEL_SHIFT(WHEEL_LEVELS - 1);
+    return WHEEL_LEVEL_OFFSET(WHEEL_LEVELS - 1) + (((wheel->current >> shift) - 1) & WHEEL_LEVEL_MASK);
+}
+
+
+void _wheelPlace(TimingWheel* wheel, ElementListNode* node)
+{
+    int slot = _wheelSlotFor(wheel, node->expiration);
+    node->slot = slot;
+    _listPushLinked(&(wheel->slots[slot]), node);
+    wheel->occupied[slot >> 6] |= (1ULL << (slot & 63));
+}
+
+
+void _wheelInsert(TimingWheel* wheel, ElementListNode* node)
+{
+    _wheelPlace(wheel, node);
+    wheel->len = wheel->len + 1;
+    if (wheel->next_valid && (node->expiration < wheel->next_expiration))
+    {
+        wheel->next_expiration = node->expiration;
+    }
+}
+
+
+void _wheelPull(TimingWheel* wheel, ElementListNode* node)
+{
+    ElementList* list = &(wheel->slots[node->slot]);
+    _listUnlink(list, node);
+    if (list->len == 0)
+    {
+        wheel->occupied[node->slot >> 6] &= ~(1ULL << (node->slot & 63));
+    }
+    if (node->expiration == wheel->next_expiration)
+    {
+        wheel->next_valid = 0;
+    }
+    node->slot = -1;
+    wheel->len = wheel->len - 1;
+}
+
+
+// detach all the nodes of a slot, leaving it empty
+ElementListNode* _wheelTakeSlot(TimingWheel* wheel, int slot)
+{
+    ElementListNode* head = wheel->slots[slot].head;
+    wheel->slots[slot].head = NULL;
+    wheel->slots[slot].tail = NULL;
+    wheel->slots[slot].len = 0;
+    wheel->occupied[slot >> 6] &= ~(1ULL << (slot & 63));
+    return head;
+}
+
+
+// first non-empty root slot at or after the current tick, going around, or -1
+int _wheelNextRootSlot(TimingWheel* wheel)
+{
+    int index = wheel->current & (WHEEL_ROOT_SIZE - 1);
+    int i;
+    for (i = 0; i <= WHEEL_ROOT_SIZE / 64; ++i)
+    {
+        int word = ((index >> 6) + i) % (WHEEL_ROOT_SIZE / 64);
+        uint64_t bits = wheel->occupied[word];
+        if (i == 0)
+        {
+            bits &= ~0ULL << (index & 63); // only slots at or after index
+        }
+        else if (i == WHEEL_ROOT_SIZE / 64)
+        {
+            bits &= ~(~0ULL << (index & 63)); // wrapped back into the first word
+        }
+        if (bits)
+        {
+            return (word << 6) + __builtin_ctzll(bits);
+        }
+    }
+    return -1;
+}
+
+
+// next slot of an upper level to be cascaded, or -1 if the level is empty.
+// a slot matching the current page was already cascaded, unless we are right at its start
+int _wheelNextLevelSlot(TimingWheel* wheel, int level, long long* tick)
+{
+    uint64_t bits = wheel->occupied[WHEEL_LEVEL_OFFSET(level) >> 6];
+    if (!bits) { return -1; }
+
+    int shift = WHEEL_LEVEL_SHIFT(level);
+    long long page = wheel->current >> shift;
+    int at_page_start = (wheel->current & ((1LL << shift) - 1)) == 0;
+    int position = page & WHEEL_LEVEL_MASK;
+    int index = _nextBitCyclic(bits, at_page_start ? position : ((position + 1) & WHEEL_LEVEL_MASK));
+    long long pages_ahead = (index - position) & WHEEL_LEVEL_MASK;
+    if ((pages_ahead == 0) && !at_page_start)
+    {
+        pages_ahead = WHEEL_LEVEL_SIZE;
+    }
+    *tick = (page + pages_ahead) << shift;
+    return WHEEL_LEVEL_OFFSET(level) + index;
+}
+
+
+// the earliest tick (>= current) on which some slot must be processed,
+// either released (root level) or cascaded down (upper levels)
+long long _wheelNextTick(TimingWheel* wheel)
+{
+    long long next_tick = -1;
+    int slot = _wheelNextRootSlot(wheel);
+    if (slot >= 0)
+    {
+        next_tick = wheel->current + ((slot - wheel->current) & (WHEEL_ROOT_SIZE - 1));
+    }
+
+    int level;
+    for (level = 1; level < WHEEL_LEVELS; ++level)
+    {
+        long long tick;
+        if (_wheelNextLevelSlot(wheel, level, &tick) < 0) { continue; }
+        if ((next_tick < 0) || (tick < next_tick))
+        {
+            next_tick = tick;
+        }
+    }
+    return next_tick;
+}
+
+
+// move up to `limit` nodes of a slot into `expired` (all of them if limit
+// is negative), returns the number of nodes moved
+long long _wheelReleaseSlot(TimingWheel* wheel, int slot, ElementList* expired, long long limit)
+{
+    ElementList* list = &(wheel->slots[slot]);
+    long long released = 0;
+    while ((list->head != NULL) && (released != limit))
+    {
+        ElementListNode* node = _listPop(list);
+        node->slot = -1;
+        _listPush(expired, node);
+        ++released;
+    }
+    if (list->len == 0)
+    {
+        wheel->occupied[slot >> 6] &= ~(1ULL << (slot & 63));
+    }
+    if (released > 0)
+    {
+        wheel->len = wheel->len - released;
+        wheel->next_valid = 0;
+    }
+    return released;
+}
+
+
+// release up to `limit` nodes expiring up to `now` (inclusive) into
+// `expired`, in expiration order (all of them if limit is negative). when
+// the limit is hit the wheel stays on the tick it stopped at, so the next
+// call resumes right there.
+void _wheelAdvance(TimingWheel* wheel, long long now, ElementList* expired, long long limit)
+{
+    long long released = _wheelReleaseSlot(wheel, WHEEL_OVERDUE_SLOT, expired, limit);
+    if (wheel->slots[WHEEL_OVERDUE_SLOT].len > 0) { return; }
+    if (limit >= 0) { limit = limit - released; }
+
+    while (wheel->len > 0)
+    {
+        long long tick = _wheelNextTick(wheel);
+        if (tick > now) { break; }
+        if (limit == 0) { return; }
+        wheel->current = tick;
+
+        // cascade every upper level that rotates on this tick, top down
+        // (when resuming a tick these slots were already emptied)
+        int level;
+        for (level = WHEEL_LEVELS - 1; level > 0; --level)
+        {
+            int shift = WHEEL_LEVEL_SHIFT(level);
+            if (tick & ((1LL << shift) - 1)) { continue; }
+            int slot = WHEEL_LEVEL_OFFSET(level) + ((tick >> shift) & WHEEL_LEVEL_MASK);
+            ElementListNode* current = _wheelTakeSlot(wheel, slot);
+            while (current != NULL)
+            {
+                ElementListNode* next = current->next;
+                _wheelPlace(wheel, current);
+                current = next;
+            }
+        }
+
+        // release the root slot of this tick
+        int slot = tick & (WHEEL_ROOT_SIZE - 1);
+        released = _wheelReleaseSlot(wheel, slot, expired, limit);
+        if (wheel->slots[slot].len > 0) { return; }
+        if (limit >= 0) { limit = limit - released; }
+        wheel->current = tick + 1;
+    }
+
+    if (wheel->current <= now)
+    {
+        // nothing is due in between, skip the empty ticks
+        wheel->current = now + 1;
+    }
+}
+
+
+// earliest expiration stored in the wheel, or -1 if it is empty
+long long _wheelNextExpiration(TimingWheel* wheel)
+{
+    if (wheel->len == 0) { return -1; }
+    if (wheel->next_valid) { return wheel->next_expiration; }
+
+    long long next_expiration = -1;
+    ElementListNode* current;
+
+    for (current = wheel->slots[WHEEL_OVERDUE_SLOT].head; current != NULL; current = current->next)
+    {
+        if ((next_expiration < 0) || (current->expiration < next_expiration))
+        {
+            next_expiration = current->expiration;
+        }
+    }
+
+    // all the nodes in a root slot share the same expiration
+    int slot = _wheelNextRootSlot(wheel);
+    if (slot >= 0)
+    {
+        current = wheel->slots[slot].head;
+        if ((next_expiration < 0) || (current->expiration < next_expiration))
+        {
+            next_expiration = current->expiration;
+        }
+    }
+
+    // on upper levels the first due slot of each level holds the level minimum,
+    // nothing in it expires before the slot is due so it is only scanned when it may win
+    int level;
+    for (level = 1; level < WHEEL_LEVELS; ++level)
+    {
+        long long tick;
+        slot = _wheelNextLevelSlot(wheel, level, &tick);
+        if (slot < 0) { continue; }
+        if ((next_expiration >= 0) && (tick >= next_expiration)) { continue; }
+        for (current = wheel->slots[slot].head; current != NULL; current = current->next)
+        {
+            if ((next_expiration < 0) || (current->expiration < next_expiration))
+            {
+                next_expiration = current->expiration;
+            }
+        }
+    }
+
+    wheel->next_expiration = next_expiration;
+    wheel->next_valid = 1;
+    return next_expiration;
+}
+
+
+// number of elements expired by `now`: the overdue ones, the root slots due
+// by then (a root slot holds a single expiration) and whatever expired in
+// the upper level slots that are due by then
+long long _wheelCountExpired(TimingWheel* wheel, long long now)
+{
+    long long next_expiration = _wheelNextExpiration(wheel);
+    if ((next_expiration < 0) || (next_expiration > now)) { return 0; }
+
+    long long expired = wheel->slots[WHEEL_OVERDUE_SLOT].len;
+    int slot;
+    for (slot = 0; slot < WHEEL_ROOT_SIZE; ++slot)
+    {
+        if ((wheel->slots[slot].len > 0) && (wheel->slots[slot].head->expiration <= now))
+        {
+            expired += wheel->slots[slot].len;
+        }
+    }
+
+    int level;
+    for (level = 1; level < WHEEL_LEVELS; ++level)
+    {
+        int shift = WHEEL_LEVEL_SHIFT(level);
+        long long page = wheel->current >> shift;
+        int at_page_start = (wheel->current & ((1LL << shift) - 1)) == 0;
+        int position = page & WHEEL_LEVEL_MASK;
+        int index;
+        for (index = 0; index < WHEEL_LEVEL_SIZE; ++index)
+        {
+            ElementList* list = &(wheel->slots[WHEEL_LEVEL_OFFSET(level) + index]);
+            if (list->len == 0) { continue; }
+            // same as _wheelNextLevelSlot, the slot of the current page is a rotation ahead
+            long long pages_ahead = (index - position) & WHEEL_LEVEL_MASK;
+            if ((pages_ahead == 0) && !at_page_start)
+            {
+                pages_ahead = WHEEL_LEVEL_SIZE;
+            }
+            if (((page + pages_ahead) << shift) > now) { continue; }
+            ElementListNode* current;
+            for (current = list->head; current != NULL; current = current->next)
+            {
+                expired += (current->expiration <= now);
+            }
+        }
+    }
+    return expired;
+}
+
+
+char* printWheel(TimingWheel* wheel)
+{
+    char* wheel_str = dehydrator_alloc(64*sizeof(char));
+    sprintf(wheel_str, "(elements=%d, current=%lld)", wheel->len, wheel->current);
+    int slot;
+    for (slot = 0; slot <= WHEEL_SLOTS; ++slot)
+    {
+        if (wheel->slots[slot].len == 0) { continue; }
+        char slot_header[50];
+        sprintf(slot_header, "\n>>Slot: %d ", slot);
+        wheel_str = string_append(wheel_str, slot_header);
+        char* list_str = printList(&(wheel->slots[slot]));
+        wheel_str = string_append(wheel_str, list_str);
+        dehydrator_free(list_str);
+    }
+    return wheel_str;
+}
+
+
+//##########################################################
+//#
+//#              Lag Histogram Functions
+//#
+//#########################################################
+
+
+static inline int _lagBucket(long long lag)
+{
+    if (lag < LAG_SUB_BUCKETS) { return (lag < 0) ? 0 : (int)lag; }
+    int msb = 63 - __builtin_clzll((unsigned long long)lag);
+    if (msb >= LAG_MAX_BITS) { return LAG_BUCKETS - 1; }
+    // keep the top LAG_SUB_BITS bits, the highest of them is always set
+    int shift = msb - (LAG_SUB_BITS - 1);
+    return LAG_SUB_BUCKETS + (shift - 1) * (LAG_SUB_BUCKETS / 2)
+        + (int)(lag >> shift) - (LAG_SUB_BUCKETS / 2);
+}
+
+
+// highest lag counted in `bucket`
+static long long _lagBucketTop(int bucket)
+{
+    if (bucket < LAG_SUB_BUCKETS) { return bucket; }
+    int shift = (bucket - LAG_SUB_BUCKETS) / (LAG_SUB_BUCKETS / 2) + 1;
+    long long sub = (bucket - LAG_SUB_BUCKETS) % (LAG_SUB_BUCKETS / 2) + (LAG_SUB_BUCKETS / 2);
+    return ((sub + 1) << shift) - 1;
+}
+
+
+// count an element delivered `lag` ms after its expiration
+void _lagRecord(Dehydrator* dehydrator, long long lag)
+{
+    if (dehydrator->lag == NULL)
+    {
+        dehydrator->lag = (LagHistogram*)_dehydratorCalloc(1, sizeof(LagHistogram));
+    }
+    LagHistogram* histogram = dehydrator->lag;
+    ++histogram->counts[_lagBucket(lag)];
+    ++histogram->total;
+    if (lag > histogram->max) { histogram->max = lag; }
+}
+
+
+// lag `percentile` percent of the delivered elements did not exceed, up to
+// the bucket precision and never above the largest lag seen. 0 when empty
+long long _lagPercentile(LagHistogram* histogram, double percentile)
+{
+    if ((histogram == NULL) || (histogram->total == 0)) { return 0; }
+    uint64_t rank = (uint64_t)(percentile / 100.0 * histogram->total + 0.5);
+    if (rank < 1) { rank = 1; }
+    uint64_t seen = 0;
+    int bucket;
+    for (bucket = 0; bucket < LAG_BUCKETS; ++bucket)
+    {
+        seen += histogram->counts[bucket];
+        if (seen >= rank) { break; }
+    }
+    // the last bucket has no upper bound
+    long long top = (bucket < LAG_BUCKETS - 1) ? _lagBucketTop(bucket) : histogram->max;
+    return (top < histogram->max) ? top : histogram->max;
+}
+
+
+//##########################################################
+//#
+//#               Dehydrator Utilities
+//#
+//#########################################################
+
+// create an empty dehydrator, a wheel one starts turning at `now`
+Dehydrator* _createDehydrator(int engine, int id_mode, long long now)
+{
+
+    Dehydrator* dehy
+        = (Dehydrator*)dehydrator_alloc(sizeof(Dehydrator));
+
+    dehy->timeout_queues = kh_init(16);
+    dehy->element_nodes = kh_init(32);
+    dehy->element_int_nodes = kh_init(64);
+    dehy->element_generated_nodes = kh_init(128);
+    dehy->name = NULL;
+    dehy->engine = engine;
+    dehy->id_mode = id_mode;
+    dehy->pull_mode = DEHYDRATOR_PULL_EAGER;
+    dehy->dead = 0;
+    dehy->compact_block = NULL;
+    dehy->compact_index = 0;
+    dehy->compact_bucket = 0;
+    dehy->queue_heads.queues = NULL;
+    dehy->queue_heads.len = 0;
+    dehy->queue_heads.cap = 0;
+    dehy->wheel = NULL;
+    dehy->lag = NULL;
+    memset(&(dehy->stats), 0, sizeof(DehydratorStats));
+    dehy->id_bytes = 0;
+    dehy->element_bytes = 0;
+    dehy->wake_timer = 0;
+    dehy->wake_at = 0;
+    dehy->delivery = 0;
+    dehy->delivery_target = NULL;
+    dehy->delivery_db = 0;
+    int size_class;
+    for (size_class = 0; size_class <= NODE_SIZE_CLASSES; ++size_class)
+    {
+        // wheel nodes have their back link after the embedded bytes
+        _slabPoolInit(&(dehy->node_pools[size_class]),
+            offsetof(ElementListNode, data) + size_class * NODE_EMBED_STEP +
+            ((engine == DEHYDRATOR_ENGINE_WHEEL) ? sizeof(ElementListNode*) : 0));
+    }
+    _slabPoolInit(&(dehy->queue_pool), sizeof(TimeoutQueue));
+    if (engine == DEHYDRATOR_ENGINE_WHEEL)
+    {
+        dehy->wheel = _createTimingWheel(now);
+    }
+
+    return dehy;
+}
+
+
+// make room for `elements` elements in `queues` queues ahead of a bulk insert,
+// so the maps are sized once and the nodes come from large slabs. `generated`
+// of the elements have generated ids, they are keyed in a map of their own
+void _reserveDehydrator(Dehydrator* dehy, size_t elements, size_t generated, size_t queues)
+{
+    // khash grows once it is filled past its upper bound of the buckets
+    if (dehy->id_mode == DEHYDRATOR_IDS_STRING)
+    {
+        if (generated > elements) { generated = elements; }
+        kh_resize(32, dehy->element_nodes, (khint_t)((elements - generated) / 0.77) + 1);
+        if (generated > 0)
+        {
+            kh_resize(128, dehy->element_generated_nodes, (khint_t)(generated / 0.77) + 1);
+        }
+    }
+    else
+    {
+        kh_resize(64, dehy->element_int_nodes, (khint_t)(elements / 0.77) + 1);
+    }
+    int size_class;
+    for (size_class = 0; size_class <= NODE_SIZE_CLASSES; ++size_class)
+    {
+        _slabPoolExpect(&(dehy->node_pools[size_class]), elements);
+    }
+    if (dehy->engine == DEHYDRATOR_ENGINE_QUEUES)
+    {
+        kh_resize(16, dehy->timeout_queues, (khint_t)(queues / 0.77) + 1);
+        _slabPoolExpect(&(dehy->queue_pool), queues);
+        if (dehy->queue_heads.cap < (int)queues)
+        {
+            dehy->queue_heads.cap = queues;
+            dehy->queue_heads.queues = dehydrator_realloc(dehy->queue_heads.queues,
+                queues * sizeof(TimeoutQueue*));
+        }
+    }
+}
+
+char* printDehydrator(Dehydrator* dehydrator)
+{
+    char* dehy_str = dehydrator_alloc(sizeof(char));
+    dehy_str[0] = '\0';
+    khiter_t k;
+
+    if (dehydrator->engine == DEHYDRATOR_ENGINE_WHEEL)
+    {
+        dehy_str = string_append(dehy_str, "\n======== timing_wheel =========\n");
+        char* wheel_str = printWheel(dehydrator->wheel);
+        dehy_str = string_append(dehy_str, wheel_str);
+        dehydrator_free(wheel_str);
+    }
+
+    dehy_str = string_append(dehy_str, "\n======== timeout_queues =========");
+    for (k = kh_begin(dehydrator->timeout_queues); k != kh_end(dehydrator->timeout_queues); ++k)
+    {
+        if (kh_exist(dehydrator->timeout_queues, k))
+        {
+            TimeoutQueue* queue = kh_value(dehydrator->timeout_queues, k);
+            dehy_str = string_append(dehy_str, "\n>>List: ");
+            char qnum[50];
+            sprintf(qnum,"%d ", kh_key(dehydrator->timeout_queues, k));
+            dehy_str = string_append(dehy_str, qnum);
+
+            char* queue_str = printQueue(queue);
+            dehy_str = string_append(dehy_str, queue_str);
+            dehydrator_free(queue_str);
+        }
+    }
+    dehy_str = string_append(dehy_str, "\n");
+
+    dehy_str = string_append(dehy_str, "\n======== memory =========\n");
+    char* pool_str;
+    int size_class;
+    for (size_class = 0; size_class <= NODE_SIZE_CLASSES; ++size_class)
+    {
+        if (dehydrator->node_pools[size_class].slab_count == 0) { continue; }
+        char pool_name[50];
+        sprintf(pool_name, "nodes(+%d bytes): ", size_class * NODE_EMBED_STEP);
+        dehy_str = string_append(dehy_str, pool_name);
+        pool_str = printSlabPool(&(dehydrator->node_pools[size_class]));
+        dehy_str = string_append(dehy_str, pool_str);
+        dehydrator_free(pool_str);
+        dehy_str = string_append(dehy_str, "\n");
+    }
+    dehy_str = string_append(dehy_str, "queues: ");
+    pool_str = printSlabPool(&(dehydrator->queue_pool));
+    dehy_str = string_append(dehy_str, pool_str);
+    dehydrator_free(pool_str);
+    dehy_str = string_append(dehy_str, "\n");
+
+    dehy_str = string_append(dehy_str, "\n======== element_nodes issues =========\n");
+    int found_problems = 0;
+    for (k = kh_begin(dehydrator->element_int_nodes); k != kh_end(dehydrator->element_int_nodes); ++k)
+    {
+        if (kh_exist(dehydrator->element_int_nodes, k))
+        {
+            ElementListNode* node = kh_value(dehydrator->element_int_nodes, k);
+            if ((!node->has_int_id) || (node->int_id != kh_key(dehydrator->element_int_nodes, k)))
+            {
+                char key_str[50];
+                sprintf(key_str, "%lld", (long long)kh_key(dehydrator->element_int_nodes, k));
+                dehy_str = string_append(dehy_str, "node is stored under integer id: ");
+                dehy_str = string_append(dehy_str, key_str);
+                dehy_str = string_append(dehy_str, "\n");
+                found_problems = 1;
+            }
+        }
+    }
+    for (k = kh_begin(dehydrator->element_nodes); k != kh_end(dehydrator->element_nodes); ++k)
+    {
+        if (kh_exist(dehydrator->element_nodes, k))
+        {
+            ElementListNode* node = kh_value(dehydrator->element_nodes, k);
+            if (node->has_int_id || node->has_generated_id ||
+                (strcmp(node->element_id, kh_key(dehydrator->element_nodes, k)) != 0))
+            {
+                char buf[ELEMENT_ID_BUF_SIZE];
+                size_t len;
+                dehy_str = string_append(dehy_str, _nodeElementId(node, buf, &len));
+                dehy_str = string_append(dehy_str, "is stored under id: ");
+                dehy_str = string_append(dehy_str, kh_key(dehydrator->element_nodes, k));
+                dehy_str = string_append(dehy_str, "\n");
+                found_problems = 1;
+            }
+        }
+    }
+    for (k = kh_begin(dehydrator->element_generated_nodes); k != kh_end(dehydrator->element_generated_nodes); ++k)
+    {
+        if (kh_exist(dehydrator->element_generated_nodes, k))
+        {
+            ElementListNode* node = kh_value(dehydrator->element_generated_nodes, k);
+            if ((!node->has_generated_id) ||
+                (!_generatedIdEqual(node->element_id, kh_key(dehydrator->element_generated_nodes, k))))
+            {
+                char key_str[ELEMENT_ID_BUF_SIZE];
+                format_generated_id(kh_key(dehydrator->element_generated_nodes, k), key_str);
+                dehy_str = string_append(dehy_str, "node is stored under generated id: ");
+                dehy_str = string_append(dehy_str, key_str);
+                dehy_str = string_append(dehy_str, "\n");
+                found_problems = 1;
+            }
+        }
+    }
+    if (!found_problems)
+    {
+        dehy_str = string_append(dehy_str, "no issues were found.\n");
+    }
+    dehy_str = string_append(dehy_str, "================================\n");
+
+    return dehy_str;
+}
+
+
+void deleteDehydrator(Dehydrator* dehydrator)
+{
+    khiter_t k;
+
+    // delete the timeout_queues dictionary and the blocks of the queues, the
+    // queues and their nodes are released in bulk with the slab pools below
+    for (k = kh_begin(dehydrator->timeout_queues); k != kh_end(dehydrator->timeout_queues); ++k)
+    {
+        if (kh_exist(dehydrator->timeout_queues, k))
+        {
+            _queueFreeBlocks(kh_value(dehydrator->timeout_queues, k));
+        }
+    }
+    kh_destroy(16, dehydrator->timeout_queues);
+    dehydrator_free(dehydrator->queue_heads.queues);
+
+    if (dehydrator->wheel != NULL)
+    {
+        deleteTimingWheel(dehydrator->wheel);
+    }
+    dehydrator_free(dehydrator->lag);
+
+    // every node is in one of the element maps, free the strings they keep
+    // outside of the slabs before deleting the maps
+    for (k = kh_begin(dehydrator->element_nodes); k != kh_end(dehydrator->element_nodes); ++k)
+    {
+        if (kh_exist(dehydrator->element_nodes, k))
+        {
+            _nodeFreeStrings(kh_value(dehydrator->element_nodes, k));
+        }
+    }
+    for (k = kh_begin(dehydrator->element_int_nodes); k != kh_end(dehydrator->element_int_nodes); ++k)
+    {
+        if (kh_exist(dehydrator->element_int_nodes, k))
+        {
+            _nodeFreeStrings(kh_value(dehydrator->element_int_nodes, k));
+        }
+    }
+    for (k = kh_begin(dehydrator->element_generated_nodes); k != kh_end(dehydrator->element_generated_nodes); ++k)
+    {
+        if (kh_exist(dehydrator->element_generated_nodes, k))
+        {
+            _nodeFreeStrings(kh_value(dehydrator->element_generated_nodes, k));
+        }
+    }
+    kh_destroy(32, dehydrator->element_nodes);
+    kh_destroy(64, dehydrator->element_int_nodes);
+    kh_destroy(128, dehydrator->element_generated_nodes);
+
+    int size_class;
+    for (size_class = 0; size_class <= NODE_SIZE_CLASSES; ++size_class)
+    {
+        _slabPoolRelease(&(dehydrator->node_pools[size_class]));
+    }
+    _slabPoolRelease(&(dehydrator->queue_pool));
+
+    // the strings the module keeps in it are its own to release
+    dehydrator_free(dehydrator);
+}
+
+
+// the number of elements in the dehydrator, every one of them is in one of the element maps
+long long _dehydratorLen(Dehydrator* dehydrator)
+{
+    return kh_size(dehydrator->element_nodes) + kh_size(dehydrator->element_int_nodes) +
+           kh_size(dehydrator->element_generated_nodes);
+}
+
+
+// element ids are NUL terminated, as the buffers of Redis strings are
+ElementListNode* _getNodeForID(Dehydrator* dehydrator, const char* element_id_str, size_t element_id_len)
+{
+		if (element_id_str == NULL)
+		{
+			return NULL;
+		}
+
+        ElementListNode* node = NULL;
+
+        if (dehydrator->id_mode != DEHYDRATOR_IDS_STRING)
+        {
+            long long int_id;
+            if (!parse_int_id(element_id_str, element_id_len, &int_id)) { return NULL; }
+            khiter_t k = kh_get(64, dehydrator->element_int_nodes, int_id);
+            if (k != kh_end(dehydrator->element_int_nodes))
+            {
+                node = kh_val(dehydrator->element_int_nodes, k);
+            }
+            return node;
+        }
+
+        char generated_id[GENERATED_ID_BYTES];
+        if (parse_generated_id(element_id_str, element_id_len, generated_id))
+        {
+            khiter_t k = kh_get(128, dehydrator->element_generated_nodes, generated_id);
+            if (k != kh_end(dehydrator->element_generated_nodes))
+            {
+                node = kh_val(dehydrator->element_generated_nodes, k);
+            }
+            return node;
+        }
+
+        khiter_t k = kh_get(32, dehydrator->element_nodes, element_id_str);  // first have to get iterator
+        if (k != kh_end(dehydrator->element_nodes)) // k will be equal to kh_end if key not present
+        {
+            node = kh_val(dehydrator->element_nodes, k);
+        }
+        return node;
+}
+
+
+// hint the cpu to bring in the element map bucket `element_id` hashes to,
+// so a batch of lookups can overlap their cache misses. returns the value
+// slot of the bucket for _prefetchNodeInBucket, or NULL if there is nothing to look for.
+ElementListNode** _prefetchIdBucket(Dehydrator* dehydrator, const char* element_id_str, size_t element_id_len)
+{
+    khint_t i;
+    char generated_id[GENERATED_ID_BYTES];
+    if (dehydrator->id_mode != DEHYDRATOR_IDS_STRING)
+    {
+        khash_t(64)* map = dehydrator->element_int_nodes;
+        long long int_id;
+        if ((map->n_buckets == 0) || !parse_int_id(element_id_str, element_id_len, &int_id)) { return NULL; }
+        i = kh_int64_hash_func((khint64_t)int_id) & (map->n_buckets - 1);
+        __builtin_prefetch(&(map->flags[i >> 4]));
+        __builtin_prefetch(&(map->keys[i]));
+        __builtin_prefetch(&(map->vals[i]));
+        return &(map->vals[i]);
+    }
+    if (parse_generated_id(element_id_str, element_id_len, generated_id))
+    {
+        khash_t(128)* map = dehydrator->element_generated_nodes;
+        if (map->n_buckets == 0) { return NULL; }
+        i = _generatedIdHash(generated_id) & (map->n_buckets - 1);
+        __builtin_prefetch(&(map->flags[i >> 4]));
+        __builtin_prefetch(&(map->keys[i]));
+        __builtin_prefetch(&(map->vals[i]));
+        return &(map->vals[i]);
+    }
+    khash_t(32)* map = dehydrator->element_nodes;
+    if (map->n_buckets == 0) { return NULL; }
+    i = kh_str_hash_func(element_id_str) & (map->n_buckets - 1);
+    __builtin_prefetch(&(map->flags[i >> 4]));
+    __builtin_prefetch(&(map->keys[i]));
+    __builtin_prefetch(&(map->vals[i]));
+    return &(map->vals[i]);
+}
+
+
+// hint the cpu to bring in the node stored in a (prefetched) bucket, the
+// string keys point into the node as well. an empty bucket just wastes the hint.
+void _prefetchNodeInBucket(ElementListNode** bucket)
+{
+    if (bucket == NULL) { return; }
+    ElementListNode* node = *bucket;
+    // the embedded element follows the node header
+    __builtin_prefetch(node);
+    __builtin_prefetch((char*)node + 64);
+}
+
+
+// mark element dehytion location in the element map, DEHYDRATOR_ERR if
+// another node has its id
+int _addNodeToMapping(Dehydrator* dehydrator, ElementListNode* node)
+{
+    // kh_put sets retval to 0 when the id is there already
+    int retval;
+    khiter_t k;
+    if (node->has_int_id)
+    {
+        k = kh_put(64, dehydrator->element_int_nodes, node->int_id, &retval);
+        if (retval == 0) { return DEHYDRATOR_ERR; }
+        kh_value(dehydrator->element_int_nodes, k) = node;
+    }
+    else if (node->has_generated_id)
+    {
+        k = kh_put(128, dehydrator->element_generated_nodes, node->element_id, &retval);
+        if (retval == 0) { return DEHYDRATOR_ERR; }
+        kh_value(dehydrator->element_generated_nodes, k) = node;
+    }
+    else
+    {
+        k = kh_put(32, dehydrator->element_nodes, node->element_id, &retval);
+        if (retval == 0) { return DEHYDRATOR_ERR; }
+        kh_value(dehydrator->element_nodes, k) = node;
+    }
+    return DEHYDRATOR_OK;
+}
+
+
+// move an integer keyed dehydrator over to string element ids
+void _convertToStringIds(Dehydrator* dehydrator)
+{
+    khiter_t k;
+    for (k = kh_begin(dehydrator->element_int_nodes); k != kh_end(dehydrator->element_int_nodes); ++k)
+    {
+        if (!kh_exist(dehydrator->element_int_nodes, k)) continue;
+        ElementListNode* node = kh_value(dehydrator->element_int_nodes, k);
+        char buf[21];
+        size_t len = sprintf(buf, "%lld", node->int_id);
+        // the node has no room reserved for it, keep the id string on its own
+        node->element_id = dehydrator_alloc(len + 1);
+        memcpy(node->element_id, buf, len + 1);
+        node->element_id_len = len;
+        node->has_int_id = 0;
+        dehydrator->id_bytes += len - sizeof(long long);
+        _addNodeToMapping(dehydrator, node);
+    }
+    kh_destroy(64, dehydrator->element_int_nodes);
+    dehydrator->element_int_nodes = kh_init(64);
+    dehydrator->id_mode = DEHYDRATOR_IDS_STRING;
+}
+
+
+// check the dehydrator can key `element_id`, an AUTO dehydrator switches
+// to string ids on the first id that is not an integer
+int _acceptElementId(Dehydrator* dehydrator, const char* element_id, size_t element_id_len)
+{
+    long long int_id;
+    if ((dehydrator->id_mode == DEHYDRATOR_IDS_STRING) || parse_int_id(element_id, element_id_len, &int_id))
+    {
+        return DEHYDRATOR_OK;
+    }
+    if (dehydrator->id_mode == DEHYDRATOR_IDS_INT)
+    {
+        return DEHYDRATOR_ERR;
+    }
+    _convertToStringIds(dehydrator);
+    return DEHYDRATOR_OK;
+}
+
+// take a node out of whatever structure is keeping its expiration order
+void _unlinkNode(Dehydrator* dehydrator, ElementListNode* node)
+{
+    if (dehydrator->engine == DEHYDRATOR_ENGINE_WHEEL)
+    {
+        _wheelPull(dehydrator->wheel, node);
+    }
+    else
+    {
+        _queuePull(dehydrator, node);
+    }
+}
+
+// take a pulled node out of the dehydrator once its element was replied. a
+// lazy pull only leaves it dead in its queue, without touching its entry
+void _pullNode(Dehydrator* dehydrator, ElementListNode* node)
+{
+    _removeNodeFromMapping(dehydrator, node);
+    if ((dehydrator->pull_mode != DEHYDRATOR_PULL_LAZY) || (dehydrator->engine == DEHYDRATOR_ENGINE_WHEEL))
+    {
+        _unlinkNode(dehydrator, node);
+        deleteNode(dehydrator, node);
+        return;
+    }
+    _nodeDropContents(dehydrator, node);
+    node->dead = 1;
+    dehydrator->dead = dehydrator->dead + 1;
+    if (dehydrator->dead * 100 > (dehydrator->dead + _dehydratorLen(dehydrator)) * DEHYDRATOR_COMPACT_DEAD_PERCENT)
+    {
+        _compactStep(dehydrator, DEHYDRATOR_COMPACT_STEP);
+    }
+}
+
+
+// visit up to `budget` queue entries from where the last step stopped and
+// unlink the dead nodes. the walk goes through the queues in table order and
+// starts over after the last one
+void _compactStep(Dehydrator* dehydrator, int budget)
+{
+    khash_t(16)* queues = dehydrator->timeout_queues;
+    while ((budget > 0) && (dehydrator->dead > 0) && (kh_size(queues) > 0))
+    {
+        QueueBlock* block = dehydrator->compact_block;
+        if (block == NULL)
+        {
+            // on to the next queue
+            do
+            {
+                dehydrator->compact_bucket = dehydrator->compact_bucket + 1;
+                if (dehydrator->compact_bucket >= kh_end(queues)) { dehydrator->compact_bucket = kh_begin(queues); }
+            } while (!kh_exist(queues, dehydrator->compact_bucket));
+            block = kh_val(queues, dehydrator->compact_bucket)->head;
+            dehydrator->compact_block = block;
+            dehydrator->compact_index = block->start;
+        }
+        if (dehydrator->compact_index >= block->end)
+        {
+            dehydrator->compact_block = block->next;
+            dehydrator->compact_index = (block->next != NULL) ? block->next->start : 0;
+            continue;
+        }
+        ElementListNode* node = block->nodes[dehydrator->compact_index];
+        dehydrator->compact_index = dehydrator->compact_index + 1;
+        budget = budget - 1;
+        if ((node != NULL) && node->dead)
+        {
+            _queuePull(dehydrator, node);
+            _reclaimDeadNode(dehydrator, node);
+        }
+    }
+}
+
+
+// release up to `limit` nodes expiring up to `now` (inclusive) from the
+// timeout queues into `expired` (all of them if limit is negative). a
+// limited release merges the queues by expiration, so whatever is left is
+// still at the heads of the queues for the next call to pick up.
+void _queuesAdvance(Dehydrator* dehydrator, long long now, ElementList* expired, long long limit)
+{
+    QueueHeads* heads = &(dehydrator->queue_heads);
+    TimeoutQueue* queue;
+    while ((limit != 0) && ((queue = _headsTop(heads)) != NULL) && (_queueHeadExpiration(queue) <= now))
+    {
+        // drain this queue while it is the one expiring first
+        long long bound = now;
+        if (limit >= 0)
+        {
+            long long next = _headsSecondExpiration(heads);
+            bound = ((next >= 0) && (next < now)) ? next : now;
+        }
+
+        // the entries are read in order, prefetching the nodes a few entries
+        // ahead, and a node is only touched once it is handed out. dead nodes
+        // are freed on the way, they don't count towards the limit
+        while ((limit != 0) && (queue->len > 0))
+        {
+            QueueBlock* block = queue->head;
+            int index = block->start;
+            long long expiration = block->epoch + block->offsets[index];
+            if (expiration > bound) { break; }
+            if (index + QUEUE_PREFETCH_DISTANCE < block->end)
+            {
+                __builtin_prefetch(block->nodes[index + QUEUE_PREFETCH_DISTANCE]);
+            }
+            ElementListNode* node = block->nodes[index];
+            _queueClearEntry(dehydrator, block, index);
+            if (node->dead)
+            {
+                _reclaimDeadNode(dehydrator, node);
+                continue;
+            }
+            node->expiration = expiration;
+            node->slot = -1;
+            _listPush(expired, node);
+            if (limit > 0) { limit = limit - 1; }
+        }
+
+        if (queue->len == 0)
+        {
+            _dropQueue(dehydrator, queue);
+        }
+        else
+        {
+            _headsUpdate(heads, queue);
+        }
+    }
+}
+
+
+// release up to `limit` expired nodes of the dehydrator into `expired`,
+// all of them if limit is negative
+void _dehydratorAdvance(Dehydrator* dehydrator, long long now, ElementList* expired, long long limit)
+{
+    if (dehydrator->engine == DEHYDRATOR_ENGINE_WHEEL)
+    {
+        _wheelAdvance(dehydrator->wheel, now, expired, limit);
+    }
+    else
+    {
+        _queuesAdvance(dehydrator, now, expired, limit);
+    }
+}
+
+
+// count the elements of the queues in the subheap under `index` expired by
+// `now`, a queue whose head did not expire yet has none below it either.
+// the nodes are only read to tell the dead ones when there are any
+static long long _headsCountExpired(QueueHeads* heads, int index, long long now, int with_dead)
+{
+    if ((index >= heads->len) || (_queueHeadExpiration(heads->queues[index]) > now))
+    {
+        return 0;
+    }
+    long long expired = 0;
+    QueueBlock* block;
+    for (block = heads->queues[index]->head; block != NULL; block = block->next)
+    {
+        int i;
+        for (i = block->start; (i < block->end) && (block->epoch + block->offsets[i] <= now); ++i)
+        {
+            ElementListNode* node = block->nodes[i];
+            expired += (node != NULL) && !(with_dead && node->dead);
+        }
+        if (i < block->end) { break; }
+    }
+    return expired + _headsCountExpired(heads, 2 * index + 1, now, with_dead)
+                   + _headsCountExpired(heads, 2 * index + 2, now, with_dead);
+}
+
+
+// number of elements expired by `now` and not polled yet
+long long _dehydratorCountExpired(Dehydrator* dehydrator, long long now)
+{
+    if (dehydrator->engine == DEHYDRATOR_ENGINE_WHEEL)
+    {
+        return _wheelCountExpired(dehydrator->wheel, now);
+    }
+    return _headsCountExpired(&(dehydrator->queue_heads), 0, now, dehydrator->dead > 0);
+}
+
+
+// free the dead nodes heading the queue that expires first, so its head is
+// the earliest expiration of an element still in the dehydrator
+static void _queuesDropDeadHeads(Dehydrator* dehydrator)
+{
+    TimeoutQueue* queue;
+    while ((dehydrator->dead > 0) && ((queue = _headsTop(&(dehydrator->queue_heads))) != NULL))
+    {
+        ElementListNode* node = queue->head->nodes[queue->head->start];
+        if (!node->dead) { break; }
+        _queuePull(dehydrator, node);
+        _reclaimDeadNode(dehydrator, node);
+    }
+}
+
+
+// earliest expiration stored in the dehydrator, or -1 if it is empty
+long long _dehydratorNextExpiration(Dehydrator* dehydrator)
+{
+    if (dehydrator->engine == DEHYDRATOR_ENGINE_WHEEL)
+    {
+        return _wheelNextExpiration(dehydrator->wheel);
+    }
+    _queuesDropDeadHeads(dehydrator);
+    TimeoutQueue* queue = _headsTop(&(dehydrator->queue_heads));
+    return (queue != NULL) ? _queueHeadExpiration(queue) : -1;
+}
+
+
+void _removeNodeFromMapping(Dehydrator* dehydrator, ElementListNode* node)
+{
+    if (node->has_int_id)
+    {
+        khiter_t k = kh_get(64, dehydrator->element_int_nodes, node->int_id);
+        if (k != kh_end(dehydrator->element_int_nodes))
+        {
+            kh_del(64, dehydrator->element_int_nodes, k);
+        }
+        return;
+    }
+    if (node->has_generated_id)
+    {
+        khiter_t k = kh_get(128, dehydrator->element_generated_nodes, node->element_id);
+        if (k != kh_end(dehydrator->element_generated_nodes))
+        {
+            kh_del(128, dehydrator->element_generated_nodes, k);
+        }
+        return;
+    }
+    khiter_t k = kh_get(32, dehydrator->element_nodes, node->element_id);  // first have to get iterator
+    if (k != kh_end(dehydrator->element_nodes)) // k will be equal to kh_end if key not present
+    {
+        kh_del(32, dehydrator->element_nodes, k);
+    }
+}
+
+
+// link a node into the wheel or the queue of `ttl`, by its expiration.
+// `last_queue` remembers the timeout queue pushed to last, so a batch with a
+// run of elements sharing a ttl only looks its queue up once (NULL when not batching)
+static void _insertNode(Dehydrator* dehydrator, ElementListNode* node, long long ttl, TimeoutQueue** last_queue)
+{
+    khiter_t k;
+    if (dehydrator->engine == DEHYDRATOR_ENGINE_WHEEL)
+    {
+        _wheelInsert(dehydrator->wheel, node);
+        return;
+    }
+
+    // get timeout_queues[ttl], queues are never dropped between the
+    // pushes of a batch so the cached one is still there
+    TimeoutQueue* timeout_queue = NULL;
+    if ((last_queue != NULL) && (*last_queue != NULL) && ((*last_queue)->ttl == ttl))
+    {
+        timeout_queue = *last_queue;
+    }
+    else
+    {
+        k = kh_get(16, dehydrator->timeout_queues, ttl);  // first have to get iterator
+        if (k != kh_end(dehydrator->timeout_queues)) // k will be equal to kh_end if key not present
+        {
+            timeout_queue = kh_val(dehydrator->timeout_queues, k);
+        }
+    }
+    if (timeout_queue == NULL) //does not exist
+    {
+        // create an empty TimeoutQueue and add it to timeout_queues
+        timeout_queue = _createNewQueue(dehydrator, ttl);
+        int retval;
+        k = kh_put(16, dehydrator->timeout_queues, ttl, &retval);
+        kh_value(dehydrator->timeout_queues, k) = timeout_queue;
+    }
+
+    // push to tail of the queue, the head only changes if it was empty
+    _queuePush(timeout_queue, node);
+    if (timeout_queue->heap_index < 0)
+    {
+        _headsInsert(&(dehydrator->queue_heads), timeout_queue);
+    }
+    if (last_queue != NULL)
+    {
+        *last_queue = timeout_queue;
+    }
+}
+
+
+// dehydrate a single element into the queue of `ttl`, expiring at `expiration`.
+// `last_queue` is as for _insertNode
+int _pushElement(Dehydrator* dehydrator, long long ttl, long long expiration,
+                 const char* element_str, size_t element_len,
+                 const char* element_id_str, size_t element_id_len, TimeoutQueue** last_queue)
+{
+    // the node keeps its own copy of these
+    //create an ElementListNode
+    ElementListNode* node  = _createNewNode(dehydrator, element_str, element_len,
+                                            element_id_str, element_id_len, expiration);
+
+    // mark element dehytion location in element_nodes, an id that is taken
+    // keeps its element
+    if (_addNodeToMapping(dehydrator, node) != DEHYDRATOR_OK)
+    {
+        deleteNode(dehydrator, node);
+        return DEHYDRATOR_ERR;
+    }
+    _insertNode(dehydrator, node, ttl, last_queue);
+    return DEHYDRATOR_OK;
+}
+
+
+// put back an expired node that was not removed from the element map, to
+// expire again at `expiration` in the queue of `ttl`. the queue has to stay
+// in expiration order, so the node never expires before its tail
+void _requeueNode(Dehydrator* dehydrator, ElementListNode* node, long long ttl, long long expiration)
+{
+    if (dehydrator->engine != DEHYDRATOR_ENGINE_WHEEL)
+    {
+        khiter_t k = kh_get(16, dehydrator->timeout_queues, ttl);
+        if (k != kh_end(dehydrator->timeout_queues))
+        {
+            TimeoutQueue* timeout_queue = kh_val(dehydrator->timeout_queues, k);
+            if ((timeout_queue->len > 0) && (_queueTailExpiration(timeout_queue) > expiration))
+            {
+                expiration = _queueTailExpiration(timeout_queue);
+            }
+        }
+    }
+    node->expiration = expiration;
+    _insertNode(dehydrator, node, ttl, NULL);
+}
+
+
+// check an element of `ttl` can expire at `expiration`. timeout queues are
+// kept in expiration order, so it can't expire before the last element pushed
+// with the same ttl. returns the error to reply with or NULL if it can
+const char* _checkPushExpiration(Dehydrator* dehydrator, long long ttl, long long expiration)
+{
+    if (dehydrator->engine == DEHYDRATOR_ENGINE_WHEEL) { return NULL; }
+    khiter_t k = kh_get(16, dehydrator->timeout_queues, ttl);
+    if (k != kh_end(dehydrator->timeout_queues))
+    {
+        TimeoutQueue* timeout_queue = kh_val(dehydrator->timeout_queues, k);
+        if ((timeout_queue->len > 0) && (_queueTailExpiration(timeout_queue) > expiration))
+        {
+            return "ERROR: Expiration is before the last element pushed with this ttl.";
+        }
+    }
+    return NULL;
+}
@@ -0,0 +1,439 @@
+#ifndef __DEHYDRATOR_H__
+#define __DEHYDRATOR_H__
+
+// the dehydration engine: timeout queues (or a timing wheel) ordering the
+// elements by expiration, and an element map finding them by id. it has no
+// Redis dependencies, the module and bench.c both build on it.
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stddef.h>
+
+
+// every allocation of the engine goes through these, they default to the C
+// library and the module points them at the Redis allocator on load
+extern void* (*dehydrator_alloc)(size_t bytes);
+extern void* (*dehydrator_realloc)(void* ptr, size_t bytes);
+extern void (*dehydrator_free)(void* ptr);
+
+static inline void* _dehydratorCalloc(size_t nmemb, size_t size)
+{
+    void* ptr = dehydrator_alloc(nmemb * size);
+    memset(ptr, 0, nmemb * size);
+    return ptr;
+}
+
+#define kcalloc(N,Z) _dehydratorCalloc(N,Z)
+#define kmalloc(Z) dehydrator_alloc(Z)
+#define krealloc(P,Z) dehydrator_realloc(P,Z)
+#define kfree(P) dehydrator_free(P)
+#include "khash.h"
+
+#define DEHYDRATOR_OK 0
+#define DEHYDRATOR_ERR 1
+
+
+// ids generated for GIDPUSH are 128 bit values written as GENERATED_ID_LENGTH
+// base36 digits: a 48 bit timestamp (ms), a 40 bit node id drawn when the
+// generator is first used and a 40 bit counter. the counter alone keeps them
+// unique within a process, the node id across processes and restarts.
+// string ids of that form are kept as their GENERATED_ID_BYTES binary value
+// (two native words) and only printed back when replied
+#define GENERATED_ID_LENGTH 25
+#define GENERATED_ID_NODE_BITS 40
+#define GENERATED_ID_COUNTER_BITS 40
+#define GENERATED_ID_BYTES 16
+
+// room for any id _nodeElementId prints: an integer or a generated id
+#define ELEMENT_ID_BUF_SIZE (GENERATED_ID_LENGTH + 1)
+
+//##########################################################
+//#
+//#                   Slab Allocator
+//#
+//#########################################################
+
+// fixed size objects are carved out of slabs that grow geometrically from
+// SLAB_MIN_OBJECTS to SLAB_MAX_OBJECTS objects, released objects are kept on
+// a free list for reuse and slabs are only returned to the allocator in bulk.
+// pools expecting a bulk of objects, as on RDB load, let their slabs grow up
+// to SLAB_ARENA_MAX_OBJECTS objects instead
+#define SLAB_MIN_OBJECTS 16
+#define SLAB_MAX_OBJECTS 1024
+#define SLAB_ARENA_MAX_OBJECTS (16 * 1024)
+
+typedef struct slab{
+    struct slab* next;
+    size_t objects;
+} Slab;
+
+typedef struct slab_pool{
+    Slab* slabs;
+    void* free_list;
+    char* bump; // next never used object in the newest slab
+    char* bump_end;
+    size_t object_size;
+    size_t next_slab_objects;
+    size_t max_slab_objects;
+    long long slab_count;
+    long long capacity; // objects carved out of slabs so far
+    long long used; // objects currently handed out
+    long long bytes; // memory held by the slabs
+} SlabPool;
+
+
+//##########################################################
+//#
+//#               Linked List Definitions
+//#
+//#########################################################
+
+// element ids and elements are embedded in the node allocation itself as
+// "<element_id>\0<element>\0" whenever they fit in NODE_EMBED_MAX bytes, the
+// node is then carved from the pool of its size class (a NODE_EMBED_STEP
+// multiple). whatever does not fit is kept in its own allocation (raw).
+// generated ids are always embedded, as GENERATED_ID_BYTES with no NUL.
+// nodes of a timing wheel keep the back link of their slot list right after
+// the embedded bytes, nodes in a timeout queue are only linked by its block.
+#define NODE_EMBED_STEP 32
+#define NODE_SIZE_CLASSES 8
+#define NODE_EMBED_MAX (NODE_EMBED_STEP * NODE_SIZE_CLASSES)
+
+typedef struct element_list_node{
+    char* element; // NUL terminated, points into data when embedded
+    union {
+        char* element_id; // NUL terminated, points into data when embedded
+        long long int_id; // when has_int_id is set, no id string is kept
+    };
+    // element_id_len is GENERATED_ID_BYTES when has_generated_id is set
+    uint32_t element_len;
+    uint32_t element_id_len;
+    int slot; // timing wheel slot, or entry of `block`, holding this node
+    unsigned char size_class; // embedded capacity in NODE_EMBED_STEP units
+    unsigned char has_int_id;
+    unsigned char has_generated_id; // element_id holds the binary value
+    unsigned char dead; // pulled lazily, only kept in its queue until freed
+    // the expiration the node is pushed with, on a timing wheel slot or handed
+    // out in a batch. a queued node's expiration is in its block entry, it is
+    // written back here when the node leaves its queue expired
+    long long expiration;
+    union {
+        struct element_list_node* next; // on a timing wheel slot, or in a batch of expired nodes
+        struct queue_block* block; // while in a timeout queue, which only links it through its entry
+    };
+    char data[];
+} ElementListNode;
+
+// the timing wheel slots and the batches of expired nodes handed out, batches
+// are only linked forward
+typedef struct element_list{
+    ElementListNode* head;
+    ElementListNode* tail;
+    int len;
+} ElementList;
+
+
+//##########################################################
+//#
+//#               Timeout Queue Definitions
+//#
+//#########################################################
+
+// the queues engine keeps the FIFO of every ttl as a chain of blocks of
+// (expiration, node) entries: Push appends to the tail block and Poll reads
+// the head block in order, so it goes through contiguous memory and only
+// touches the nodes it hands out. a queue's blocks double from QUEUE_BLOCK_MIN_ENTRIES
+// up to QUEUE_BLOCK_MAX_ENTRIES entries, and one drained block of the largest
+// size is kept to become the next tail. Pull only clears the node's entry,
+// the node knows its block and index, and blocks are released once all of
+// their entries are cleared. the entries at both ends of a block are always taken.
+// expirations are kept as 32-bit offsets from the epoch of their block, the
+// expiration of its first entry, so Push starts a new block for an expiration
+// more than QUEUE_BLOCK_MAX_OFFSET ms after the epoch (or before it)
+#define QUEUE_BLOCK_MIN_ENTRIES 4
+#define QUEUE_BLOCK_MAX_ENTRIES 256
+#define QUEUE_BLOCK_MAX_OFFSET UINT32_MAX
+#define QUEUE_PREFETCH_DISTANCE 8 // entries Poll looks ahead to prefetch their node
+
+// the entries are kept as two arrays in the block allocation, the nodes
+// followed by their offsets, so an entry takes 12 bytes
+typedef struct queue_block{
+    struct queue_block* next;
+    struct queue_block* prev;
+    struct timeout_queue* queue;
+    long long epoch; // expiration the offsets are relative to
+    uint32_t* offsets; // expiration - epoch of every entry, after `nodes`
+    int start; // first taken entry
+    int end; // one past the last taken entry, Push appends there
+    int live; // taken entries
+    int capacity;
+    ElementListNode* nodes[]; // NULL once pulled or polled
+} QueueBlock;
+
+typedef struct timeout_queue{
+    QueueBlock* head;
+    QueueBlock* tail;
+    QueueBlock* spare; // drained block kept for reuse, NULL when there is none
+    int ttl;
+    int len; // taken entries of all blocks, dead nodes included
+    int heap_index; // position in the queue heads index, -1 when not indexed
+} TimeoutQueue;
+
+// walks the nodes of a timeout queue in expiration order, dead ones included
+typedef struct queue_iterator{
+    QueueBlock* block;
+    int index;
+} QueueIterator;
+
+
+// a binary min-heap over the non-empty timeout queues, keyed by the
+// expiration of their head, so the next queue to expire is always on top
+typedef struct queue_heads{
+    TimeoutQueue** queues;
+    int len;
+    int cap;
+} QueueHeads;
+
+
+//##########################################################
+//#
+//#               Timing Wheel Definitions
+//#
+//#########################################################
+
+// A hierarchical timing wheel with millisecond ticks. The root level has one
+// slot per tick, every upper level has slots spanning a full rotation of the
+// level beneath it, so 5 levels cover 2^32 ms (~49 days) ahead of `current`.
+#define WHEEL_LEVELS 5
+#define WHEEL_ROOT_BITS 8
+#define WHEEL_LEVEL_BITS 6
+#define WHEEL_ROOT_SIZE (1 << WHEEL_ROOT_BITS)
+#define WHEEL_LEVEL_SIZE (1 << WHEEL_LEVEL_BITS)
+#define WHEEL_LEVEL_MASK (WHEEL_LEVEL_SIZE - 1)
+#define WHEEL_SLOTS (WHEEL_ROOT_SIZE + (WHEEL_LEVELS - 1) * WHEEL_LEVEL_SIZE)
+#define WHEEL_OVERDUE_SLOT WHEEL_SLOTS // nodes pushed with an expiration already behind the wheel
+#define WHEEL_LEVEL_SHIFT(level) (WHEEL_ROOT_BITS + ((level) - 1) * WHEEL_LEVEL_BITS)
+#define WHEEL_LEVEL_OFFSET(level) (WHEEL_ROOT_SIZE + ((level) - 1) * WHEEL_LEVEL_SIZE)
+
+typedef struct timing_wheel{
+    ElementList slots[WHEEL_SLOTS + 1];
+    uint64_t occupied[WHEEL_SLOTS / 64 + 1]; // one bit per non-empty slot
+    long long current; // next tick (in ms) that was not processed yet
+    long long next_expiration; // cached earliest expiration, valid when next_valid is set
+    int next_valid;
+    int len;
+} TimingWheel;
+
+
+//##########################################################
+//#
+//#               Lag Histogram Definitions
+//#
+//#########################################################
+
+// How late elements are delivered after their expiration, in ms, counted in
+// log-linear buckets: exact below LAG_SUB_BUCKETS, then every power of two is
+// split in LAG_SUB_BUCKETS/2 linear buckets (at most 1/16 relative error).
+// Lags from 2^LAG_MAX_BITS ms (~1.5 years) on share the last bucket.
+#define LAG_SUB_BUCKETS 32
+#define LAG_SUB_BITS 5
+#define LAG_MAX_BITS 36
+#define LAG_BUCKETS (LAG_SUB_BUCKETS + (LAG_MAX_BITS - LAG_SUB_BITS) * (LAG_SUB_BUCKETS / 2))
+
+typedef struct lag_histogram{
+    uint64_t counts[LAG_BUCKETS];
+    uint64_t total;
+    long long max;
+} LagHistogram;
+
+
+//##########################################################
+//#
+//#                     Hash Maps
+//#
+//#########################################################
+
+KHASH_MAP_INIT_INT(16, TimeoutQueue*);
+
+KHASH_MAP_INIT_STR(32, ElementListNode*);
+
+KHASH_MAP_INIT_INT64(64, ElementListNode*);
+
+// generated ids are keyed by a pointer to their binary value in the node,
+// hashed and compared as two words whatever their text looked like
+static inline uint64_t _generatedIdWord(const char* id, int word)
+{
+    uint64_t value;
+    memcpy(&value, id + word * sizeof(uint64_t), sizeof(uint64_t));
+    return value;
+}
+
+static inline khint_t _generatedIdHash(const char* id)
+{
+    uint64_t h = (_generatedIdWord(id, 1) ^ (_generatedIdWord(id, 0) * 0x9E3779B97F4A7C15ULL)) * 0xBF58476D1CE4E5B9ULL;
+    return (khint_t)(h >> 32);
+}
+
+static inline int _generatedIdEqual(const char* a, const char* b)
+{
+    return ((_generatedIdWord(a, 0) ^ _generatedIdWord(b, 0)) | (_generatedIdWord(a, 1) ^ _generatedIdWord(b, 1))) == 0;
+}
+
+KHASH_INIT(128, const char*, ElementListNode*, 1, _generatedIdHash, _generatedIdEqual);
+//##########################################################
+//#
+//#                     Type
+//#
+//#########################################################
+
+#define DEHYDRATOR_ENGINE_QUEUES 0
+#define DEHYDRATOR_ENGINE_WHEEL 1
+
+// timeout queue of the elements a delivery target refused, waiting to be
+// delivered again. pushes for a ttl only take non-negative ones, so it never
+// shares a queue with them
+#define DEHYDRATOR_RETRY_TTL -1
+
+// element ids are either kept as strings, or as integers keyed in an integer
+// table. AUTO dehydrators key integers until the first id that is not one.
+#define DEHYDRATOR_IDS_STRING 0
+#define DEHYDRATOR_IDS_INT 1
+#define DEHYDRATOR_IDS_AUTO 2
+
+// PULL either unlinks the node from its timeout queue, or (LAZY, queues
+// engine only) just drops the id and strings and leaves the node dead in its
+// queue, so it saves touching the queue. POLL frees the dead nodes as it
+// drains the queues, and once more than DEHYDRATOR_COMPACT_DEAD_PERCENT of the
+// queued nodes are dead every lazy pull also walks DEHYDRATOR_COMPACT_STEP of
+// them, unlinking the dead ones. each walked node is likely a cache miss, so
+// the threshold keeps the walk down to about two nodes per pull
+#define DEHYDRATOR_PULL_EAGER 0
+#define DEHYDRATOR_PULL_LAZY 1
+#define DEHYDRATOR_COMPACT_DEAD_PERCENT 50
+#define DEHYDRATOR_COMPACT_STEP 64
+
+// running totals of the operations on a dehydrator
+typedef struct dehydrator_stats{
+    uint64_t pushed;
+    uint64_t pulled;
+    uint64_t polled; // handed out by POLL and BPOLL, or delivered to a target
+    uint64_t updated;
+} DehydratorStats;
+
+typedef struct dehydrator{
+    khash_t(16) *timeout_queues; //<ttl,TimeoutQueue>
+    khash_t(32) * element_nodes; //<element_id,node*>
+    khash_t(64) * element_int_nodes; //<integer element_id,node*>
+    khash_t(128) * element_generated_nodes; //<binary generated element_id,node*>
+    QueueHeads queue_heads; // only used by DEHYDRATOR_ENGINE_QUEUES
+    TimingWheel* wheel; // only used by DEHYDRATOR_ENGINE_WHEEL
+    SlabPool node_pools[NODE_SIZE_CLASSES+1]; // ElementListNode storage per size class
+    SlabPool queue_pool; // TimeoutQueue storage, their blocks are allocated on their own
+    LagHistogram* lag; // delivery lag, allocated on the first delivered element
+    DehydratorStats stats;
+    size_t id_bytes; // of the element ids, 8 for every integer id
+    size_t element_bytes;
+    int engine;
+    int id_mode;
+    int pull_mode;
+    long long dead; // dead nodes still in the timeout queues
+    QueueBlock* compact_block; // block the compaction walk is in, NULL between queues
+    int compact_index; // next entry of compact_block the walk visits
+    khiter_t compact_bucket; // timeout_queues bucket of the queue the walk is in
+    // kept for the Redis module, the engine only clears them
+    struct RedisModuleString* name;
+    uint64_t wake_timer; // wakes REDE.BPOLL clients blocked on the key, 0 when not armed
+    long long wake_at; // expiration wake_timer is armed for
+    int delivery;
+    struct RedisModuleString* delivery_target; // channel, list or stream expired elements are delivered to
+    int delivery_db;
+} Dehydrator;
+
+
+//##########################################################
+//#
+//#                     Functions
+//#
+//#########################################################
+
+char* string_append(char* a, const char* b);
+int parse_int_id(const char* str, size_t len, long long* value);
+int parse_generated_id(const char* str, size_t len, char* id);
+size_t format_generated_id(const char* id, char* buf);
+void _generateId(long long now, char* buf);
+
+void _slabPoolInit(SlabPool* pool, size_t object_size);
+void* _slabAlloc(SlabPool* pool);
+void _slabFree(SlabPool* pool, void* object);
+void _slabPoolExpect(SlabPool* pool, size_t objects);
+void _slabPoolRelease(SlabPool* pool);
+char* printSlabPool(SlabPool* pool);
+
+ElementListNode* _createNewNode(Dehydrator* dehydrator, const char* element, size_t element_len,
+                                const char* element_id, size_t element_id_len, long long expiration);
+void _nodeSetElement(Dehydrator* dehydrator, ElementListNode* node, const char* element, size_t element_len);
+const char* _nodeElementId(ElementListNode* node, char* buf, size_t* len);
+void _nodeFreeStrings(ElementListNode* node);
+void deleteNode(Dehydrator* dehydrator, ElementListNode* node);
+void _listPush(ElementList* list, ElementListNode* node);
+void _listPushLinked(ElementList* list, ElementListNode* node);
+ElementListNode* _listPop(ElementList* list);
+void _listUnlink(ElementList* list, ElementListNode* node);
+ElementListNode* _listFind(ElementList* list, const char* element_id);
+char* printNode(ElementListNode* node, long long expiration);
+char* printList(ElementList* list);
+
+TimeoutQueue* _createNewQueue(Dehydrator* dehydrator, int ttl);
+void deleteQueue(Dehydrator* dehydrator, TimeoutQueue* queue);
+void _queueExpect(TimeoutQueue* queue, size_t entries);
+void _queuePush(TimeoutQueue* queue, ElementListNode* node);
+void _queuePull(Dehydrator* dehydrator, ElementListNode* node);
+long long _queueNodeExpiration(ElementListNode* node);
+void _queueIterInit(TimeoutQueue* queue, QueueIterator* iter);
+ElementListNode* _queueIterNext(QueueIterator* iter);
+char* printQueue(TimeoutQueue* queue);
+
+void _headsInsert(QueueHeads* heads, TimeoutQueue* queue);
+void _headsRemove(QueueHeads* heads, TimeoutQueue* queue);
+void _headsUpdate(QueueHeads* heads, TimeoutQueue* queue);
+TimeoutQueue* _headsTop(QueueHeads* heads);
+long long _headsSecondExpiration(QueueHeads* heads);
+
+TimingWheel* _createTimingWheel(long long now);
+void deleteTimingWheel(TimingWheel* wheel);
+void _wheelInsert(TimingWheel* wheel, ElementListNode* node);
+void _wheelPull(TimingWheel* wheel, ElementListNode* node);
+void _wheelAdvance(TimingWheel* wheel, long long now, ElementList* expired, long long limit);
+long long _wheelNextExpiration(TimingWheel* wheel);
+long long _wheelCountExpired(TimingWheel* wheel, long long now);
+char* printWheel(TimingWheel* wheel);
+
+void _lagRecord(Dehydrator* dehydrator, long long lag);
+long long _lagPercentile(LagHistogram* histogram, double percentile);
+
+Dehydrator* _createDehydrator(int engine, int id_mode, long long now);
+void _reserveDehydrator(Dehydrator* dehy, size_t elements, size_t generated, size_t queues);
+char* printDehydrator(Dehydrator* dehydrator);
+void deleteDehydrator(Dehydrator* dehydrator);
+long long _dehydratorLen(Dehydrator* dehydrator);
+ElementListNode* _getNodeForID(Dehydrator* dehydrator, const char* element_id, size_t element_id_len);
+ElementListNode** _prefetchIdBucket(Dehydrator* dehydrator, const char* element_id, size_t element_id_len);
+void _prefetchNodeInBucket(ElementListNode** bucket);
+int _addNodeToMapping(Dehydrator* dehydrator, ElementListNode* node);
+void _removeNodeFromMapping(Dehydrator* dehydrator, ElementListNode* node);
+void _convertToStringIds(Dehydrator* dehydrator);
+int _acceptElementId(Dehydrator* dehydrator, const char* element_id, size_t element_id_len);
+void _unlinkNode(Dehydrator* dehydrator, ElementListNode* node);
+void _pullNode(Dehydrator* dehydrator, ElementListNode* node);
+void _compactStep(Dehydrator* dehydrator, int budget);
+int _pushElement(Dehydrator* dehydrator, long long ttl, long long expiration,
+                 const char* element, size_t element_len,
+                 const char* element_id, size_t element_id_len, TimeoutQueue** last_queue);
+void _requeueNode(Dehydrator* dehydrator, ElementListNode* node, long long ttl, long long expiration);
+const char* _checkPushExpiration(Dehydrator* dehydrator, long long ttl, long long expiration);
+void _dehydratorAdvance(Dehydrator* dehydrator, long long now, ElementList* expired, long long limit);
+long long _dehydratorNextExpiration(Dehydrator* dehydrator);
+long long _dehydratorCountExpired(Dehydrator* dehydrator, long long now);
+
+#endif
@@ -4,11 +4,14 @@
 #include <unistd.h>
 #include <pthread.h>
 #include <stdint.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <time.h>
 #include <inttypes.h>
+#include <limits.h>
 #include <math.h>
-#include "khash.h"
+#include <limits.h>
+#include "dehydrator.h"
 #include "rmutil/util.h"
 #include "rmutil/strings.h"
 #include "rmutil/test_util.h"
@@ -21,1260 +24,3777 @@
 //#
 //#########################################################
 
-#define ID_LENGTH 31
-#define ALLOWED_ID_CHARS "0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZ"
 
-char* string_append(char* a, const char* b)
+
+// expirations are kept in unix time milliseconds, but read off the monotonic
+// clock so wall clock steps (NTP, manual changes) can't release or stall a
+// whole dehydrator at once. the monotonic clock is anchored to the wall clock
+// the first time it is read, so saved expirations keep their meaning across
+// restarts. REDE.DEBUG CLOCK can freeze it at a virtual time instead
+static long long clock_offset_ms = 0;
+static int clock_anchored = 0;
+static long long clock_virtual_ms = -1; // -1 when the real clock is used
+
+
+static inline long long _monotonicMs(void)
 {
-    char* retstr = RedisModule_Alloc(strlen(a)+strlen(b));
-    strcpy(retstr, a);
-    strcat(retstr, b);
-    // printf("printing: %s", retstr);
-    RedisModule_Free(a);
-    return retstr;
+    struct timespec spec;
+    clock_gettime(CLOCK_MONOTONIC, &spec);
+    return (long long)spec.tv_sec * 1000 + spec.tv_nsec / 1000000;
 }
 
 
-long long current_time_ms (void)
+void clock_anchor(void)
 {
-    long            ms; // Milliseconds
-    time_t          s;  // Seconds
     struct timespec spec;
-
     clock_gettime(CLOCK_REALTIME, &spec);
-
-    s  = spec.tv_sec*1000;
-    ms = round(spec.tv_nsec / 1.0e6); // Convert nanoseconds to milliseconds
-
-    return s+ms;
+    long long wall_ms = (long long)spec.tv_sec * 1000 + spec.tv_nsec / 1000000;
+    clock_offset_ms = wall_ms - _monotonicMs();
+    clock_anchored = 1;
 }
 
-// Assumes 0 <= max <= RAND_MAX
-// Returns in the closed interval [0, max]
-long random_at_most(long max) {
-    unsigned long
-      // max <= RAND_MAX < ULONG_MAX, so this is okay.
-      num_bins = (unsigned long) max + 1,
-      num_rand = (unsigned long) RAND_MAX + 1,
-      bin_size = num_rand / num_bins,
-      defect   = num_rand % num_bins;
 
-    long x;
-    do {
-     x = random();
-    }
-    // This is carefully written not to overflow
-    while (num_rand - defect <= (unsigned long)x);
-
-    // Truncated division is intentional
-    return x/bin_size;
-}
-
-char* generate_id(void)
+// callers read it once per command or batch and pass `now` along
+long long current_time_ms (void)
 {
-    char* uuid = RedisModule_Alloc((ID_LENGTH+1)*sizeof(char));
-    long allowed_char_range = strlen(ALLOWED_ID_CHARS)-1;
-
-
-    // Intializes random number generator
-    srandom((unsigned) time(0));
-
-    int i;
-    for (i=0;i<ID_LENGTH;++i)
-    {
-        uuid[i] = ALLOWED_ID_CHARS[random_at_most(allowed_char_range)];
-    }
-    uuid[ID_LENGTH] = 0;
-    return uuid;
+    if (clock_virtual_ms >= 0) { return clock_virtual_ms; }
+    if (!clock_anchored) { clock_anchor(); }
+    return _monotonicMs() + clock_offset_ms;
 }
 
 
-//##########################################################
-//#
-//#               Linked List Definitions
-//#
-//#########################################################
-
-typedef struct element_list_node{
-    RedisModuleString* element;
-    RedisModuleString* element_id;
-    int ttl;
-    long long expiration;
-    struct element_list_node* next;
-    struct element_list_node* prev;
-} ElementListNode;
-
-typedef struct element_list{
-    ElementListNode* head;
-    ElementListNode* tail;
-    int len;
-} ElementList;
 
 
 //##########################################################
 //#
-//#                     Hash Maps
+//#                     Type
 //#
 //#########################################################
 
-KHASH_MAP_INIT_INT(16, ElementList*);
+// the engine itself (Dehydrator and its queues, wheel and maps) is in
+// dehydrator.c, this module keeps it in Redis keys of DehydratorType
+static RedisModuleType *DehydratorType;
 
-KHASH_MAP_INIT_STR(32, ElementListNode*);
+// where expired elements are moved to by the server itself, if anywhere
+#define DEHYDRATOR_DELIVERY_NONE 0
+#define DEHYDRATOR_DELIVERY_PUBLISH 1
+#define DEHYDRATOR_DELIVERY_RPUSH 2
+#define DEHYDRATOR_DELIVERY_XADD 3
 
+// bump this whenever the RDB layout of the DehydratorType changes
+#define DEHYDRATOR_ENCODING_VERSION 8
 
-//##########################################################
-//#
-//#                     Type
-//#
-//#########################################################
+// operation totals over all the dehydrators, and how many there are, for INFO
+static DehydratorStats rede_totals = {0, 0, 0, 0};
+static long long rede_dehydrators = 0;
 
-static RedisModuleType *DehydratorType;
+// count `n` operations of kind `counter` on the dehydrator and in the totals
+#define DEHYDRATOR_COUNT(dehydrator, counter, n) \
+    do { (dehydrator)->stats.counter += (n); rede_totals.counter += (n); } while (0)
 
-typedef struct dehydrator{
-    khash_t(16) *timeout_queues; //<ttl,ElementList>
-    khash_t(32) * element_nodes; //<element_id,node*>
-    RedisModuleString* name;
-} Dehydrator;
 
 
 //##########################################################
 //#
-//#              Linked List Functions
+//#               Dehydrator Utilities
 //#
 //#########################################################
 
-
-//Creates a new Node and returns pointer to it.
-ElementListNode* _createNewNode(RedisModuleString* element, RedisModuleString* element_id, long long ttl, long long expiration)
-{
-    ElementListNode* newNode
-        = (ElementListNode*)RedisModule_Alloc(sizeof(ElementListNode));
-
-    newNode->element_id = element_id;
-    newNode->element = element;
-    newNode->expiration = expiration;
-    newNode->ttl = ttl;
-    newNode->next = NULL;
-    newNode->prev = NULL;
-    return newNode;
-}
-
-
-void deleteNode(ElementListNode* node)
+// create a dehydrator to keep under the key `dehydrator_name`
+Dehydrator* _createNamedDehydrator(RedisModuleString* dehydrator_name, int engine, int id_mode)
 {
-    // free everything else related to the node
-    RedisModule_Free(node);
+    Dehydrator* dehy = _createDehydrator(engine, id_mode, current_time_ms());
+    dehy->name = dehydrator_name;
+    dehy->wake_timer = 0;
+    dehy->wake_at = -1;
+    dehy->delivery = DEHYDRATOR_DELIVERY_NONE;
+    dehy->delivery_target = NULL;
+    dehy->delivery_db = 0;
+    ++rede_dehydrators;
+    return dehy;
 }
 
 
-//Creates a new Node and returns pointer to it.
-ElementList* _createNewList()
+// find the node of an element id given as a Redis string, NULL if there is none
+ElementListNode* _getNodeForString(Dehydrator* dehydrator, RedisModuleString* element_id)
 {
-    ElementList* list
-        = (ElementList*)RedisModule_Alloc(sizeof(ElementList));
-    list->head = NULL;
-    list->tail = NULL;
-    list->len = 0;
-    return list;
+    if (element_id == NULL) { return NULL; }
+    size_t element_id_len;
+    const char* element_id_str = RedisModule_StringPtrLen(element_id, &element_id_len);
+    return _getNodeForID(dehydrator, element_id_str, element_id_len);
 }
 
 
-void deleteList(ElementList* list)
+// undo _createNamedDehydrator before the dehydrator is deleted: release the
+// strings the module keeps in it, they may be shared with the keyspace so
+// this is only done on the main thread
+void _releaseNamedDehydrator(Dehydrator* dehydrator)
 {
-    ElementListNode* current = list->head;
-
-    // iterate over queue and find the element that has id = element_id
-    while(current != NULL)
+    --rede_dehydrators;
+    if (dehydrator->delivery_target != NULL)
     {
-        ElementListNode* next = current->next; // save next
-        deleteNode(current);
-        current = next;  //move to next node
+        RedisModule_FreeString(NULL, dehydrator->delivery_target);
+        dehydrator->delivery_target = NULL;
     }
-
-    RedisModule_Free(list);
 }
 
 
-// insert a Node at tail of linked list
-void _listPush(ElementList* list, ElementListNode* node)
+Dehydrator* validateDehydratorKey(RedisModuleCtx* ctx, RedisModuleKey* key, RedisModuleString* dehydrator_name)
 {
-    if (list->tail == NULL)
+    int type = RedisModule_KeyType(key);
+    if (type != REDISMODULE_KEYTYPE_EMPTY &&
+        RedisModule_ModuleTypeGetType(key) != DehydratorType)
+    {
+        RedisModule_ReplyWithError(ctx,REDISMODULE_ERRORMSG_WRONGTYPE);
+        RedisModule_CloseKey(key);
+        return NULL;
+    }
+    if (type == REDISMODULE_KEYTYPE_EMPTY)
     {
-        list->head = node;
+        if (dehydrator_name != NULL)
+        {
+            RedisModuleString* saved_dehydrator_name = RedisModule_CreateStringFromString(ctx, dehydrator_name);
+            Dehydrator* dehydrator = _createNamedDehydrator(saved_dehydrator_name, DEHYDRATOR_ENGINE_QUEUES, DEHYDRATOR_IDS_AUTO);
+            RedisModule_ModuleTypeSetValue(key, DehydratorType, dehydrator);
+            return dehydrator;
+        }
+        else
+        {
+            RedisModule_CloseKey(key);
+            return NULL;
+        }
     }
     else
     {
-        node->prev = list->tail;
-        list->tail->next = node;
+        return RedisModule_ModuleTypeGetValue(key);
     }
-    list->tail = node;
-    list->len = (list->len) + 1;
 }
 
 
-// pull and return the element at the first location
-ElementListNode* _listPop(ElementList* list) {
-   if ((list == NULL) || (list->head == NULL)) { return NULL; } // if list empty
-
-   //save current head
-   ElementListNode* node = list->head;
-
-   if (list->len == 1)
-   {
-       list->tail = NULL;
-       list->head = NULL;
-   }
-   else
-   {
-       // swap to new head
-       list->head = list->head->next;
-       list->head->prev = NULL;
-   }
-
-   list->len = list->len - 1;
-   return node;
+//##########################################################
+//#
+//#                      Replication
+//#
+//#########################################################
 
-}
+// the writes that depend on the clock or on a generated id are not
+// propagated verbatim to the AOF and replicas: pushed elements go as a
+// REDE.MPUSHAT of their absolute expiration and id, and elements removed
+// from a dehydrator as a REDE.MPULL of their ids, so these hold exactly
+// what this server does whatever their own clock says. the other writes
+// are propagated verbatim
 
+// elements per REDE.MPUSHAT or REDE.MPULL command propagated
+#define REPLICATE_BATCH 256
 
-void _listPull(Dehydrator* dehydrator, ElementListNode* node)
+// propagate `cmd` for the arguments gathered in `args` and release them
+void _replicateArgs(RedisModuleCtx *ctx, const char* cmd, RedisModuleString *key,
+                    RedisModuleString** args, size_t* args_len)
 {
-    ElementList* list = NULL;
-    khiter_t k = kh_get(16, dehydrator->timeout_queues, node->ttl);  // first have to get iterator
-    if (k != kh_end(dehydrator->timeout_queues)) // k will be equal to kh_end if key not present
+    if (*args_len == 0) { return; }
+    RedisModule_Replicate(ctx, cmd, "sv", key, args, *args_len);
+    size_t pos;
+    for (pos = 0; pos < *args_len; ++pos)
     {
-        list = kh_val(dehydrator->timeout_queues, k);
+        RedisModule_FreeString(NULL, args[pos]);
     }
-    if (list == NULL) { return; }
+    *args_len = 0;
+}
 
-    if (list->len == 1)
-    {
-        list->head = NULL;
-        list->tail = NULL;
-        kh_del(16, dehydrator->timeout_queues, k);
-        deleteList(list);
-        return;
-    }
 
-    //hort circuit the node (carefull! pulling from tail or head)
-    if (node == list->head)
-    {
-        list->head = list->head->next;
-        list->head->prev = NULL;
-    }
-    else
+// gather an element that was pushed into the dehydrator
+void _replicatePush(RedisModuleCtx *ctx, RedisModuleString *key, RedisModuleString** args, size_t* args_len,
+                    long long ttl, long long expiration, RedisModuleString* element, RedisModuleString* element_id)
+{
+    args[(*args_len)++] = RedisModule_CreateStringFromLongLong(NULL, ttl);
+    args[(*args_len)++] = RedisModule_CreateStringFromLongLong(NULL, expiration);
+    args[(*args_len)++] = RedisModule_CreateStringFromString(NULL, element);
+    args[(*args_len)++] = RedisModule_CreateStringFromString(NULL, element_id);
+    if (*args_len == REPLICATE_BATCH * 4)
     {
-        node->prev->next = node->next;
+        _replicateArgs(ctx, "REDE.MPUSHAT", key, args, args_len);
     }
+}
 
-    if (node == list->tail) {
-        list->tail = node->prev;
-        list->tail->next = NULL;
-    }
-    else
+
+// gather the id of a node that is leaving the dehydrator, call before the node is freed
+void _replicatePull(RedisModuleCtx *ctx, RedisModuleString *key, RedisModuleString** args, size_t* args_len,
+                    ElementListNode* node)
+{
+    char buf[ELEMENT_ID_BUF_SIZE];
+    size_t element_id_len;
+    const char* element_id = _nodeElementId(node, buf, &element_id_len);
+    args[(*args_len)++] = RedisModule_CreateString(NULL, element_id, element_id_len);
+    if (*args_len == REPLICATE_BATCH)
     {
-        node->next->prev = node->prev;
+        _replicateArgs(ctx, "REDE.MPULL", key, args, args_len);
     }
-    list->len = list->len - 1;
 }
 
-// pull from list and return an element with the following id
-ElementListNode* _listFind(ElementList* list, RedisModuleString* element_id)
-{
-    //start from head
-    ElementListNode* current = list->head;
 
-    if (current == NULL) { return NULL; } //list is empty
+//##########################################################
+//#
+//#                     Wake Up Timers
+//#
+//#########################################################
 
-    // iterate over queue and find the element that has id = element_id
-    while (current->element_id != element_id)
-    {
-        if (current->next == NULL) { return NULL; } // got to tail
-        current = current->next; //move to next node
-    }
+// a dehydrator arms a single timer for its earliest expiration, either to
+// wake clients blocked on it in REDE.BPOLL or to deliver its expired elements
 
-    while (current->element_id == element_id) // match found
-    {
-        return current;
-    }
+// number of clients blocked in REDE.BPOLL, pushes only arm wake timers
+// while there is someone to wake up or something to deliver
+static long long bpoll_waiters = 0;
 
-    return NULL;
-}
+// most expired elements delivered per timer, the rest are delivered on the
+// next event loop iteration so big backlogs don't block the server
+#define DELIVERY_BATCH 1000
 
+// how long elements the delivery target refused wait for the next attempt
+#define DELIVERY_RETRY_MS 1000
 
-char* printNode(ElementListNode* node)
-{
-    size_t element_id_len;
-    size_t element_len;
-    const char* element_id = RedisModule_StringPtrLen(node->element_id, &element_id_len);
-    const char* element = RedisModule_StringPtrLen(node->element, &element_len);
-    char* node_str = (char*)RedisModule_Alloc((element_id_len+element_len+50)*sizeof(char));
-    sprintf(node_str, "[id=%s,elem=%s,ttl=%d,exp=%lld]", element_id, element, node->ttl, node->expiration);
-    return node_str;
+// how often dehydrators loaded with a delivery target get their timers armed
+#define DELIVERY_SWEEP_MS 100
 
-}
+// a dehydrator that delivers but has no timer, since it was loaded (there
+// is no context to arm one there) or because this server is a replica
+typedef struct pending_delivery{
+    RedisModuleString* key_name;
+    int db;
+} PendingDelivery;
+
+static PendingDelivery* pending_deliveries = NULL;
+static int pending_deliveries_len = 0;
+static int pending_deliveries_cap = 0;
 
 
-char* printList(ElementList* list)
+// a dehydrator is listed once, however often its timer fires on a replica
+// or the replica loads it again on a full sync
+void _addPendingDelivery(RedisModuleString* key_name, int db)
 {
-    char* list_str = RedisModule_Alloc(32*sizeof(char));
-    ElementListNode* current = list->head;
-    sprintf(list_str, "(elements=%d)\n   head", list->len);
-    // iterate over queue and find the element that has id = element_id
-    while(current != NULL)
+    int i;
+    for (i = 0; i < pending_deliveries_len; ++i)
     {
-        list_str = string_append(list_str, "->");
-        char* node_str = printNode(current);
-        list_str = string_append(list_str, node_str);
-        RedisModule_Free(node_str);
+        if ((pending_deliveries[i].db == db) &&
+            (RedisModule_StringCompare(pending_deliveries[i].key_name, key_name) == 0))
+        {
+            return;
+        }
+    }
 
-        current = current->next;  //move to next node
+    if (pending_deliveries_len == pending_deliveries_cap)
+    {
+        pending_deliveries_cap = (pending_deliveries_cap == 0) ? 16 : pending_deliveries_cap * 2;
+        pending_deliveries = RedisModule_Realloc(pending_deliveries,
+            pending_deliveries_cap * sizeof(PendingDelivery));
     }
-    list_str = string_append(list_str, "\n   tail points to: ");
-    list_str = string_append(list_str, RedisModule_StringPtrLen(list->tail->element_id, NULL));
-    list_str = string_append(list_str,"\n");
-    return list_str;
+    pending_deliveries[pending_deliveries_len].key_name = RedisModule_CreateStringFromString(NULL, key_name);
+    pending_deliveries[pending_deliveries_len].db = db;
+    ++pending_deliveries_len;
 }
 
 
-//##########################################################
-//#
-//#               Dehydrator Utilities
-//#
-//#########################################################
-
-Dehydrator* _createDehydrator(RedisModuleString* dehydrator_name)
+static inline int _isReplica(RedisModuleCtx *ctx)
 {
-
-    Dehydrator* dehy
-        = (Dehydrator*)RedisModule_Alloc(sizeof(Dehydrator));
-
-    dehy->timeout_queues = kh_init(16);
-    dehy->element_nodes = kh_init(32);
-    dehy->name = dehydrator_name;
-
-    return dehy;
+    return (RedisModule_GetContextFlags(ctx) & REDISMODULE_CTX_FLAGS_SLAVE) != 0;
 }
 
 
-Dehydrator* validateDehydratorKey(RedisModuleCtx* ctx, RedisModuleKey* key, RedisModuleString* dehydrator_name)
+// hand `element_num` elements to the delivery target of the dehydrator, in
+// order, stopping at the first one the target refuses. returns how many got
+// there. the writes are propagated to the AOF and replicas ("!"), and Redis
+// wraps the calls of a batch in a single MULTI/EXEC when it does
+size_t _deliverElements(RedisModuleCtx *ctx, Dehydrator* dehydrator, RedisModuleString** elements, size_t element_num)
 {
-    int type = RedisModule_KeyType(key);
-    if (type != REDISMODULE_KEYTYPE_EMPTY &&
-        RedisModule_ModuleTypeGetType(key) != DehydratorType)
+    RedisModuleCallReply* reply;
+    if (dehydrator->delivery == DEHYDRATOR_DELIVERY_RPUSH)
     {
-        RedisModule_ReplyWithError(ctx,REDISMODULE_ERRORMSG_WRONGTYPE);
-        RedisModule_CloseKey(key);
-        return NULL;
+        // a whole batch fits a single RPUSH, all of it gets there or none
+        reply = RedisModule_Call(ctx, "RPUSH", "!sv", dehydrator->delivery_target, elements, element_num);
+        int failed = (reply == NULL) || (RedisModule_CallReplyType(reply) == REDISMODULE_REPLY_ERROR);
+        if (reply != NULL) { RedisModule_FreeCallReply(reply); }
+        return failed ? 0 : element_num;
     }
-    if (type == REDISMODULE_KEYTYPE_EMPTY)
+
+    // streams and channels take one element per call, Redis has no command
+    // adding several stream entries at once
+    RedisModuleString* id = RedisModule_CreateString(ctx, "*", 1);
+    RedisModuleString* field = RedisModule_CreateString(ctx, "element", 7);
+    size_t pos;
+    for (pos = 0; pos < element_num; ++pos)
     {
-        if (dehydrator_name != NULL)
+        if (dehydrator->delivery == DEHYDRATOR_DELIVERY_XADD)
         {
-            RedisModuleString* saved_dehydrator_name = RedisModule_CreateStringFromString(ctx, dehydrator_name);
-            Dehydrator* dehydrator = _createDehydrator(saved_dehydrator_name);
-            RedisModule_ModuleTypeSetValue(key, DehydratorType, dehydrator);
-            return dehydrator;
+            reply = RedisModule_Call(ctx, "XADD", "!ssss", dehydrator->delivery_target, id, field, elements[pos]);
         }
         else
         {
-            RedisModule_CloseKey(key);
-            return NULL;
+            reply = RedisModule_Call(ctx, "PUBLISH", "!ss", dehydrator->delivery_target, elements[pos]);
         }
+        int failed = (reply == NULL) || (RedisModule_CallReplyType(reply) == REDISMODULE_REPLY_ERROR);
+        if (reply != NULL) { RedisModule_FreeCallReply(reply); }
+        if (failed) { break; }
     }
-    else
-    {
-        return RedisModule_ModuleTypeGetValue(key);
-    }
+    RedisModule_FreeString(ctx, id);
+    RedisModule_FreeString(ctx, field);
+    return pos;
 }
 
-char* printDehydrator(Dehydrator* dehydrator)
+
+// move up to DELIVERY_BATCH expired elements of the dehydrator stored under
+// `key_name` to its delivery target, returns the number of elements moved.
+// elements the target refused stay in the dehydrator and are retried
+// DELIVERY_RETRY_MS later, from a queue of their own. replicas don't deliver, they drop the delivered
+// elements when the master propagates their removal
+long long _deliverExpired(RedisModuleCtx *ctx, Dehydrator* dehydrator, RedisModuleString* key_name)
 {
-    char* dehy_str = RedisModule_Alloc(sizeof(char));
-    khiter_t k;
+    long long now = current_time_ms();
+    ElementList expired = {NULL, NULL, 0};
+    _dehydratorAdvance(dehydrator, now, &expired, DELIVERY_BATCH);
+    if (expired.len == 0) { return 0; }
+
+    // the nodes stay mapped until their elements got to the target
+    size_t element_num = 0;
+    RedisModuleString** elements = RedisModule_Alloc(expired.len * sizeof(RedisModuleString*));
+    ElementListNode* node;
+    for (node = expired.head; node != NULL; node = node->next)
+    {
+        elements[element_num++] = RedisModule_CreateString(ctx, node->element, node->element_len);
+    }
+    size_t delivered = _deliverElements(ctx, dehydrator, elements, element_num);
+    if (delivered < element_num)
+    {
+        RedisModule_Log(ctx, "warning", "REDE: failed delivering %zu expired elements to %s, retrying in %d ms",
+            element_num - delivered, RedisModule_StringPtrLen(dehydrator->delivery_target, NULL), DELIVERY_RETRY_MS);
+    }
 
-    dehy_str = string_append(dehy_str, "\n======== timeout_queues =========");
-    for (k = kh_begin(dehydrator->timeout_queues); k != kh_end(dehydrator->timeout_queues); ++k)
+    DEHYDRATOR_COUNT(dehydrator, polled, delivered);
+    RedisModuleString* ids[REPLICATE_BATCH];
+    size_t ids_len = 0;
+    size_t pos;
+    for (pos = 0; (node = _listPop(&expired)) != NULL; ++pos)
     {
-        if (kh_exist(dehydrator->timeout_queues, k))
+        if (pos < delivered)
+        {
+            _replicatePull(ctx, key_name, ids, &ids_len, node);
+            _lagRecord(dehydrator, now - node->expiration);
+            _removeNodeFromMapping(dehydrator, node);
+            deleteNode(dehydrator, node);
+        }
+        else
         {
-            ElementList* list = kh_value(dehydrator->timeout_queues, k);
-            dehy_str = string_append(dehy_str, "\n>>List: ");
-            char qnum[50];
-            sprintf(qnum,"%d ", kh_key(dehydrator->timeout_queues, k));
-            dehy_str = string_append(dehy_str, qnum);
-
-            char* list_str = printList(list);
-            dehy_str = string_append(dehy_str, list_str);
-            RedisModule_Free(list_str);
+            _requeueNode(dehydrator, node, DEHYDRATOR_RETRY_TTL, now + DELIVERY_RETRY_MS);
         }
+        RedisModule_FreeString(ctx, elements[pos]);
     }
-    dehy_str = string_append(dehy_str, "\n");
+    _replicateArgs(ctx, "REDE.MPULL", key_name, ids, &ids_len);
+    RedisModule_Free(elements);
+    return delivered;
+}
+
 
-    dehy_str = string_append(dehy_str, "\n======== element_nodes issues =========\n");
-    int found_problems = 0;
-    for (k = kh_begin(dehydrator->element_nodes); k != kh_end(dehydrator->element_nodes); ++k)
+void _armWakeTimer(RedisModuleCtx *ctx, Dehydrator* dehydrator, RedisModuleString* key_name);
+
+// a wake timer fired, deliver what expired and let Redis run the reply
+// callback of the clients blocked on the key. the timer owns its copy of
+// the key name
+void _wakeTimerFired(RedisModuleCtx *ctx, void *data)
+{
+    RedisModuleString* key_name = data;
+    RedisModuleKey *key = RedisModule_OpenKey(ctx, key_name, REDISMODULE_READ|REDISMODULE_WRITE);
+    if (RedisModule_ModuleTypeGetType(key) == DehydratorType)
     {
-        if (kh_exist(dehydrator->element_nodes, k))
+        Dehydrator* dehydrator = RedisModule_ModuleTypeGetValue(key);
+        dehydrator->wake_timer = 0;
+        dehydrator->wake_at = -1;
+        if (dehydrator->delivery != DEHYDRATOR_DELIVERY_NONE)
         {
-            ElementListNode* node = kh_value(dehydrator->element_nodes, k);
-            if (!RMUtil_StringEqualsC(node->element_id, kh_key(dehydrator->element_nodes, k)))
+            if (_isReplica(ctx))
+            {
+                // leave delivering to the master, check again if promoted
+                _addPendingDelivery(key_name, RedisModule_GetSelectedDb(ctx));
+            }
+            else
             {
-                dehy_str = string_append(dehy_str, RedisModule_StringPtrLen(node->element_id, NULL));
-                dehy_str = string_append(dehy_str, "is stored under id: ");
-                dehy_str = string_append(dehy_str, kh_key(dehydrator->element_nodes, k));
-                dehy_str = string_append(dehy_str, "\n");
-                found_problems = 1;
+                _deliverExpired(ctx, dehydrator, key_name);
+                _armWakeTimer(ctx, dehydrator, key_name);
             }
         }
     }
-    if (!found_problems)
+    RedisModule_CloseKey(key);
+
+    // delivery timers fire on servers without REDE.BPOLL too
+    if (RedisModule_SignalKeyAsReady != NULL)
     {
-        dehy_str = string_append(dehy_str, "no issues were found.\n");
+        RedisModule_SignalKeyAsReady(ctx, key_name);
     }
-    dehy_str = string_append(dehy_str, "================================\n");
-
-    return dehy_str;
+    RedisModule_FreeString(NULL, key_name);
 }
 
 
-void deleteDehydrator(Dehydrator* dehydrator)
+// make sure the wake timer of the dehydrator stored under `key_name` fires
+// no later than its earliest expiration
+void _armWakeTimer(RedisModuleCtx *ctx, Dehydrator* dehydrator, RedisModuleString* key_name)
 {
-    khiter_t k;
+    long long next_expiration = _dehydratorNextExpiration(dehydrator);
+    if (next_expiration < 0) { return; }
 
-    // clear and delete the timeout_queues dictionary
-    for (k = kh_begin(dehydrator->timeout_queues); k != kh_end(dehydrator->timeout_queues); ++k)
+    // a timer armed for the past is one that was lost (the key was renamed)
+    long long now = current_time_ms();
+    if ((dehydrator->wake_timer != 0) &&
+        (dehydrator->wake_at <= next_expiration) && (dehydrator->wake_at > now))
     {
-        if (kh_exist(dehydrator->timeout_queues, k))
-        {
-            ElementList* list = kh_value(dehydrator->timeout_queues, k);
-            kh_del(16, dehydrator->timeout_queues, k);
-            deleteList(list);
-        }
+        return;
     }
-    kh_destroy(16, dehydrator->timeout_queues);
 
-    // clear and delete the element_nodes dictionary
-    for (k = kh_begin(dehydrator->element_nodes); k != kh_end(dehydrator->element_nodes); ++k)
+    if (dehydrator->wake_timer != 0)
     {
-        if (kh_exist(dehydrator->element_nodes, k))
+        // a sooner element was pushed, move the timer forward
+        void* data;
+        if (RedisModule_StopTimer(ctx, dehydrator->wake_timer, &data) == REDISMODULE_OK)
         {
-            kh_del(32, dehydrator->element_nodes, k);
+            RedisModule_FreeString(NULL, data);
         }
     }
-    kh_destroy(32, dehydrator->element_nodes);
 
-    // delete the dehydrator
-    // RedisModule_FreeString(ctx, dehydrator->name); //TODO: make this work
-    RedisModule_Free(dehydrator);
+    long long period = (next_expiration > now) ? next_expiration - now : 0;
+    dehydrator->wake_at = next_expiration;
+    dehydrator->wake_timer = RedisModule_CreateTimer(ctx, period, _wakeTimerFired,
+        RedisModule_CreateStringFromString(NULL, key_name));
 }
 
 
-ElementListNode* _getNodeForID(Dehydrator* dehydrator, RedisModuleString* element_id)
+// called after pushing into a dehydrator, brings its wake up forward if the
+// pushed elements expire before anything else in it
+void _scheduleWakeUp(RedisModuleCtx *ctx, Dehydrator* dehydrator, RedisModuleString* key_name)
 {
-		if (element_id == NULL)
-		{
-			return NULL;
-		}
-
-        ElementListNode* node = NULL;
-
-        khiter_t k = kh_get(32, dehydrator->element_nodes, RedisModule_StringPtrLen(element_id, NULL));  // first have to get iterator
-        if (k != kh_end(dehydrator->element_nodes)) // k will be equal to kh_end if key not present
-        {
-            node = kh_val(dehydrator->element_nodes, k);
-        }
-        return node;
+    if ((bpoll_waiters > 0) || (dehydrator->delivery != DEHYDRATOR_DELIVERY_NONE))
+    {
+        _armWakeTimer(ctx, dehydrator, key_name);
+    }
 }
 
-void _removeNodeFromMapping(Dehydrator* dehydrator, ElementListNode* node)
+
+// arm the timers of the dehydrators waiting to deliver, runs every
+// DELIVERY_SWEEP_MS. a replica keeps them listed until it is promoted, only
+// dropping the ones that were deleted or stopped delivering
+void _deliverySweep(RedisModuleCtx *ctx, void *data)
 {
-    khiter_t k = kh_get(32, dehydrator->element_nodes, RedisModule_StringPtrLen(node->element_id, NULL));  // first have to get iterator
-    if (k != kh_end(dehydrator->element_nodes)) // k will be equal to kh_end if key not present
+    int replica = _isReplica(ctx);
+    int kept = 0;
+    int i;
+    for (i = 0; i < pending_deliveries_len; ++i)
     {
-        kh_del(32, dehydrator->element_nodes, k);
+        PendingDelivery* pending = &(pending_deliveries[i]);
+        RedisModule_SelectDb(ctx, pending->db);
+        RedisModuleKey *key = RedisModule_OpenKey(ctx, pending->key_name, REDISMODULE_READ);
+        int delivering = 0;
+        if (RedisModule_ModuleTypeGetType(key) == DehydratorType)
+        {
+            Dehydrator* dehydrator = RedisModule_ModuleTypeGetValue(key);
+            delivering = (dehydrator->delivery != DEHYDRATOR_DELIVERY_NONE);
+            if (delivering && !replica)
+            {
+                _armWakeTimer(ctx, dehydrator, pending->key_name);
+            }
+        }
+        RedisModule_CloseKey(key);
+        if (delivering && replica)
+        {
+            pending_deliveries[kept++] = *pending;
+        }
+        else
+        {
+            RedisModule_FreeString(NULL, pending->key_name);
+        }
     }
+    pending_deliveries_len = kept;
+    RedisModule_CreateTimer(ctx, DELIVERY_SWEEP_MS, _deliverySweep, NULL);
 }
 
+
 //##########################################################
 //#
-//#                     REDIS Type
+//#                      Lazy Free
 //#
 //#########################################################
 
-void DehydratorTypeRdbSave(RedisModuleIO *rdb, void *value)
+// dehydrators holding more than lazyfree_threshold elements are destroyed by
+// a background thread, so deleting or overwriting one costs the event loop
+// O(1), like UNLINK does for the native types. set with the
+// LAZYFREE_THRESHOLD module argument
+#define LAZYFREE_DEFAULT_THRESHOLD 64
+
+static long long lazyfree_threshold = LAZYFREE_DEFAULT_THRESHOLD;
+static int lazyfree_started = 0;
+static pthread_t lazyfree_thread;
+static pthread_mutex_t lazyfree_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t lazyfree_cond = PTHREAD_COND_INITIALIZER;
+static Dehydrator** lazyfree_jobs = NULL;
+static int lazyfree_jobs_len = 0;
+static int lazyfree_jobs_cap = 0;
+static long long lazyfree_pending = 0; // dehydrators handed over and not freed yet
+
+
+void* _lazyFreeMain(void* arg)
 {
-    Dehydrator *dehy = value;
-    RedisModule_SaveString(rdb, dehy->name);
-    RedisModule_SaveUnsigned(rdb, kh_size(dehy->timeout_queues));
-    // for each timeout_queue in timeout_queues
-    khiter_t k;
-    for (k = kh_begin(dehy->timeout_queues); k != kh_end(dehy->timeout_queues); ++k)
+    while (1)
     {
-        if (!kh_exist(dehy->timeout_queues, k)) continue;
-        ElementList* list = kh_value(dehy->timeout_queues, k);
-        int ttl = kh_key(dehy->timeout_queues, k);
-        RedisModule_SaveUnsigned(rdb, ttl);
-        RedisModule_SaveUnsigned(rdb, list->len);
-        ElementListNode* node = list->head;
-        int done_with_queue = 0;
-        while (!done_with_queue)
+        pthread_mutex_lock(&lazyfree_mutex);
+        while (lazyfree_jobs_len == 0)
         {
-            if ((node != NULL))
-            {
-                RedisModule_SaveUnsigned(rdb, node->expiration);
-                RedisModule_SaveString(rdb, node->element_id);
-                RedisModule_SaveString(rdb, node->element);
-                node = node->next;
-            }
-            else
-            {
-                done_with_queue = 1;
-            }
+            pthread_cond_wait(&lazyfree_cond, &lazyfree_mutex);
+        }
+        // take the whole batch, so the main thread never waits on a free
+        Dehydrator** jobs = lazyfree_jobs;
+        int jobs_len = lazyfree_jobs_len;
+        lazyfree_jobs = NULL;
+        lazyfree_jobs_len = 0;
+        lazyfree_jobs_cap = 0;
+        pthread_mutex_unlock(&lazyfree_mutex);
+
+        int i;
+        for (i = 0; i < jobs_len; ++i)
+        {
+            deleteDehydrator(jobs[i]);
+            __atomic_sub_fetch(&lazyfree_pending, 1, __ATOMIC_RELAXED);
         }
+        RedisModule_Free(jobs);
     }
+    return NULL;
 }
 
-void *DehydratorTypeRdbLoad(RedisModuleIO *rdb, int encver)
+
+int _lazyFreeStart(void)
 {
-    if (encver != 0) { return NULL; }
-    khiter_t k;
-    RedisModuleString* name = RedisModule_LoadString(rdb);
-    Dehydrator *dehy = _createDehydrator(name);
-    //create an ElementListNode
-    uint64_t queue_num = RedisModule_LoadUnsigned(rdb);
-    while(queue_num--)
+    if (pthread_create(&lazyfree_thread, NULL, _lazyFreeMain, NULL) != 0)
     {
-        ElementList* timeout_queue = _createNewList();
-        uint64_t ttl = RedisModule_LoadUnsigned(rdb);
-
-        uint64_t node_num = RedisModule_LoadUnsigned(rdb);
-        while(node_num--)
-        {
-            uint64_t expiration = RedisModule_LoadUnsigned(rdb);
-            RedisModuleString* element_id = RedisModule_LoadString(rdb);
-            RedisModuleString* element = RedisModule_LoadString(rdb);
-
-            ElementListNode* node  = _createNewNode(element, element_id, ttl, expiration);
-            _listPush(timeout_queue, node);
-
-            // mark element dehytion location in element_nodes
-            int retval;
-            k = kh_put(32, dehy->element_nodes, RedisModule_StringPtrLen(element_id, NULL), &retval);
-            kh_value(dehy->element_nodes, k) = node;
-        }
-
-        int retval;
-        k = kh_put(16, dehy->timeout_queues, ttl, &retval);
-        kh_value(dehy->timeout_queues, k) = timeout_queue;
+        return REDISMODULE_ERR;
     }
-
-    return dehy;
+    pthread_detach(lazyfree_thread);
+    lazyfree_started = 1;
+    return REDISMODULE_OK;
 }
 
-void DehydratorTypeAofRewrite(RedisModuleIO *aof, RedisModuleString *key, void *value)
-{
-    // REDISMODULE_NOT_USED(aof);
-    // REDISMODULE_NOT_USED(key);
-    // REDISMODULE_NOT_USED(value);
-    // TODO: stub
-    // struct DehydratorTypeObject *hto = value;
-    // struct DehydratorTypeNode *node = hto->head;
-    // while(node) {
-    //     RedisModule_EmitAOF(aof,"HELLOTYPE.INSERT","sl",key,node->value);
-    //     node = node->next;
-    // }
-}
 
-void DehydratorTypeDigest(RedisModuleDigest *digest, void *value)
+// free the dehydrator on the background thread if it is large enough to be
+// worth it, returns REDISMODULE_ERR if it was left to the caller. the strings
+// of the module must have been released already
+int _lazyFreeDehydrator(Dehydrator* dehydrator)
 {
-    // REDISMODULE_NOT_USED(digest);
-    // REDISMODULE_NOT_USED(value);
-    /* TODO: The DIGEST module interface is yet not implemented. */
+    long long elements = _dehydratorLen(dehydrator);
+    if ((!lazyfree_started) || (elements <= lazyfree_threshold))
+    {
+        return REDISMODULE_ERR;
+    }
+    __atomic_add_fetch(&lazyfree_pending, 1, __ATOMIC_RELAXED);
+    pthread_mutex_lock(&lazyfree_mutex);
+    if (lazyfree_jobs_len == lazyfree_jobs_cap)
+    {
+        lazyfree_jobs_cap = (lazyfree_jobs_cap == 0) ? 16 : lazyfree_jobs_cap * 2;
+        lazyfree_jobs = RedisModule_Realloc(lazyfree_jobs, lazyfree_jobs_cap * sizeof(Dehydrator*));
+    }
+    lazyfree_jobs[lazyfree_jobs_len] = dehydrator;
+    lazyfree_jobs_len = lazyfree_jobs_len + 1;
+    pthread_cond_signal(&lazyfree_cond);
+    pthread_mutex_unlock(&lazyfree_mutex);
+    return REDISMODULE_OK;
 }
 
-void DehydratorTypeFree(void *value)
+
+//##########################################################
+//#
+//#                     INFO Section
+//#
+//#########################################################
+
+// the module section of INFO, totals over all the dehydrators
+void DehydratorInfo(RedisModuleInfoCtx *ctx, int for_crash_report)
 {
-    deleteDehydrator(value);
+    RedisModule_InfoAddSection(ctx, "stats");
+    RedisModule_InfoAddFieldLongLong(ctx, "dehydrators", rede_dehydrators);
+    RedisModule_InfoAddFieldULongLong(ctx, "pushed", rede_totals.pushed);
+    RedisModule_InfoAddFieldULongLong(ctx, "pulled", rede_totals.pulled);
+    RedisModule_InfoAddFieldULongLong(ctx, "polled", rede_totals.polled);
+    RedisModule_InfoAddFieldULongLong(ctx, "updated", rede_totals.updated);
+    RedisModule_InfoAddFieldLongLong(ctx, "bpoll_waiters", bpoll_waiters);
+    RedisModule_InfoAddFieldLongLong(ctx, "lazyfree_pending",
+        __atomic_load_n(&lazyfree_pending, __ATOMIC_RELAXED));
 }
 
 
 //##########################################################
 //#
-//#                     REDIS Commands
+//#                     REDIS Type
 //#
 //#########################################################
 
-int UpdateCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc)
-{
-    if (argc != 4)
-    {
-      return RedisModule_WrongArity(ctx);
-    }
+// since encoding version 4 the nodes are saved in string chunks of about
+// RDB_CHUNK_SIZE bytes rather than as separate RDB values. in a chunk every
+// node takes the varint delta of its expiration from the one before it (the
+// first from a base expiration saved ahead of the chunks), its ttl when on a
+// wheel, its element id (an integer or a length and bytes) and its element
+#define RDB_CHUNK_SIZE (64 * 1024)
 
-    RedisModuleString* dehydrator_name = argv[1];
-    RedisModuleString* element_id = argv[2];
-    RedisModuleString* updated_element = argv[3];
-
-    // get key dehydrator_name
-    RedisModuleKey *key = RedisModule_OpenKey(ctx, dehydrator_name,
-        REDISMODULE_READ|REDISMODULE_WRITE);
-    Dehydrator * dehydrator = validateDehydratorKey(ctx, key, NULL);
-    if (dehydrator == NULL)
-    {
-        RedisModule_ReplyWithError(ctx, "ERROR: No Such dehydrator.");
-        return REDISMODULE_ERR;
-    }
-
-    ElementListNode* node = _getNodeForID(dehydrator, element_id);
-    if (node == NULL)
-    {
-        RedisModule_ReplyWithError(ctx, "ERROR: No Such Element.");
-        return REDISMODULE_ERR;
-    } // no element with such element_id
+typedef struct rdb_buffer{
+    char* data;
+    size_t len;
+    size_t cap;
+} RdbBuffer;
 
-    //send reply to user
-    RedisModule_ReplyWithString(ctx, node->element);
-    RedisModule_Free(node->element);
-    node->element = RedisModule_CreateStringFromString(ctx, updated_element);
 
-    RedisModule_CloseKey(key);
-    return REDISMODULE_OK;
+static inline uint64_t _zigzag(long long value)
+{
+    return ((uint64_t)value << 1) ^ (uint64_t)(value >> 63);
 }
 
-int TimeToNextCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc)
+
+static inline long long _unzigzag(uint64_t value)
 {
+    return (long long)(value >> 1) ^ -(long long)(value & 1);
+}
 
-    if (argc != 2)
-    {
-      return RedisModule_WrongArity(ctx);
-    }
-    RedisModuleString* dehydrator_name = argv[1];
 
-    // get key dehydrator_name
-    RedisModuleKey *key = RedisModule_OpenKey(ctx, dehydrator_name, REDISMODULE_READ);
-    Dehydrator* dehydrator = validateDehydratorKey(ctx, key, NULL);
-    if (dehydrator == NULL)
+void _rdbBufferReserve(RdbBuffer* buf, size_t len)
+{
+    if (buf->len + len <= buf->cap) { return; }
+    while (buf->len + len > buf->cap)
     {
-        RedisModule_ReplyWithNull(ctx);
-        return REDISMODULE_OK;
+        buf->cap = (buf->cap == 0) ? RDB_CHUNK_SIZE : buf->cap * 2;
     }
+    buf->data = RedisModule_Realloc(buf->data, buf->cap);
+}
 
-    time_t now = current_time_ms();
-    int time_to_next = -1;
 
-    khiter_t k;
-    for (k = kh_begin(dehydrator->timeout_queues); k != kh_end(dehydrator->timeout_queues); ++k)
+void _rdbPutVarint(RdbBuffer* buf, uint64_t value)
+{
+    _rdbBufferReserve(buf, 10);
+    while (value >= 0x80)
     {
-        if (!kh_exist(dehydrator->timeout_queues, k)) continue;
-        ElementList* list = kh_value(dehydrator->timeout_queues, k);
-        ElementListNode* head = list->head;
-        if (head != NULL)
-        {
-            int tmp = head->expiration - now;
-            if (tmp <= 0)
-            {
-                time_to_next = 0;
-                break;
-            }
-            else if ((tmp < time_to_next) || (time_to_next < 0))
-            {
-                time_to_next = tmp;
-            }
-        }
+        buf->data[buf->len++] = (char)(value | 0x80);
+        value >>= 7;
     }
+    buf->data[buf->len++] = (char)value;
+}
 
-    RedisModule_CloseKey(key);
-    RedisModule_ReplyWithLongLong(ctx, time_to_next);
-    return REDISMODULE_OK;
+
+void _rdbPutBytes(RdbBuffer* buf, const char* str, size_t len)
+{
+    _rdbBufferReserve(buf, len);
+    memcpy(buf->data + buf->len, str, len);
+    buf->len += len;
 }
 
-int PrintCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc)
+
+// returns 0 if the chunk ended in the middle of the varint
+int _rdbGetVarint(const char** pos, const char* end, uint64_t* value)
 {
-    if (argc != 2)
+    uint64_t result = 0;
+    int shift;
+    for (shift = 0; (shift < 64) && (*pos < end); shift += 7)
     {
-      return RedisModule_WrongArity(ctx);
+        unsigned char byte = *((*pos)++);
+        result |= (uint64_t)(byte & 0x7f) << shift;
+        if (byte < 0x80)
+        {
+            *value = result;
+            return 1;
+        }
     }
+    return 0;
+}
 
-    // get key dehydrator_name
-    RedisModuleKey *key = RedisModule_OpenKey(ctx, argv[1], REDISMODULE_READ);
-    Dehydrator* dehydrator = validateDehydratorKey(ctx, key, NULL);
-    if (dehydrator == NULL)
-    {
-        RedisModule_ReplyWithNull(ctx);
-        return REDISMODULE_OK;
-    }
 
-    char* dehy_str = printDehydrator(dehydrator);
-    RedisModule_CloseKey(key);
-    RedisModule_ReplyWithSimpleString(ctx, dehy_str);
-    RedisModule_Free(dehy_str);
-    return REDISMODULE_OK;
+// returns 0 if the chunk ended in the middle of the string
+int _rdbGetBytes(const char** pos, const char* end, size_t len, const char** str)
+{
+    if ((size_t)(end - *pos) < len) { return 0; }
+    *str = *pos;
+    *pos += len;
+    return 1;
 }
 
 
-int LookCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc)
+void _rdbPutNode(RdbBuffer* buf, ElementListNode* node, long long expiration, long long* last_expiration)
 {
-    if (argc != 3)
+    _rdbPutVarint(buf, _zigzag(expiration - *last_expiration));
+    *last_expiration = expiration;
+    // the low bit tells an integer id from the length of a string one
+    if (node->has_int_id)
     {
-      return RedisModule_WrongArity(ctx);
+        _rdbPutVarint(buf, 1);
+        _rdbPutVarint(buf, _zigzag(node->int_id));
     }
-    RedisModuleKey *key = RedisModule_OpenKey(ctx, argv[1], REDISMODULE_READ);
-    Dehydrator * dehydrator = validateDehydratorKey(ctx, key, NULL);
-    if (dehydrator == NULL)
+    else
     {
-        RedisModule_ReplyWithNull(ctx);
-        return REDISMODULE_OK;
+        // generated ids are saved as the string they were pushed with
+        char id_buf[ELEMENT_ID_BUF_SIZE];
+        size_t element_id_len;
+        const char* element_id = _nodeElementId(node, id_buf, &element_id_len);
+        _rdbPutVarint(buf, (uint64_t)element_id_len << 1);
+        _rdbPutBytes(buf, element_id, element_id_len);
     }
+    _rdbPutVarint(buf, node->element_len);
+    _rdbPutBytes(buf, node->element, node->element_len);
+}
 
-    ElementListNode* node = _getNodeForID(dehydrator, argv[2]);
 
-    if ((node != NULL) && (node->element != NULL))
+void _rdbFlushChunk(RedisModuleIO *rdb, RdbBuffer* buf, int force)
+{
+    if ((buf->len >= RDB_CHUNK_SIZE) || (force && (buf->len > 0)))
     {
-        RedisModule_ReplyWithString(ctx, node->element);
-        RedisModule_CloseKey(key);
-        return REDISMODULE_OK;
+        RedisModule_SaveStringBuffer(rdb, buf->data, buf->len);
+        buf->len = 0;
     }
-
-    RedisModule_ReplyWithNull(ctx);
-    RedisModule_CloseKey(key);
-    return REDISMODULE_OK;
 }
 
-int push_impl(RedisModuleCtx *ctx, Dehydrator* dehydrator, RedisModuleString* timeout,
-									RedisModuleString* element, RedisModuleString* element_id)
-{
-    // timeout str to int ttl
-    long long ttl;
-    int rep = RedisModule_StringToLongLong(timeout, &ttl);
-    if (rep == REDISMODULE_ERR) { return REDISMODULE_ERR; }
 
-    // get timeout_queues[ttl]
-    ElementList* timeout_queue = NULL;
-    khiter_t k = kh_get(16, dehydrator->timeout_queues, ttl);  // first have to get iterator
-    if (k != kh_end(dehydrator->timeout_queues)) // k will be equal to kh_end if key not present
+// create and map the node of a loaded element, returns NULL if its id does
+// not fit the id mode of the dehydrator or is taken, which only a corrupt
+// RDB holds. the caller links the node into the wheel or its queue
+ElementListNode* _rdbLoadNode(Dehydrator* dehy, const char* element, size_t element_len,
+                              const char* element_id, size_t element_id_len, long long expiration)
+{
+    if (_acceptElementId(dehy, element_id, element_id_len) != DEHYDRATOR_OK)
     {
-        timeout_queue = kh_val(dehydrator->timeout_queues, k);
+        return NULL;
     }
-    if (timeout_queue == NULL) //does not exist
+    ElementListNode* node = _createNewNode(dehy, element, element_len, element_id, element_id_len, expiration);
+    if (_addNodeToMapping(dehy, node) != DEHYDRATOR_OK)
     {
-        // create an empty ElementList and add it to timeout_queues
-        timeout_queue = _createNewList();
-        int retval;
-        k = kh_put(16, dehydrator->timeout_queues, ttl, &retval);
-        kh_value(dehydrator->timeout_queues, k) = timeout_queue;
+        deleteNode(dehy, node);
+        return NULL;
     }
-
-    //let's make our own copy of these
-    RedisModuleString* saved_element_id = RedisModule_CreateStringFromString(ctx, element_id);
-
-    RedisModuleString* saved_element = RedisModule_CreateStringFromString(ctx, element);
-
-    //create an ElementListNode
-    ElementListNode* node  = _createNewNode(saved_element, saved_element_id, ttl, current_time_ms() + ttl);
-
-    // push to tail of the list
-    _listPush(timeout_queue, node);
-
-    // mark element dehytion location in element_nodes
-    int retval;
-    k = kh_put(32, dehydrator->element_nodes, RedisModule_StringPtrLen(saved_element_id, NULL), &retval);
-    kh_value(dehydrator->element_nodes, k) = node;
-
-    return REDISMODULE_OK;
+    return node;
 }
 
 
-/*
-* dehydrator.gidpush <timeout> <element>
-* dehydrate <element> for <timeout> seconds
-*/
-int GIDPushCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc)
+// load `node_num` nodes saved by _rdbPutNode into `queue`, or into the
+// wheel when it is NULL. wheel nodes saved before encoding version 7 carry a
+// ttl, which is skipped. returns REDISMODULE_ERR if a chunk or one of its
+// elements is corrupt
+int _rdbLoadNodes(RedisModuleIO *rdb, Dehydrator* dehy, uint64_t node_num,
+                  long long expiration, TimeoutQueue* queue, int encver)
 {
-    if (argc != 4)
+    int retval = REDISMODULE_OK;
+    while ((node_num > 0) && (retval == REDISMODULE_OK))
     {
-      return RedisModule_WrongArity(ctx);
+        size_t chunk_len;
+        char* chunk = RedisModule_LoadStringBuffer(rdb, &chunk_len);
+        const char* pos = chunk;
+        const char* end = chunk + chunk_len;
+        while ((node_num > 0) && (pos < end))
+        {
+            uint64_t delta, ttl = 0, tag, value, element_len;
+            const char* element_id;
+            const char* element;
+            char buf[21];
+            size_t element_id_len;
+            if (!_rdbGetVarint(&pos, end, &delta) ||
+                ((queue == NULL) && (encver < 7) && !_rdbGetVarint(&pos, end, &ttl)) ||
+                !_rdbGetVarint(&pos, end, &tag))
+            {
+                retval = REDISMODULE_ERR;
+                break;
+            }
+            if (tag & 1)
+            {
+                if (!_rdbGetVarint(&pos, end, &value))
+                {
+                    retval = REDISMODULE_ERR;
+                    break;
+                }
+                element_id_len = sprintf(buf, "%lld", _unzigzag(value));
+                element_id = buf;
+            }
+            else
+            {
+                element_id_len = tag >> 1;
+                if (!_rdbGetBytes(&pos, end, element_id_len, &element_id))
+                {
+                    retval = REDISMODULE_ERR;
+                    break;
+                }
+            }
+            if (!_rdbGetVarint(&pos, end, &element_len) ||
+                !_rdbGetBytes(&pos, end, element_len, &element))
+            {
+                retval = REDISMODULE_ERR;
+                break;
+            }
+
+            expiration += _unzigzag(delta);
+            ElementListNode* node = _rdbLoadNode(dehy, element, element_len, element_id, element_id_len, expiration);
+            if (node == NULL)
+            {
+                retval = REDISMODULE_ERR;
+                break;
+            }
+            if (queue == NULL)
+            {
+                _wheelInsert(dehy->wheel, node);
+            }
+            else
+            {
+                _queuePush(queue, node);
+            }
+            --node_num;
+        }
+        if (pos != end)
+        {
+            retval = REDISMODULE_ERR;
+        }
+        RedisModule_Free(chunk);
     }
+    return retval;
+}
 
-    RedisModuleString * dehydrator_name = argv[1];
-    // get key dehydrator_name
-    RedisModuleKey *key = RedisModule_OpenKey(ctx, dehydrator_name,
-        REDISMODULE_READ|REDISMODULE_WRITE);
-    Dehydrator* dehydrator = validateDehydratorKey(ctx, key, dehydrator_name);
-    if (dehydrator == NULL)
+
+void DehydratorTypeRdbSave(RedisModuleIO *rdb, void *value)
+{
+    Dehydrator *dehy = value;
+    RedisModule_SaveString(rdb, dehy->name);
+    RedisModule_SaveUnsigned(rdb, dehy->engine);
+    RedisModule_SaveUnsigned(rdb, dehy->id_mode);
+    RedisModule_SaveUnsigned(rdb, dehy->delivery);
+    if (dehy->delivery != DEHYDRATOR_DELIVERY_NONE)
     {
-        RedisModule_ReplyWithError(ctx, "ERROR: Not a dehydrator.");
-        RedisModule_CloseKey(key);
-        return REDISMODULE_ERR;
+        RedisModule_SaveString(rdb, dehy->delivery_target);
+        RedisModule_SaveUnsigned(rdb, dehy->delivery_db);
     }
+    RedisModule_SaveUnsigned(rdb, dehy->pull_mode);
 
-    RedisModuleString * element_id = NULL;
-    while ((element_id == NULL) || (_getNodeForID(dehydrator, element_id) != NULL))
+    RdbBuffer buf = {NULL, 0, 0};
+    ElementListNode* node;
+    long long last_expiration;
+    if (dehy->engine == DEHYDRATOR_ENGINE_WHEEL)
     {
-        char* tmp = generate_id();
-        element_id = RedisModule_CreateString(ctx, tmp, ID_LENGTH);
-        RedisModule_Free(tmp);
+        // the wheel layout depends on the time it is loaded at, so just save
+        // the nodes, by their expiration
+        TimingWheel* wheel = dehy->wheel;
+        last_expiration = _wheelNextExpiration(wheel);
+        RedisModule_SaveUnsigned(rdb, wheel->len);
+        RedisModule_SaveUnsigned(rdb, kh_size(dehy->element_generated_nodes));
+        RedisModule_SaveSigned(rdb, last_expiration);
+        int slot;
+        for (slot = 0; slot <= WHEEL_SLOTS; ++slot)
+        {
+            for (node = wheel->slots[slot].head; node != NULL; node = node->next)
+            {
+                _rdbPutNode(&buf, node, node->expiration, &last_expiration);
+                _rdbFlushChunk(rdb, &buf, 0);
+            }
+        }
+        _rdbFlushChunk(rdb, &buf, 1);
+        RedisModule_Free(buf.data);
+        return;
     }
 
-
-    int retval = push_impl(ctx, dehydrator, argv[2], argv[3], element_id);
-
-    if (retval == REDISMODULE_OK)
+    RedisModule_SaveUnsigned(rdb, kh_size(dehy->timeout_queues));
+    RedisModule_SaveUnsigned(rdb, _dehydratorLen(dehy));
+    RedisModule_SaveUnsigned(rdb, kh_size(dehy->element_generated_nodes));
+    // for each timeout_queue in timeout_queues, its nodes are in expiration
+    // order so the deltas are all small and positive. dead nodes are left out
+    khiter_t k;
+    for (k = kh_begin(dehy->timeout_queues); k != kh_end(dehy->timeout_queues); ++k)
     {
-        RedisModule_ReplyWithString(ctx, element_id);
+        if (!kh_exist(dehy->timeout_queues, k)) continue;
+        TimeoutQueue* queue = kh_value(dehy->timeout_queues, k);
+        long long live = queue->len;
+        QueueIterator iter;
+        _queueIterInit(queue, &iter);
+        while ((dehy->dead > 0) && ((node = _queueIterNext(&iter)) != NULL))
+        {
+            live -= node->dead;
+        }
+        _queueIterInit(queue, &iter);
+        while (((node = _queueIterNext(&iter)) != NULL) && node->dead);
+        last_expiration = (node != NULL) ? _queueNodeExpiration(node) : 0;
+        RedisModule_SaveUnsigned(rdb, kh_key(dehy->timeout_queues, k));
+        RedisModule_SaveUnsigned(rdb, live);
+        RedisModule_SaveSigned(rdb, last_expiration);
+        for (; node != NULL; node = _queueIterNext(&iter))
+        {
+            if (node->dead) continue;
+            _rdbPutNode(&buf, node, _queueNodeExpiration(node), &last_expiration);
+            _rdbFlushChunk(rdb, &buf, 0);
+        }
+        _rdbFlushChunk(rdb, &buf, 1);
     }
-    RedisModule_FreeString(ctx,element_id);
-
-	RedisModule_CloseKey(key);
-    return retval;
+    RedisModule_Free(buf.data);
 }
 
-/*
-* dehydrator.push <timeout> <element> <element_id>
-* dehydrate <element> for <timeout> seconds
-*/
-int PushCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc)
+Dehydrator* _rdbLoadCompact(RedisModuleIO *rdb, Dehydrator* dehy, int encver)
 {
-    if(argc != 5)
-    {
-      return RedisModule_WrongArity(ctx);
-    }
-
-	RedisModuleString * dehydrator_name = argv[1];
-	RedisModuleString * element_id = argv[4];
-    // get key dehydrator_name
-    RedisModuleKey *key = RedisModule_OpenKey(ctx, dehydrator_name,
-        REDISMODULE_READ|REDISMODULE_WRITE);
-    Dehydrator* dehydrator = validateDehydratorKey(ctx, key, dehydrator_name);
-    if (dehydrator == NULL)
+    if (dehy->engine == DEHYDRATOR_ENGINE_WHEEL)
     {
-        RedisModule_ReplyWithError(ctx, "ERROR: Not a dehydrator.");
-        RedisModule_CloseKey(key);
-        return REDISMODULE_ERR;
+        uint64_t node_num = RedisModule_LoadUnsigned(rdb);
+        // since encoding version 8 the count of generated ids follows, they have a map of their own
+        uint64_t generated = (encver >= 8) ? RedisModule_LoadUnsigned(rdb) : 0;
+        long long expiration = RedisModule_LoadSigned(rdb);
+        _reserveDehydrator(dehy, node_num, generated, 0);
+        if (_rdbLoadNodes(rdb, dehy, node_num, expiration, NULL, encver) != REDISMODULE_OK)
+        {
+            RedisModule_LogIOError(rdb, "warning", "REDE: corrupt dehydrator chunk");
+            _releaseNamedDehydrator(dehy);
+            deleteDehydrator(dehy);
+            return NULL;
+        }
+        return dehy;
     }
 
-    // now we know we have a dehydrator check if there is anything in id = element_id
-    ElementListNode* node = _getNodeForID(dehydrator, element_id);
-    if (node != NULL) // somthing is already there
+    uint64_t queue_num = RedisModule_LoadUnsigned(rdb);
+    // since encoding version 5 the element count of all queues follows theirs
+    uint64_t total = (encver >= 5) ? RedisModule_LoadUnsigned(rdb) : 0;
+    uint64_t generated = (encver >= 8) ? RedisModule_LoadUnsigned(rdb) : 0;
+    _reserveDehydrator(dehy, total, generated, queue_num);
+    while(queue_num--)
     {
-        RedisModule_ReplyWithError(ctx, "ERROR: Element already dehydrating.");
-        RedisModule_CloseKey(key);
-        return REDISMODULE_ERR;
-    }
+        uint64_t ttl = RedisModule_LoadUnsigned(rdb);
+        TimeoutQueue* timeout_queue = _createNewQueue(dehy, (int)ttl);
+        uint64_t node_num = RedisModule_LoadUnsigned(rdb);
+        long long expiration = RedisModule_LoadSigned(rdb);
+        _queueExpect(timeout_queue, node_num);
+        // map the queue before filling it, so a corrupt chunk frees its blocks with the dehydrator
+        int retval;
+        khiter_t k = kh_put(16, dehy->timeout_queues, ttl, &retval);
+        kh_value(dehy->timeout_queues, k) = timeout_queue;
+        if (_rdbLoadNodes(rdb, dehy, node_num, expiration, timeout_queue, encver) != REDISMODULE_OK)
+        {
+            // the nodes loaded so far are all mapped, they go with the dehydrator
+            RedisModule_LogIOError(rdb, "warning", "REDE: corrupt dehydrator chunk");
+            _releaseNamedDehydrator(dehy);
+            deleteDehydrator(dehy);
+            return NULL;
+        }
 
-    int retval = push_impl(ctx, dehydrator, argv[2], argv[3], element_id);
+        if (timeout_queue->len == 0)
+        {
+            kh_del(16, dehy->timeout_queues, k);
+            deleteQueue(dehy, timeout_queue);
+            continue;
+        }
 
-    if (retval == REDISMODULE_OK)
-    {
-        RedisModule_ReplyWithSimpleString(ctx, "OK");
+        _headsInsert(&(dehy->queue_heads), timeout_queue);
     }
-    RedisModule_CloseKey(key);
-    return retval;
+    return dehy;
 }
 
 
-/*
-* dehydrator.pull <element_id>
-* Pull an element off the bench by id.
-*/
-int PullCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc)
+void *DehydratorTypeRdbLoad(RedisModuleIO *rdb, int encver)
 {
-    if (argc != 3)
+    if (encver > DEHYDRATOR_ENCODING_VERSION) { return NULL; }
+    khiter_t k;
+    RedisModuleString* name = RedisModule_LoadString(rdb);
+    int engine = DEHYDRATOR_ENGINE_QUEUES;
+    if (encver >= 1)
     {
-      return RedisModule_WrongArity(ctx);
+        engine = RedisModule_LoadUnsigned(rdb);
     }
-
-    // get key dehydrator_name
-    RedisModuleKey *key = RedisModule_OpenKey(ctx, argv[1],
-        REDISMODULE_READ|REDISMODULE_WRITE);
-    Dehydrator * dehydrator = validateDehydratorKey(ctx, key, NULL);
-    if (dehydrator == NULL)
+    int id_mode = DEHYDRATOR_IDS_AUTO;
+    if (encver >= 2)
     {
-        RedisModule_ReplyWithNull(ctx);
-        return REDISMODULE_OK;
+        id_mode = RedisModule_LoadUnsigned(rdb);
     }
-
-    ElementListNode* node = _getNodeForID(dehydrator, argv[2]);
-    if (node != NULL)
+    Dehydrator *dehy = _createNamedDehydrator(name, engine, id_mode);
+    if (encver >= 3)
     {
-
-        _listPull(dehydrator, node);
-        _removeNodeFromMapping(dehydrator, node);
-
-        if (node->element == NULL)
-        {
-            RedisModule_ReplyWithNull(ctx);
-        }
-        else
+        dehy->delivery = RedisModule_LoadUnsigned(rdb);
+        if (dehy->delivery != DEHYDRATOR_DELIVERY_NONE)
         {
-            RedisModule_ReplyWithString(ctx, node->element);
+            dehy->delivery_target = RedisModule_LoadString(rdb);
+            dehy->delivery_db = RedisModule_LoadUnsigned(rdb);
+            _addPendingDelivery(name, dehy->delivery_db);
         }
-        deleteNode(node);
     }
-    else
+    if (encver >= 6)
     {
-        // no element with such element_id
-        RedisModule_ReplyWithNull(ctx);
+        dehy->pull_mode = RedisModule_LoadUnsigned(rdb);
     }
+    if (encver >= 4)
+    {
+        return _rdbLoadCompact(rdb, dehy, encver);
+    }
+
+    // encoding versions 0 to 3 keep each node field as an RDB value of its own
+    if (engine == DEHYDRATOR_ENGINE_WHEEL)
+    {
+        uint64_t node_num = RedisModule_LoadUnsigned(rdb);
+        while(node_num--)
+        {
+            RedisModule_LoadUnsigned(rdb); // the ttl, wheel nodes don't keep it
+            uint64_t expiration = RedisModule_LoadUnsigned(rdb);
+            size_t element_id_len;
+            char* element_id = RedisModule_LoadStringBuffer(rdb, &element_id_len);
+            size_t element_len;
+            char* element = RedisModule_LoadStringBuffer(rdb, &element_len);
+
+            ElementListNode* node = _rdbLoadNode(dehy, element, element_len, element_id, element_id_len, expiration);
+            RedisModule_Free(element_id);
+            RedisModule_Free(element);
+            if (node == NULL)
+            {
+                RedisModule_LogIOError(rdb, "warning", "REDE: corrupt dehydrator element");
+                _releaseNamedDehydrator(dehy);
+                deleteDehydrator(dehy);
+                return NULL;
+            }
+            _wheelInsert(dehy->wheel, node);
+        }
+        return dehy;
+    }
+    //create an ElementListNode
+    uint64_t queue_num = RedisModule_LoadUnsigned(rdb);
+    while(queue_num--)
+    {
+        uint64_t ttl = RedisModule_LoadUnsigned(rdb);
+        TimeoutQueue* timeout_queue = _createNewQueue(dehy, (int)ttl);
+
+        uint64_t node_num = RedisModule_LoadUnsigned(rdb);
+        _queueExpect(timeout_queue, node_num);
+        // mapped before it is filled, so a corrupt element frees its blocks with the dehydrator
+        int retval;
+        k = kh_put(16, dehy->timeout_queues, ttl, &retval);
+        kh_value(dehy->timeout_queues, k) = timeout_queue;
+        while(node_num--)
+        {
+            uint64_t expiration = RedisModule_LoadUnsigned(rdb);
+            size_t element_id_len;
+            char* element_id = RedisModule_LoadStringBuffer(rdb, &element_id_len);
+            size_t element_len;
+            char* element = RedisModule_LoadStringBuffer(rdb, &element_len);
+
+            // mark element dehytion location in element_nodes
+            ElementListNode* node = _rdbLoadNode(dehy, element, element_len, element_id, element_id_len, expiration);
+            RedisModule_Free(element_id);
+            RedisModule_Free(element);
+            if (node == NULL)
+            {
+                RedisModule_LogIOError(rdb, "warning", "REDE: corrupt dehydrator element");
+                _releaseNamedDehydrator(dehy);
+                deleteDehydrator(dehy);
+                return NULL;
+            }
+            _queuePush(timeout_queue, node);
+        }
+
+        if (timeout_queue->len == 0)
+        {
+            kh_del(16, dehy->timeout_queues, k);
+            deleteQueue(dehy, timeout_queue);
+            continue;
+        }
+        _headsInsert(&(dehy->queue_heads), timeout_queue);
+    }
+
+    return dehy;
+}
+
+// elements per REDE.MPUSHAT command emitted by the AOF rewrite
+#define AOF_REWRITE_BATCH 256
+
+// emit the <ttl> <expiration> <element> <element_id> groups gathered in `args`
+void _aofEmitPushes(RedisModuleIO *aof, RedisModuleString *key, RedisModuleString** args, size_t* args_len)
+{
+    if (*args_len == 0) { return; }
+    RedisModule_EmitAOF(aof, "REDE.MPUSHAT", "sv", key, args, *args_len);
+    size_t pos;
+    for (pos = 0; pos < *args_len; ++pos)
+    {
+        RedisModule_FreeString(NULL, args[pos]);
+    }
+    *args_len = 0;
+}
+
+
+// `ttl` is the one of the node's queue, wheel nodes don't keep theirs and
+// the wheel ignores it
+void _aofAddPush(RedisModuleIO *aof, RedisModuleString *key, RedisModuleString** args, size_t* args_len,
+                 ElementListNode* node, long long ttl, long long expiration)
+{
+    char buf[ELEMENT_ID_BUF_SIZE];
+    size_t element_id_len;
+    const char* element_id = _nodeElementId(node, buf, &element_id_len);
+    args[(*args_len)++] = RedisModule_CreateStringFromLongLong(NULL, ttl);
+    args[(*args_len)++] = RedisModule_CreateStringFromLongLong(NULL, expiration);
+    args[(*args_len)++] = RedisModule_CreateString(NULL, node->element, node->element_len);
+    args[(*args_len)++] = RedisModule_CreateString(NULL, element_id, element_id_len);
+    if (*args_len == AOF_REWRITE_BATCH * 4)
+    {
+        _aofEmitPushes(aof, key, args, args_len);
+    }
+}
+
+
+// rebuild the dehydrator with its settings and then batches of elements that
+// keep their absolute expiration, so they don't get a fresh ttl when replayed
+void DehydratorTypeAofRewrite(RedisModuleIO *aof, RedisModuleString *key, void *value)
+{
+    Dehydrator *dehy = value;
+    const char* ids[] = {"STRING", "INT", "AUTO"};
+    RedisModule_EmitAOF(aof, "REDE.CREATE", "scccccc", key,
+        "ENGINE", (dehy->engine == DEHYDRATOR_ENGINE_WHEEL) ? "WHEEL" : "QUEUES",
+        "IDS", ids[dehy->id_mode],
+        "PULL", (dehy->pull_mode == DEHYDRATOR_PULL_LAZY) ? "LAZY" : "EAGER");
+    if (dehy->delivery != DEHYDRATOR_DELIVERY_NONE)
+    {
+        const char* deliveries[] = {"NONE", "PUBLISH", "RPUSH", "XADD"};
+        RedisModule_EmitAOF(aof, "REDE.DELIVER", "scs", key, deliveries[dehy->delivery], dehy->delivery_target);
+    }
+
+    RedisModuleString* args[AOF_REWRITE_BATCH * 4];
+    size_t args_len = 0;
+    ElementListNode* node;
+    if (dehy->engine == DEHYDRATOR_ENGINE_WHEEL)
+    {
+        int slot;
+        for (slot = 0; slot <= WHEEL_SLOTS; ++slot)
+        {
+            for (node = dehy->wheel->slots[slot].head; node != NULL; node = node->next)
+            {
+                _aofAddPush(aof, key, args, &args_len, node, 0, node->expiration);
+            }
+        }
+    }
+    else
+    {
+        // each queue is emitted in order, so replaying keeps it sorted by expiration
+        khiter_t k;
+        for (k = kh_begin(dehy->timeout_queues); k != kh_end(dehy->timeout_queues); ++k)
+        {
+            if (!kh_exist(dehy->timeout_queues, k)) continue;
+            TimeoutQueue* queue = kh_value(dehy->timeout_queues, k);
+            QueueIterator iter;
+            _queueIterInit(queue, &iter);
+            while ((node = _queueIterNext(&iter)) != NULL)
+            {
+                if (node->dead) continue;
+                _aofAddPush(aof, key, args, &args_len, node, queue->ttl, _queueNodeExpiration(node));
+            }
+        }
+    }
+    _aofEmitPushes(aof, key, args, &args_len);
+}
+
+void DehydratorTypeDigest(RedisModuleDigest *digest, void *value)
+{
+    // REDISMODULE_NOT_USED(digest);
+    // REDISMODULE_NOT_USED(value);
+    /* TODO: The DIGEST module interface is yet not implemented. */
+}
+
+void DehydratorTypeFree(void *value)
+{
+    _releaseNamedDehydrator(value);
+    if (_lazyFreeDehydrator(value) != REDISMODULE_OK)
+    {
+        deleteDehydrator(value);
+    }
+}
+
+
+//##########################################################
+//#
+//#                     REDIS Commands
+//#
+//#########################################################
+
+/*
+* rede.create <dehydrator_name> [ENGINE QUEUES|WHEEL] [IDS AUTO|INT|STRING] [PULL EAGER|LAZY]
+* create an empty dehydrator, choosing how it keeps its elements ordered by expiration
+*/
+int CreateCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc)
+{
+    if ((argc < 2) || (argc % 2 != 0))
+    {
+      return RedisModule_WrongArity(ctx);
+    }
+
+    // options come in <name> <value> pairs, only argv[pos] is matched
+    int engine = DEHYDRATOR_ENGINE_QUEUES;
+    int id_mode = DEHYDRATOR_IDS_AUTO;
+    int pull_mode = DEHYDRATOR_PULL_EAGER;
+    int pos;
+    for (pos = 2; pos < argc; pos += 2)
+    {
+        if (RMUtil_ArgExists("ENGINE", argv, pos + 1, pos))
+        {
+            if (RMUtil_ArgExists("WHEEL", argv, pos + 2, pos + 1))
+            {
+                engine = DEHYDRATOR_ENGINE_WHEEL;
+            }
+            else if (RMUtil_ArgExists("QUEUES", argv, pos + 2, pos + 1))
+            {
+                engine = DEHYDRATOR_ENGINE_QUEUES;
+            }
+            else
+            {
+                RedisModule_ReplyWithError(ctx, "ERROR: Unknown engine.");
+                return REDISMODULE_ERR;
+            }
+        }
+        else if (RMUtil_ArgExists("IDS", argv, pos + 1, pos))
+        {
+            if (RMUtil_ArgExists("INT", argv, pos + 2, pos + 1))
+            {
+                id_mode = DEHYDRATOR_IDS_INT;
+            }
+            else if (RMUtil_ArgExists("STRING", argv, pos + 2, pos + 1))
+            {
+                id_mode = DEHYDRATOR_IDS_STRING;
+            }
+            else if (RMUtil_ArgExists("AUTO", argv, pos + 2, pos + 1))
+            {
+                id_mode = DEHYDRATOR_IDS_AUTO;
+            }
+            else
+            {
+                RedisModule_ReplyWithError(ctx, "ERROR: Unknown id mode.");
+                return REDISMODULE_ERR;
+            }
+        }
+        else if (RMUtil_ArgExists("PULL", argv, pos + 1, pos))
+        {
+            if (RMUtil_ArgExists("LAZY", argv, pos + 2, pos + 1))
+            {
+                pull_mode = DEHYDRATOR_PULL_LAZY;
+            }
+            else if (RMUtil_ArgExists("EAGER", argv, pos + 2, pos + 1))
+            {
+                pull_mode = DEHYDRATOR_PULL_EAGER;
+            }
+            else
+            {
+                RedisModule_ReplyWithError(ctx, "ERROR: Unknown pull mode.");
+                return REDISMODULE_ERR;
+            }
+        }
+        else
+        {
+            RedisModule_ReplyWithError(ctx, "ERROR: Unknown option.");
+            return REDISMODULE_ERR;
+        }
+    }
+
+    // the wheel unlinks a pulled node without looking anything up anyway
+    if ((pull_mode == DEHYDRATOR_PULL_LAZY) && (engine == DEHYDRATOR_ENGINE_WHEEL))
+    {
+        RedisModule_ReplyWithError(ctx, "ERROR: Lazy pull needs the queues engine.");
+        return REDISMODULE_ERR;
+    }
+
+    RedisModuleString* dehydrator_name = argv[1];
+    RedisModuleKey *key = RedisModule_OpenKey(ctx, dehydrator_name,
+        REDISMODULE_READ|REDISMODULE_WRITE);
+    if (RedisModule_KeyType(key) != REDISMODULE_KEYTYPE_EMPTY)
+    {
+        RedisModule_ReplyWithError(ctx, "ERROR: Key already exists.");
+        RedisModule_CloseKey(key);
+        return REDISMODULE_ERR;
+    }
+
+    RedisModuleString* saved_dehydrator_name = RedisModule_CreateStringFromString(ctx, dehydrator_name);
+    Dehydrator* dehydrator = _createNamedDehydrator(saved_dehydrator_name, engine, id_mode);
+    dehydrator->pull_mode = pull_mode;
+    RedisModule_ModuleTypeSetValue(key, DehydratorType, dehydrator);
+
+    RedisModule_ReplicateVerbatim(ctx);
+    RedisModule_ReplyWithSimpleString(ctx, "OK");
+    RedisModule_CloseKey(key);
+    return REDISMODULE_OK;
+}
+
+/*
+* rede.deliver <dehydrator_name> PUBLISH|RPUSH|XADD <target>
+* rede.deliver <dehydrator_name> NONE
+* have the server itself move elements to a channel, list or stream as they expire
+*/
+int DeliverCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc)
+{
+    if ((argc != 3) && (argc != 4))
+    {
+      return RedisModule_WrongArity(ctx);
+    }
+
+    int delivery;
+    if (RMUtil_ArgExists("NONE", argv, 3, 2))
+    {
+        delivery = DEHYDRATOR_DELIVERY_NONE;
+    }
+    else if (RMUtil_ArgExists("PUBLISH", argv, 3, 2))
+    {
+        delivery = DEHYDRATOR_DELIVERY_PUBLISH;
+    }
+    else if (RMUtil_ArgExists("RPUSH", argv, 3, 2))
+    {
+        delivery = DEHYDRATOR_DELIVERY_RPUSH;
+    }
+    else if (RMUtil_ArgExists("XADD", argv, 3, 2))
+    {
+        delivery = DEHYDRATOR_DELIVERY_XADD;
+    }
+    else
+    {
+        RedisModule_ReplyWithError(ctx, "ERROR: Unknown delivery.");
+        return REDISMODULE_ERR;
+    }
+    if ((delivery == DEHYDRATOR_DELIVERY_NONE) != (argc == 3))
+    {
+        return RedisModule_WrongArity(ctx);
+    }
+    if ((delivery != DEHYDRATOR_DELIVERY_NONE) && (delivery != DEHYDRATOR_DELIVERY_PUBLISH) &&
+        (RedisModule_StringCompare(argv[1], argv[3]) == 0))
+    {
+        RedisModule_ReplyWithError(ctx, "ERROR: Cannot deliver into the dehydrator itself.");
+        return REDISMODULE_ERR;
+    }
+
+    RedisModuleString* dehydrator_name = argv[1];
+    RedisModuleKey *key = RedisModule_OpenKey(ctx, dehydrator_name,
+        REDISMODULE_READ|REDISMODULE_WRITE);
+    Dehydrator* dehydrator = validateDehydratorKey(ctx, key, dehydrator_name);
+    if (dehydrator == NULL)
+    {
+        RedisModule_ReplyWithError(ctx, "ERROR: Not a dehydrator.");
+        RedisModule_CloseKey(key);
+        return REDISMODULE_ERR;
+    }
+
+    if (dehydrator->delivery_target != NULL)
+    {
+        RedisModule_FreeString(NULL, dehydrator->delivery_target);
+        dehydrator->delivery_target = NULL;
+    }
+    dehydrator->delivery = delivery;
+    if (delivery != DEHYDRATOR_DELIVERY_NONE)
+    {
+        dehydrator->delivery_target = RedisModule_CreateStringFromString(NULL, argv[3]);
+        dehydrator->delivery_db = RedisModule_GetSelectedDb(ctx);
+
+        // whatever already expired goes out on the next event loop iteration
+        _armWakeTimer(ctx, dehydrator, dehydrator_name);
+    }
+
+    RedisModule_ReplicateVerbatim(ctx);
+    RedisModule_ReplyWithSimpleString(ctx, "OK");
+    RedisModule_CloseKey(key);
+    return REDISMODULE_OK;
+}
+
+
+
+int UpdateCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc)
+{
+    if (argc != 4)
+    {
+      return RedisModule_WrongArity(ctx);
+    }
+
+    RedisModuleString* dehydrator_name = argv[1];
+    RedisModuleString* element_id = argv[2];
+    RedisModuleString* updated_element = argv[3];
+
+    // get key dehydrator_name
+    RedisModuleKey *key = RedisModule_OpenKey(ctx, dehydrator_name,
+        REDISMODULE_READ|REDISMODULE_WRITE);
+    Dehydrator * dehydrator = validateDehydratorKey(ctx, key, NULL);
+    if (dehydrator == NULL)
+    {
+        RedisModule_ReplyWithError(ctx, "ERROR: No Such dehydrator.");
+        return REDISMODULE_ERR;
+    }
+
+    ElementListNode* node = _getNodeForString(dehydrator, element_id);
+    if (node == NULL)
+    {
+        RedisModule_ReplyWithError(ctx, "ERROR: No Such Element.");
+        return REDISMODULE_ERR;
+    } // no element with such element_id
+
+    //send reply to user
+    RedisModule_ReplyWithStringBuffer(ctx, node->element, node->element_len);
+    size_t updated_element_len;
+    const char* updated_element_str = RedisModule_StringPtrLen(updated_element, &updated_element_len);
+    _nodeSetElement(dehydrator, node, updated_element_str, updated_element_len);
+    DEHYDRATOR_COUNT(dehydrator, updated, 1);
+    RedisModule_ReplicateVerbatim(ctx);
+
     RedisModule_CloseKey(key);
     return REDISMODULE_OK;
 }
 
-/*
-* dehydrator.poll
-* get all elements which were dried for long enogh
-*/
-int PollCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc)
-{
-    if (argc != 2)
-    {
-      return RedisModule_WrongArity(ctx);
-    }
+int TimeToNextCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc)
+{
+
+    if (argc != 2)
+    {
+      return RedisModule_WrongArity(ctx);
+    }
+    RedisModuleString* dehydrator_name = argv[1];
+
+    // get key dehydrator_name
+    RedisModuleKey *key = RedisModule_OpenKey(ctx, dehydrator_name, REDISMODULE_READ);
+    Dehydrator* dehydrator = validateDehydratorKey(ctx, key, NULL);
+    if (dehydrator == NULL)
+    {
+        RedisModule_ReplyWithNull(ctx);
+        return REDISMODULE_OK;
+    }
+
+    long long now = current_time_ms();
+    int time_to_next = -1;
+
+    // the earliest expiration sits on top of the queue heads index (or in
+    // the wheel's cached next expiration), no need to scan every queue
+    long long next_expiration = _dehydratorNextExpiration(dehydrator);
+    if (next_expiration >= 0)
+    {
+        time_to_next = (next_expiration > now) ? next_expiration - now : 0;
+    }
+
+    RedisModule_CloseKey(key);
+    RedisModule_ReplyWithLongLong(ctx, time_to_next);
+    return REDISMODULE_OK;
+}
+
+int PrintCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc)
+{
+    if (argc != 2)
+    {
+      return RedisModule_WrongArity(ctx);
+    }
+
+    // get key dehydrator_name
+    RedisModuleKey *key = RedisModule_OpenKey(ctx, argv[1], REDISMODULE_READ);
+    Dehydrator* dehydrator = validateDehydratorKey(ctx, key, NULL);
+    if (dehydrator == NULL)
+    {
+        RedisModule_ReplyWithNull(ctx);
+        return REDISMODULE_OK;
+    }
+
+    char* dehy_str = printDehydrator(dehydrator);
+    RedisModule_CloseKey(key);
+    RedisModule_ReplyWithSimpleString(ctx, dehy_str);
+    RedisModule_Free(dehy_str);
+    return REDISMODULE_OK;
+}
+
+
+// reply with a field value pair of a stats reply
+static void _replyWithStat(RedisModuleCtx *ctx, const char* field, long long value)
+{
+    RedisModule_ReplyWithSimpleString(ctx, field);
+    RedisModule_ReplyWithLongLong(ctx, value);
+}
+
+
+// entries over buckets of a hash map, 0 when it has no buckets yet
+static double _loadFactor(size_t size, size_t buckets)
+{
+    return (buckets > 0) ? (double)size / buckets : 0;
+}
+
+
+/*
+* rede.stats <dehydrator_name>
+* the counters of the dehydrator and how late it delivered its elements, as
+* field value pairs. only the expired backlog is not kept up to date, it is
+* counted from the queues (or wheel slots) that are due
+*/
+int StatsCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc)
+{
+    if (argc != 2)
+    {
+      return RedisModule_WrongArity(ctx);
+    }
+
+    RedisModuleKey *key = RedisModule_OpenKey(ctx, argv[1], REDISMODULE_READ);
+    Dehydrator* dehydrator = validateDehydratorKey(ctx, key, NULL);
+    if (dehydrator == NULL)
+    {
+        RedisModule_ReplyWithNull(ctx);
+        return REDISMODULE_OK;
+    }
+
+    khint_t id_buckets = kh_n_buckets(dehydrator->element_nodes) + kh_n_buckets(dehydrator->element_int_nodes) +
+                         kh_n_buckets(dehydrator->element_generated_nodes);
+    LagHistogram* lag = dehydrator->lag;
+    RedisModule_ReplyWithArray(ctx, 32);
+    _replyWithStat(ctx, "elements", _dehydratorLen(dehydrator));
+    _replyWithStat(ctx, "queues", kh_size(dehydrator->timeout_queues));
+    _replyWithStat(ctx, "id_bytes", dehydrator->id_bytes);
+    _replyWithStat(ctx, "element_bytes", dehydrator->element_bytes);
+    _replyWithStat(ctx, "pushed", dehydrator->stats.pushed);
+    _replyWithStat(ctx, "pulled", dehydrator->stats.pulled);
+    _replyWithStat(ctx, "polled", dehydrator->stats.polled);
+    _replyWithStat(ctx, "updated", dehydrator->stats.updated);
+    _replyWithStat(ctx, "expired_backlog", _dehydratorCountExpired(dehydrator, current_time_ms()));
+    _replyWithStat(ctx, "dead_nodes", dehydrator->dead);
+    _replyWithStat(ctx, "lag_p50", _lagPercentile(lag, 50));
+    _replyWithStat(ctx, "lag_p99", _lagPercentile(lag, 99));
+    _replyWithStat(ctx, "lag_p999", _lagPercentile(lag, 99.9));
+    _replyWithStat(ctx, "lag_max", (lag != NULL) ? lag->max : 0);
+    RedisModule_ReplyWithSimpleString(ctx, "ids_load_factor");
+    RedisModule_ReplyWithDouble(ctx, _loadFactor(_dehydratorLen(dehydrator), id_buckets));
+    RedisModule_ReplyWithSimpleString(ctx, "queues_load_factor");
+    RedisModule_ReplyWithDouble(ctx, _loadFactor(kh_size(dehydrator->timeout_queues),
+                                                 kh_n_buckets(dehydrator->timeout_queues)));
+    RedisModule_CloseKey(key);
+    return REDISMODULE_OK;
+}
+
+
+int LookCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc)
+{
+    if (argc != 3)
+    {
+      return RedisModule_WrongArity(ctx);
+    }
+    RedisModuleKey *key = RedisModule_OpenKey(ctx, argv[1], REDISMODULE_READ);
+    Dehydrator * dehydrator = validateDehydratorKey(ctx, key, NULL);
+    if (dehydrator == NULL)
+    {
+        RedisModule_ReplyWithNull(ctx);
+        return REDISMODULE_OK;
+    }
+
+    ElementListNode* node = _getNodeForString(dehydrator, argv[2]);
+
+    if ((node != NULL) && (node->element != NULL))
+    {
+        RedisModule_ReplyWithStringBuffer(ctx, node->element, node->element_len);
+        RedisModule_CloseKey(key);
+        return REDISMODULE_OK;
+    }
+
+    RedisModule_ReplyWithNull(ctx);
+    RedisModule_CloseKey(key);
+    return REDISMODULE_OK;
+}
+
+
+#define MULTI_ID_BATCH 16
+
+// look up (and pull, if `pull` is set) every id in argv[2..], replying with
+// an array of the elements aligned to the ids. ids are resolved in batches,
+// prefetching all of their map buckets, then their nodes, then probing.
+int mlook_impl(RedisModuleCtx *ctx, RedisModuleString **argv, int argc, int pull)
+{
+    if (argc < 3)
+    {
+      return RedisModule_WrongArity(ctx);
+    }
+
+    RedisModuleKey *key = RedisModule_OpenKey(ctx, argv[1],
+        pull ? (REDISMODULE_READ|REDISMODULE_WRITE) : REDISMODULE_READ);
+    int id_num = argc - 2;
+    if (RedisModule_KeyType(key) == REDISMODULE_KEYTYPE_EMPTY)
+    {
+        RedisModule_ReplyWithArray(ctx, id_num);
+        int i;
+        for (i = 0; i < id_num; ++i)
+        {
+            RedisModule_ReplyWithNull(ctx);
+        }
+        RedisModule_CloseKey(key);
+        return REDISMODULE_OK;
+    }
+    Dehydrator* dehydrator = validateDehydratorKey(ctx, key, NULL);
+    if (dehydrator == NULL)
+    {
+        return REDISMODULE_OK; // wrong type, already replied
+    }
+
+    RedisModule_ReplyWithArray(ctx, id_num);
+    RedisModuleString* pulled_ids[REPLICATE_BATCH];
+    size_t pulled_ids_len = 0;
+    RedisModuleString** element_ids = argv + 2;
+    ElementListNode** buckets[MULTI_ID_BATCH];
+    ElementListNode* nodes[MULTI_ID_BATCH];
+    int batch_start;
+    for (batch_start = 0; batch_start < id_num; batch_start += MULTI_ID_BATCH)
+    {
+        int batch_len = id_num - batch_start;
+        if (batch_len > MULTI_ID_BATCH) { batch_len = MULTI_ID_BATCH; }
+        int i;
+
+        for (i = 0; i < batch_len; ++i)
+        {
+            size_t element_id_len;
+            const char* element_id_str = RedisModule_StringPtrLen(element_ids[batch_start + i], &element_id_len);
+            buckets[i] = _prefetchIdBucket(dehydrator, element_id_str, element_id_len);
+        }
+        for (i = 0; i < batch_len; ++i)
+        {
+            _prefetchNodeInBucket(buckets[i]);
+        }
+        for (i = 0; i < batch_len; ++i)
+        {
+            nodes[i] = _getNodeForString(dehydrator, element_ids[batch_start + i]);
+        }
+
+        for (i = 0; i < batch_len; ++i)
+        {
+            ElementListNode* node = nodes[i];
+            if (node == NULL)
+            {
+                RedisModule_ReplyWithNull(ctx);
+                continue;
+            }
+            RedisModule_ReplyWithStringBuffer(ctx, node->element, node->element_len);
+            if (pull)
+            {
+                // an id repeated later in the batch was found before this pull
+                int j;
+                for (j = i + 1; j < batch_len; ++j)
+                {
+                    if (nodes[j] == node) { nodes[j] = NULL; }
+                }
+                _replicatePull(ctx, argv[1], pulled_ids, &pulled_ids_len, node);
+                _pullNode(dehydrator, node);
+                DEHYDRATOR_COUNT(dehydrator, pulled, 1);
+            }
+        }
+    }
+    _replicateArgs(ctx, "REDE.MPULL", argv[1], pulled_ids, &pulled_ids_len);
+
+    RedisModule_CloseKey(key);
+    return REDISMODULE_OK;
+}
+
+
+/*
+* rede.mlook <dehydrator_name> <element_id> [<element_id> ...]
+* show the elements of a batch of ids without pulling them
+*/
+int MLookCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc)
+{
+    return mlook_impl(ctx, argv, argc, 0);
+}
+
+
+/*
+* rede.mpull <dehydrator_name> <element_id> [<element_id> ...]
+* pull the elements of a batch of ids off the bench
+*/
+int MPullCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc)
+{
+    return mlook_impl(ctx, argv, argc, 1);
+}
+
+
+
+// parse the ttl of a push, returns the error to reply with or NULL if it
+// can be used. a ttl keys a timeout queue so it has to fit one, and only
+// pushes at an absolute expiration take negative ones: the AOF rewrite
+// restores the queue of DEHYDRATOR_RETRY_TTL with them
+const char* _parsePushTTL(RedisModuleString* str, long long* ttl, int absolute)
+{
+    if ((RedisModule_StringToLongLong(str, ttl) == REDISMODULE_ERR) || (*ttl < INT_MIN) || (*ttl > INT_MAX))
+    {
+        return "ERROR: TTL must be a 32-bit integer.";
+    }
+    if (!absolute && (*ttl < 0))
+    {
+        return "ERROR: TTL must be a non-negative integer.";
+    }
+    return NULL;
+}
+
+
+// check `element_id` can be pushed into the dehydrator, returns the error
+// to reply with or NULL if it can
+const char* _checkPushElementId(Dehydrator* dehydrator, RedisModuleString* element_id)
+{
+    size_t element_id_len;
+    const char* element_id_str = RedisModule_StringPtrLen(element_id, &element_id_len);
+    if (_acceptElementId(dehydrator, element_id_str, element_id_len) != DEHYDRATOR_OK)
+    {
+        return "ERROR: Element id must be an integer.";
+    }
+
+    // now we know we have a dehydrator check if there is anything in id = element_id
+    if (_getNodeForID(dehydrator, element_id_str, element_id_len) != NULL) // somthing is already there
+    {
+        return "ERROR: Element already dehydrating.";
+    }
+    return NULL;
+}
+
+
+
+
+// push `element` for `ttl` milliseconds into the dehydrator stored under
+// `dehydrator_name`, fails when `element_id` is taken
+int push_impl(RedisModuleCtx *ctx, Dehydrator* dehydrator, RedisModuleString* dehydrator_name, long long ttl,
+              RedisModuleString* element, const char* element_id_str, size_t element_id_len)
+{
+    size_t element_len;
+    const char* element_str = RedisModule_StringPtrLen(element, &element_len);
+    long long expiration = current_time_ms() + ttl;
+    if (_pushElement(dehydrator, ttl, expiration, element_str, element_len,
+                     element_id_str, element_id_len, NULL) != DEHYDRATOR_OK)
+    {
+        return REDISMODULE_ERR;
+    }
+    DEHYDRATOR_COUNT(dehydrator, pushed, 1);
+    RedisModule_Replicate(ctx, "REDE.MPUSHAT", "sllsb", dehydrator_name, ttl, expiration,
+                          element, element_id_str, element_id_len);
+    return REDISMODULE_OK;
+}
+
+
+/*
+* dehydrator.gidpush <timeout> <element>
+* dehydrate <element> for <timeout> seconds
+*/
+int GIDPushCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc)
+{
+    if (argc != 4)
+    {
+      return RedisModule_WrongArity(ctx);
+    }
+
+    // the ttl is checked ahead of everything else, a failed push must not
+    // leave an AUTO dehydrator switched to string ids
+    long long ttl;
+    const char* ttl_error = _parsePushTTL(argv[2], &ttl, 0);
+    if (ttl_error != NULL)
+    {
+        RedisModule_ReplyWithError(ctx, ttl_error);
+        return REDISMODULE_ERR;
+    }
+
+    RedisModuleString * dehydrator_name = argv[1];
+    // get key dehydrator_name
+    RedisModuleKey *key = RedisModule_OpenKey(ctx, dehydrator_name,
+        REDISMODULE_READ|REDISMODULE_WRITE);
+    Dehydrator* dehydrator = validateDehydratorKey(ctx, key, dehydrator_name);
+    if (dehydrator == NULL)
+    {
+        RedisModule_ReplyWithError(ctx, "ERROR: Not a dehydrator.");
+        RedisModule_CloseKey(key);
+        return REDISMODULE_ERR;
+    }
+
+    // generated ids are never integers
+    if (dehydrator->id_mode == DEHYDRATOR_IDS_INT)
+    {
+        RedisModule_ReplyWithError(ctx, "ERROR: Element id must be an integer.");
+        RedisModule_CloseKey(key);
+        return REDISMODULE_ERR;
+    }
+    if (dehydrator->id_mode == DEHYDRATOR_IDS_AUTO)
+    {
+        _convertToStringIds(dehydrator);
+    }
+
+    // generated ids are unique by construction, so they are not looked up
+    // first. PUSH can still be given one by hand, the push fails on a clash
+    char element_id[GENERATED_ID_LENGTH + 1];
+    _generateId(current_time_ms(), element_id);
+
+    int retval = push_impl(ctx, dehydrator, dehydrator_name, ttl, argv[3], element_id, GENERATED_ID_LENGTH);
+
+    if (retval == REDISMODULE_OK)
+    {
+        _scheduleWakeUp(ctx, dehydrator, dehydrator_name);
+        RedisModule_ReplyWithStringBuffer(ctx, element_id, GENERATED_ID_LENGTH);
+    }
+    else
+    {
+        RedisModule_ReplyWithError(ctx, "ERROR: Element already dehydrating.");
+    }
+
+	RedisModule_CloseKey(key);
+    return retval;
+}
+
+/*
+* dehydrator.push <timeout> <element> <element_id>
+* dehydrate <element> for <timeout> seconds
+*/
+int PushCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc)
+{
+    if(argc != 5)
+    {
+      return RedisModule_WrongArity(ctx);
+    }
+
+    // checked before the id, which may switch an AUTO dehydrator to string ids
+    long long ttl;
+    const char* ttl_error = _parsePushTTL(argv[2], &ttl, 0);
+    if (ttl_error != NULL)
+    {
+        RedisModule_ReplyWithError(ctx, ttl_error);
+        return REDISMODULE_ERR;
+    }
+
+	RedisModuleString * dehydrator_name = argv[1];
+	RedisModuleString * element_id = argv[4];
+    // get key dehydrator_name
+    RedisModuleKey *key = RedisModule_OpenKey(ctx, dehydrator_name,
+        REDISMODULE_READ|REDISMODULE_WRITE);
+    Dehydrator* dehydrator = validateDehydratorKey(ctx, key, dehydrator_name);
+    if (dehydrator == NULL)
+    {
+        RedisModule_ReplyWithError(ctx, "ERROR: Not a dehydrator.");
+        RedisModule_CloseKey(key);
+        return REDISMODULE_ERR;
+    }
+
+    const char* error = _checkPushElementId(dehydrator, element_id);
+    if (error != NULL)
+    {
+        RedisModule_ReplyWithError(ctx, error);
+        RedisModule_CloseKey(key);
+        return REDISMODULE_ERR;
+    }
+
+    size_t element_id_len;
+    const char* element_id_str = RedisModule_StringPtrLen(element_id, &element_id_len);
+    int retval = push_impl(ctx, dehydrator, dehydrator_name, ttl, argv[3], element_id_str, element_id_len);
+
+    if (retval == REDISMODULE_OK)
+    {
+        _scheduleWakeUp(ctx, dehydrator, dehydrator_name);
+        RedisModule_ReplyWithSimpleString(ctx, "OK");
+    }
+    else
+    {
+        RedisModule_ReplyWithError(ctx, "ERROR: Element already dehydrating.");
+    }
+    RedisModule_CloseKey(key);
+    return retval;
+}
+
+
+// push the <ttl> <element> <element_id> groups of argv[2..] (<element> <element_id>
+// when `shared_ttl` is given, <ttl> <expiration> <element> <element_id> when the
+// expirations are `absolute`) with a single key open and clock read, replying
+// with the status of every element
+int mpush_impl(RedisModuleCtx *ctx, RedisModuleString **argv, int argc,
+               RedisModuleString* shared_ttl, int absolute)
+{
+    int first = (shared_ttl == NULL) ? 2 : 3;
+    int group = (shared_ttl == NULL) ? 3 : 2;
+    if (absolute) { group = 4; }
+    if ((argc < first + group) || ((argc - first) % group != 0))
+    {
+      return RedisModule_WrongArity(ctx);
+    }
+
+    long long ttl;
+    const char* ttl_error = (shared_ttl != NULL) ? _parsePushTTL(shared_ttl, &ttl, absolute) : NULL;
+    if (ttl_error != NULL)
+    {
+        RedisModule_ReplyWithError(ctx, ttl_error);
+        return REDISMODULE_ERR;
+    }
+
+    RedisModuleString * dehydrator_name = argv[1];
+    // get key dehydrator_name
+    RedisModuleKey *key = RedisModule_OpenKey(ctx, dehydrator_name,
+        REDISMODULE_READ|REDISMODULE_WRITE);
+    Dehydrator* dehydrator = validateDehydratorKey(ctx, key, dehydrator_name);
+    if (dehydrator == NULL)
+    {
+        RedisModule_ReplyWithError(ctx, "ERROR: Not a dehydrator.");
+        RedisModule_CloseKey(key);
+        return REDISMODULE_ERR;
+    }
+
+    long long now = current_time_ms();
+    long long expiration;
+    TimeoutQueue* last_queue = NULL;
+    RedisModuleString* pushed[REPLICATE_BATCH * 4];
+    size_t pushed_len = 0;
+    RedisModule_ReplyWithArray(ctx, (argc - first) / group);
+    int pos;
+    for (pos = first; pos < argc; pos += group)
+    {
+        if ((shared_ttl == NULL) && ((ttl_error = _parsePushTTL(argv[pos], &ttl, absolute)) != NULL))
+        {
+            RedisModule_ReplyWithError(ctx, ttl_error);
+            continue;
+        }
+        RedisModuleString* element = argv[pos + group - 2];
+        RedisModuleString* element_id = argv[pos + group - 1];
+
+        const char* error = NULL;
+        expiration = now + ttl;
+        if (absolute)
+        {
+            if ((RedisModule_StringToLongLong(argv[pos + 1], &expiration) == REDISMODULE_ERR) || (expiration < 0))
+            {
+                error = "ERROR: Expiration must be a non-negative integer.";
+            }
+            else
+            {
+                error = _checkPushExpiration(dehydrator, ttl, expiration);
+            }
+        }
+        if (error == NULL)
+        {
+            error = _checkPushElementId(dehydrator, element_id);
+        }
+        if (error != NULL)
+        {
+            RedisModule_ReplyWithError(ctx, error);
+            continue;
+        }
+
+        size_t element_id_len;
+        const char* element_id_str = RedisModule_StringPtrLen(element_id, &element_id_len);
+        size_t element_len;
+        const char* element_str = RedisModule_StringPtrLen(element, &element_len);
+        _pushElement(dehydrator, ttl, expiration, element_str, element_len,
+                     element_id_str, element_id_len, &last_queue);
+        DEHYDRATOR_COUNT(dehydrator, pushed, 1);
+        _replicatePush(ctx, dehydrator_name, pushed, &pushed_len, ttl, expiration, element, element_id);
+        RedisModule_ReplyWithSimpleString(ctx, "OK");
+    }
+    _replicateArgs(ctx, "REDE.MPUSHAT", dehydrator_name, pushed, &pushed_len);
+
+    _scheduleWakeUp(ctx, dehydrator, dehydrator_name);
+    RedisModule_CloseKey(key);
+    return REDISMODULE_OK;
+}
+
+
+/*
+* rede.mpush <dehydrator_name> <ttl> <element> <element_id> [<ttl> <element> <element_id> ...]
+* dehydrate a batch of elements, each for its own ttl
+*/
+int MPushCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc)
+{
+    return mpush_impl(ctx, argv, argc, NULL, 0);
+}
+
+
+/*
+* rede.mpushttl <dehydrator_name> <ttl> <element> <element_id> [<element> <element_id> ...]
+* dehydrate a batch of elements, all for the same ttl
+*/
+int MPushTTLCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc)
+{
+    if (argc < 3)
+    {
+      return RedisModule_WrongArity(ctx);
+    }
+    return mpush_impl(ctx, argv, argc, argv[2], 0);
+}
+
+
+/*
+* rede.mpushat <dehydrator_name> <ttl> <expiration> <element> <element_id> [<ttl> <expiration> <element> <element_id> ...]
+* dehydrate a batch of elements until an absolute <expiration> (unix time in
+* milliseconds), each kept with the elements of its <ttl>
+*/
+int MPushAtCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc)
+{
+    return mpush_impl(ctx, argv, argc, NULL, 1);
+}
+
+
+/*
+* dehydrator.pull <element_id>
+* Pull an element off the bench by id.
+*/
+int PullCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc)
+{
+    if (argc != 3)
+    {
+      return RedisModule_WrongArity(ctx);
+    }
+
+    // get key dehydrator_name
+    RedisModuleKey *key = RedisModule_OpenKey(ctx, argv[1],
+        REDISMODULE_READ|REDISMODULE_WRITE);
+    Dehydrator * dehydrator = validateDehydratorKey(ctx, key, NULL);
+    if (dehydrator == NULL)
+    {
+        RedisModule_ReplyWithNull(ctx);
+        return REDISMODULE_OK;
+    }
+
+    ElementListNode* node = _getNodeForString(dehydrator, argv[2]);
+    if (node != NULL)
+    {
+        DEHYDRATOR_COUNT(dehydrator, pulled, 1);
+
+        if (node->element == NULL)
+        {
+            RedisModule_ReplyWithNull(ctx);
+        }
+        else
+        {
+            RedisModule_ReplyWithStringBuffer(ctx, node->element, node->element_len);
+        }
+        _pullNode(dehydrator, node);
+        RedisModule_ReplicateVerbatim(ctx);
+    }
+    else
+    {
+        // no element with such element_id
+        RedisModule_ReplyWithNull(ctx);
+    }
+    RedisModule_CloseKey(key);
+    return REDISMODULE_OK;
+}
+
+// reply with the elements `expired` from the dehydrator stored under
+// `dehydrator_name` as an array, releasing their nodes and counting how late
+// they were delivered at `now`
+void _replyWithExpired(RedisModuleCtx *ctx, Dehydrator* dehydrator, RedisModuleString* dehydrator_name,
+                       ElementList* expired, long long now)
+{
+    RedisModule_ReplyWithArray(ctx, expired->len);
+    DEHYDRATOR_COUNT(dehydrator, polled, expired->len);
+    RedisModuleString* ids[REPLICATE_BATCH];
+    size_t ids_len = 0;
+    ElementListNode* node;
+    while ((node = _listPop(expired)) != NULL)
+    {
+        _lagRecord(dehydrator, now - node->expiration);
+        _replicatePull(ctx, dehydrator_name, ids, &ids_len, node);
+        _removeNodeFromMapping(dehydrator, node);
+        RedisModule_ReplyWithStringBuffer(ctx, node->element, node->element_len); // append node->element to output
+        deleteNode(dehydrator, node);
+    }
+    _replicateArgs(ctx, "REDE.MPULL", dehydrator_name, ids, &ids_len);
+}
+
+
+/*
+* dehydrator.poll
+* get all elements which were dried for long enogh
+*/
+int PollCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc)
+{
+    if ((argc != 2) && (argc != 4))
+    {
+      return RedisModule_WrongArity(ctx);
+    }
+
+    long long count = -1;
+    if (argc == 4)
+    {
+        if (RMUtil_ArgExists("COUNT", argv, argc, 2) != 2)
+        {
+            RedisModule_ReplyWithError(ctx, "ERROR: Unknown option.");
+            return REDISMODULE_ERR;
+        }
+        if ((RedisModule_StringToLongLong(argv[3], &count) == REDISMODULE_ERR) || (count <= 0))
+        {
+            RedisModule_ReplyWithError(ctx, "ERROR: COUNT must be a positive integer.");
+            return REDISMODULE_ERR;
+        }
+    }
+
+    // get key for dehydrator
+    RedisModuleKey *key = RedisModule_OpenKey(ctx, argv[1],
+        REDISMODULE_READ|REDISMODULE_WRITE);
+    Dehydrator* dehydrator = validateDehydratorKey(ctx, key, NULL);
+    if (dehydrator == NULL)
+    {
+        RedisModule_ReplyWithArray(ctx, 0);
+        return REDISMODULE_OK;
+    }
+
+    long long now = current_time_ms();
+
+    ElementList expired = {NULL, NULL, 0};
+    _dehydratorAdvance(dehydrator, now, &expired, count);
+    _replyWithExpired(ctx, dehydrator, argv[1], &expired, now);
+    RedisModule_CloseKey(key);
+    return REDISMODULE_OK;
+}
+
+
+// serve a REDE.BPOLL client from the dehydrator under `key` if anything in
+// it expired, replying with [<dehydrator_name>, [<element> ...]]. otherwise
+// nothing is replied, the wake timer is armed and REDISMODULE_ERR returned
+int _bpollKey(RedisModuleCtx *ctx, RedisModuleKey *key, RedisModuleString* dehydrator_name)
+{
+    if (RedisModule_ModuleTypeGetType(key) != DehydratorType)
+    {
+        return REDISMODULE_ERR;
+    }
+    Dehydrator* dehydrator = RedisModule_ModuleTypeGetValue(key);
+
+    long long now = current_time_ms();
+    ElementList expired = {NULL, NULL, 0};
+    _dehydratorAdvance(dehydrator, now, &expired, -1);
+    if (expired.len == 0)
+    {
+        _armWakeTimer(ctx, dehydrator, dehydrator_name);
+        return REDISMODULE_ERR;
+    }
+
+    RedisModule_ReplyWithArray(ctx, 2);
+    RedisModule_ReplyWithString(ctx, dehydrator_name);
+    _replyWithExpired(ctx, dehydrator, dehydrator_name, &expired, now);
+    return REDISMODULE_OK;
+}
+
+
+// a key REDE.BPOLL is blocked on was signaled, returning REDISMODULE_ERR
+// keeps the client blocked
+int BPollReadyCallback(RedisModuleCtx *ctx, RedisModuleString **argv, int argc)
+{
+    RedisModuleString* dehydrator_name = RedisModule_GetBlockedClientReadyKey(ctx);
+    RedisModuleKey *key = RedisModule_OpenKey(ctx, dehydrator_name,
+        REDISMODULE_READ|REDISMODULE_WRITE);
+    int retval = _bpollKey(ctx, key, dehydrator_name);
+    RedisModule_CloseKey(key);
+    return retval;
+}
+
+
+int BPollTimeoutCallback(RedisModuleCtx *ctx, RedisModuleString **argv, int argc)
+{
+    return RedisModule_ReplyWithNull(ctx);
+}
+
+
+void BPollFreeCallback(RedisModuleCtx *ctx, void *privdata)
+{
+    --bpoll_waiters;
+}
+
+
+/*
+* rede.bpoll <dehydrator_name> [<dehydrator_name> ...] <timeout>
+* get all dried elements of the first dehydrator having any, blocking until
+* one does for up to <timeout> milliseconds (0 blocks forever)
+*/
+int BPollCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc)
+{
+    if (argc < 3)
+    {
+      return RedisModule_WrongArity(ctx);
+    }
+
+    long long timeout;
+    if ((RedisModule_StringToLongLong(argv[argc - 1], &timeout) == REDISMODULE_ERR) || (timeout < 0))
+    {
+        RedisModule_ReplyWithError(ctx, "ERROR: Timeout must be a non-negative integer.");
+        return REDISMODULE_ERR;
+    }
+
+    // serve right away if something already expired, arming the wake timers
+    // of the dehydrators that are not ready yet
+    int pos;
+    for (pos = 1; pos < argc - 1; ++pos)
+    {
+        RedisModuleKey *key = RedisModule_OpenKey(ctx, argv[pos],
+            REDISMODULE_READ|REDISMODULE_WRITE);
+        if ((RedisModule_KeyType(key) != REDISMODULE_KEYTYPE_EMPTY) &&
+            (RedisModule_ModuleTypeGetType(key) != DehydratorType))
+        {
+            RedisModule_ReplyWithError(ctx, REDISMODULE_ERRORMSG_WRONGTYPE);
+            RedisModule_CloseKey(key);
+            return REDISMODULE_ERR;
+        }
+        int retval = _bpollKey(ctx, key, argv[pos]);
+        RedisModule_CloseKey(key);
+        if (retval == REDISMODULE_OK)
+        {
+            return REDISMODULE_OK;
+        }
+    }
+
+    // the private data is only passed so BPollFreeCallback runs once the client is released
+    ++bpoll_waiters;
+    RedisModule_BlockClientOnKeys(ctx, BPollReadyCallback, BPollTimeoutCallback, BPollFreeCallback,
+        timeout, argv + 1, argc - 2, &bpoll_waiters);
+    return REDISMODULE_OK;
+}
+
+
+// REDE.DEBUG and REDE.TEST are only registered when the module is loaded
+// with the DEBUG yes argument, so production servers can't move the clock
+static int debug_commands = 0;
+
+/*
+* rede.debug CLOCK SET <unix_time_ms> | ADVANCE <milliseconds> | RESET | GET
+* freeze the module clock at a virtual time every expiration is checked
+* against, for tests and benchmarks. wake timers armed before a change still
+* fire on the real clock
+*/
+int DebugCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc)
+{
+    if ((argc < 3) || !RMUtil_ArgExists("CLOCK", argv, 2, 1))
+    {
+      return RedisModule_WrongArity(ctx);
+    }
+
+    long long value = 0;
+    if ((argc == 4) &&
+        ((RedisModule_StringToLongLong(argv[3], &value) == REDISMODULE_ERR) || (value < 0)))
+    {
+        RedisModule_ReplyWithError(ctx, "ERROR: Time must be a non-negative integer.");
+        return REDISMODULE_ERR;
+    }
+
+    if ((argc == 4) && RMUtil_ArgExists("SET", argv, 3, 2))
+    {
+        clock_virtual_ms = value;
+    }
+    else if ((argc == 4) && RMUtil_ArgExists("ADVANCE", argv, 3, 2))
+    {
+        // starting from the real time if the clock was not frozen yet
+        clock_virtual_ms = current_time_ms() + value;
+    }
+    else if ((argc == 3) && RMUtil_ArgExists("RESET", argv, 3, 2))
+    {
+        clock_virtual_ms = -1;
+    }
+    else if (!((argc == 3) && RMUtil_ArgExists("GET", argv, 3, 2)))
+    {
+        RedisModule_ReplyWithError(ctx, "ERROR: Unknown clock subcommand.");
+        return REDISMODULE_ERR;
+    }
+
+    RedisModule_ReplyWithLongLong(ctx, current_time_ms());
+    return REDISMODULE_OK;
+}
+
+int TestLook(RedisModuleCtx *ctx)
+{
+    // RedisModule_Call(ctx, "DEL", "c", "TEST_DEHYDRATOR_look");
+    printf("Testing Look - ");
+
+    // size_t len
+    RedisModuleCallReply *check1 =
+        RedisModule_Call(ctx, "REDE.look", "cc", "TEST_DEHYDRATOR_look", "test_element");
+    RMUtil_Assert(!RedisModule_CreateStringFromCallReply(check1));
+    // check if X is dehydtaring (should be false)
+    // RMUtil_Assert(RedisModule_CreateStringFromCallReply(check1) == NULL);
+
+
+    RedisModuleCallReply *push1 =
+        RedisModule_Call(ctx, "REDE.push", "cccc", "TEST_DEHYDRATOR_look", "100000", "payload", "test_element");
+    RMUtil_Assert(RedisModule_CallReplyType(push1) != REDISMODULE_REPLY_ERROR);
+
+    RedisModuleCallReply *check2 =
+        RedisModule_Call(ctx, "REDE.look", "cc", "TEST_DEHYDRATOR_look", "test_element");
+    RMUtil_Assert(RedisModule_CallReplyType(check2) != REDISMODULE_REPLY_ERROR);
+    RMUtil_Assert(RedisModule_CreateStringFromCallReply(check2) != NULL); //TODO: == "payload"
+
+
+    RedisModuleCallReply *pull1 =
+        RedisModule_Call(ctx, "REDE.pull", "cc", "TEST_DEHYDRATOR_look", "test_element");
+    RMUtil_Assert(RedisModule_CallReplyType(pull1) != REDISMODULE_REPLY_ERROR);
+
+    RedisModuleCallReply *check3 =
+        RedisModule_Call(ctx, "REDE.look", "cc", "TEST_DEHYDRATOR_look", "test_element");
+    RMUtil_Assert(!RedisModule_CreateStringFromCallReply(check3));
+
+    // RedisModule_Call(ctx, "DEL", "c", "TEST_DEHYDRATOR_look");
+    printf("Passed.\n");
+    return REDISMODULE_OK;
+}
+
+
+int TestUpdate(RedisModuleCtx *ctx)
+{
+    // RedisModule_Call(ctx, "DEL", "c", "TEST_DEHYDRATOR_update");
+    printf("Testing Update - ");
+
+    RedisModuleCallReply *check1 =
+        RedisModule_Call(ctx, "REDE.update", "ccc", "TEST_DEHYDRATOR_update", "test_element", "text");
+    RMUtil_Assert(RedisModule_CallReplyType(check1) == REDISMODULE_REPLY_ERROR);
+
+    RedisModuleCallReply *push1 =
+        RedisModule_Call(ctx, "REDE.push", "cccc", "TEST_DEHYDRATOR_update", "100000", "some payload", "test_element");
+    RMUtil_Assert(RedisModule_CallReplyType(push1) != REDISMODULE_REPLY_ERROR);
+
+    RedisModuleCallReply *check2 =
+        RedisModule_Call(ctx, "REDE.update", "ccc", "TEST_DEHYDRATOR_update", "test_element", "some OTHER payload");
+    RMUtil_Assert(RedisModule_CallReplyType(check2) != REDISMODULE_REPLY_ERROR);
+    RMUtil_Assert(RMUtil_StringEqualsC(RedisModule_CreateStringFromCallReply(check2),"some payload"));
+
+    RedisModuleCallReply *check3 =
+        RedisModule_Call(ctx, "REDE.look", "cc", "TEST_DEHYDRATOR_update", "test_element");
+    RMUtil_Assert(RedisModule_CallReplyType(check3) != REDISMODULE_REPLY_ERROR);
+    RMUtil_Assert(RMUtil_StringEqualsC(RedisModule_CreateStringFromCallReply(check3), "some OTHER payload"));
+
+    RedisModuleCallReply *pull1 =
+        RedisModule_Call(ctx, "REDE.pull", "cc", "TEST_DEHYDRATOR_update", "test_element");
+    RMUtil_Assert(RedisModule_CallReplyType(pull1) != REDISMODULE_REPLY_ERROR);
+
+    RedisModuleCallReply *check4 =
+        RedisModule_Call(ctx, "REDE.update", "ccc", "TEST_DEHYDRATOR_update", "test_element", "text");
+    RMUtil_Assert(RedisModule_CallReplyType(check4) == REDISMODULE_REPLY_ERROR);
+
+    // RedisModule_Call(ctx, "DEL", "c", "TEST_DEHYDRATOR_update");
+    printf("Passed.\n");
+    return REDISMODULE_OK;
+}
+
+
+int TestTimeToNext(RedisModuleCtx *ctx)
+{
+    // RedisModule_Call(ctx, "DEL", "c", "TEST_DEHYDRATOR_ttn");
+    printf("Testing TTN - ");
+
+    RedisModuleCallReply *push1 =
+        RedisModule_Call(ctx, "REDE.push", "cccc", "TEST_DEHYDRATOR_ttn", "3000", "payload", "ttn_test_element");
+    RMUtil_Assert(RedisModule_CallReplyType(push1) != REDISMODULE_REPLY_ERROR);
+
+    RedisModuleCallReply *check1 =
+        RedisModule_Call(ctx, "REDE.ttn", "c", "TEST_DEHYDRATOR_ttn");
+    RMUtil_Assert(RedisModule_CallReplyType(check1) != REDISMODULE_REPLY_ERROR);
+    RMUtil_Assert(RedisModule_CallReplyInteger(check1) == 3000);
+
+    RedisModule_Call(ctx, "REDE.DEBUG", "ccc", "CLOCK", "ADVANCE", "2000");
+
+    RedisModuleCallReply *check2 =
+        RedisModule_Call(ctx, "REDE.ttn", "c", "TEST_DEHYDRATOR_ttn");
+    RMUtil_Assert(RedisModule_CallReplyType(check2) != REDISMODULE_REPLY_ERROR);
+    RMUtil_Assert(RedisModule_CallReplyInteger(check2) == 1000);
+
+    RedisModule_Call(ctx, "REDE.DEBUG", "ccc", "CLOCK", "ADVANCE", "2000");
+
+    RedisModuleCallReply *check3 =
+        RedisModule_Call(ctx, "REDE.ttn", "c", "TEST_DEHYDRATOR_ttn");
+    RMUtil_Assert(RedisModule_CallReplyType(check3) != REDISMODULE_REPLY_ERROR);
+    RMUtil_Assert(RedisModule_CallReplyInteger(check3) == 0);
+
+
+    // RedisModule_Call(ctx, "DEL", "c", "TEST_DEHYDRATOR_ttn");
+    printf("Passed.\n");
+    return REDISMODULE_OK;
+}
+
+
+int TestPush(RedisModuleCtx *ctx)
+{
+    // RedisModule_Call(ctx, "DEL", "c", "TEST_DEHYDRATOR_push");
+    printf("Testing Push - ");
+    // char * element_id = "push_test_element";
+    // size_t len
+    RedisModuleCallReply *check1 =
+        RedisModule_Call(ctx, "REDE.look", "cc", "TEST_DEHYDRATOR_push", "push_test_element");
+    RMUtil_Assert(!RedisModule_CreateStringFromCallReply(check1));
+    // check if X is dehydtaring (should be false)
+    // RMUtil_Assert(RedisModule_CreateStringFromCallReply(check1) == NULL);
+
+    RedisModuleCallReply *push1 =
+        RedisModule_Call(ctx, "REDE.push", "cccc", "TEST_DEHYDRATOR_push", "1000", "payload", "push_test_element");
+    RMUtil_Assert(RedisModule_CallReplyType(push1) != REDISMODULE_REPLY_ERROR);
+
+    RedisModuleCallReply *check2 =
+        RedisModule_Call(ctx, "REDE.look", "cc", "TEST_DEHYDRATOR_push", "push_test_element");
+    RMUtil_Assert(RedisModule_CallReplyType(check2) != REDISMODULE_REPLY_ERROR);
+    RMUtil_Assert(RedisModule_CreateStringFromCallReply(check2) != NULL); //TODO: == "payload"
+
+    // TODO: test pushing more then one element
+    // TODO: add fail-case tests
+
+    // RedisModule_Call(ctx, "DEL", "c", "TEST_DEHYDRATOR_push");
+    printf("Passed.\n");
+    return REDISMODULE_OK;
+}
+
+
+int TestPull(RedisModuleCtx *ctx)
+{
+    // RedisModule_Call(ctx, "DEL", "c", "TEST_DEHYDRATOR_pull");
+    printf("Testing Pull - ");
+
+    char * store_key = "pull_test_element";
+    char * bad_store_key = "pull_test_bad_element";
+
+    RedisModuleCallReply *push1 =
+        RedisModule_Call(ctx, "REDE.push", "cccc", "TEST_DEHYDRATOR_pull", "100000", "payload", store_key);
+    RMUtil_Assert(RedisModule_CallReplyType(push1) != REDISMODULE_REPLY_ERROR);
+
+
+    RedisModuleCallReply *look1 =
+        RedisModule_Call(ctx, "REDE.look", "cc", "TEST_DEHYDRATOR_pull", store_key);
+    // RMUTIL_ASSERT_NOERROR(look1);
+    RMUtil_Assert(RedisModule_CallReplyType(look1) != REDISMODULE_REPLY_ERROR);
+    // RMUtil_Assert(RedisModule_CallReplyInteger(rep1) == 1);
+
+
+    RedisModuleCallReply *pull1 =
+        RedisModule_Call(ctx, "REDE.pull", "cc", "TEST_DEHYDRATOR_pull", bad_store_key);
+    RMUtil_Assert(!RedisModule_CreateStringFromCallReply(pull1));
+
+
+    RedisModuleCallReply *look2 =
+        RedisModule_Call(ctx, "REDE.look", "cc", "TEST_DEHYDRATOR_pull", bad_store_key);
+    RMUtil_Assert(!RedisModule_CreateStringFromCallReply(look2));
+    // RMUtil_Assert(RedisModule_CallReplyInteger(rep2) == 0);
+
+
+    RedisModuleCallReply *pull2 =
+        RedisModule_Call(ctx, "REDE.pull", "cc", "TEST_DEHYDRATOR_pull", store_key);
+    RMUtil_Assert(RedisModule_CallReplyType(pull2) != REDISMODULE_REPLY_ERROR);
+
+
+    RedisModuleCallReply *look3 =
+        RedisModule_Call(ctx, "REDE.look", "cc", "TEST_DEHYDRATOR_pull", bad_store_key);
+    RMUtil_Assert(!RedisModule_CreateStringFromCallReply(look3));
+
+    printf("Passed.\n");
+    // RedisModule_Call(ctx, "DEL", "c", "TEST_DEHYDRATOR_pull");
+    return REDISMODULE_OK;
+}
+
+
+int TestPoll(RedisModuleCtx *ctx)
+{
+    printf("Testing Poll - ");
+
+  // clear dehydrator
+  // RedisModule_Call(ctx, "DEL", "c", "TEST_DEHYDRATOR_poll");
+
+  // start test
+  // push elements 1, 4, 7 & 3a (for 1, 4, 7 & 3 seconds)
+  // 1
+  RedisModuleCallReply *push1 =
+      RedisModule_Call(ctx, "REDE.push", "cccc", "TEST_DEHYDRATOR_poll", "1000", "element_1", "e1");
+  RMUtil_Assert(RedisModule_CallReplyType(push1) != REDISMODULE_REPLY_ERROR);
+
+  // 4
+  RedisModuleCallReply *push4 =
+      RedisModule_Call(ctx, "REDE.push", "cccc", "TEST_DEHYDRATOR_poll", "4000", "element_4", "e4");
+  RMUtil_Assert(RedisModule_CallReplyType(push4) != REDISMODULE_REPLY_ERROR);
+
+  // 7
+  RedisModuleCallReply *push7 =
+      RedisModule_Call(ctx, "REDE.push", "cccc", "TEST_DEHYDRATOR_poll", "7000", "element_7", "e7");
+  RMUtil_Assert(RedisModule_CallReplyType(push7) != REDISMODULE_REPLY_ERROR);
+
+  // 3a
+  RedisModuleCallReply *push3a =
+      RedisModule_Call(ctx, "REDE.push", "cccc", "TEST_DEHYDRATOR_poll", "3000", "element_3a", "e3a");
+  RMUtil_Assert(RedisModule_CallReplyType(push3a) != REDISMODULE_REPLY_ERROR);
+
+  // pull question 7
+  RedisModuleCallReply *pull_seven_rep =
+      RedisModule_Call(ctx, "REDE.pull", "cc", "TEST_DEHYDRATOR_poll", "e7");
+  RMUtil_Assert(RedisModule_CallReplyType(pull_seven_rep) != REDISMODULE_REPLY_ERROR);
+
+  // poll - make sure no element pops right out
+  RedisModuleCallReply *poll1_rep =
+      RedisModule_Call(ctx, "REDE.poll", "c", "TEST_DEHYDRATOR_poll");
+  RMUtil_Assert(RedisModule_CallReplyType(poll1_rep) != REDISMODULE_REPLY_ERROR);
+  RMUtil_Assert(RedisModule_CallReplyLength(poll1_rep) == 0);
+
+  // advance the clock 1 sec
+  RedisModule_Call(ctx, "REDE.DEBUG", "ccc", "CLOCK", "ADVANCE", "1000");
+  // push element 3b (for 3 seconds)
+  // 3b
+  RedisModuleCallReply *push_three_b =
+      RedisModule_Call(ctx, "REDE.push", "cccc", "TEST_DEHYDRATOR_poll", "3000", "element_3b", "e3b");
+  RMUtil_Assert(RedisModule_CallReplyType(push_three_b) != REDISMODULE_REPLY_ERROR);
+
+  // poll (t=1) - we expect only element 1 to pop out
+  RedisModuleCallReply *poll_two_rep =
+      RedisModule_Call(ctx, "REDE.poll", "c", "TEST_DEHYDRATOR_poll");
+  RMUtil_Assert(RedisModule_CallReplyType(poll_two_rep) != REDISMODULE_REPLY_ERROR);
+  RMUtil_Assert(RedisModule_CallReplyLength(poll_two_rep) == 1);
+  RedisModuleCallReply *subreply_a = RedisModule_CallReplyArrayElement(poll_two_rep, 0);
+  RMUtil_AssertReplyEquals(subreply_a, "element_1")
 
-    // get key for dehydrator
-    RedisModuleKey *key = RedisModule_OpenKey(ctx, argv[1],
-        REDISMODULE_READ|REDISMODULE_WRITE);
-    Dehydrator* dehydrator = validateDehydratorKey(ctx, key, NULL);
-    if (dehydrator == NULL)
-    {
-        RedisModule_ReplyWithArray(ctx, 0);
-        return REDISMODULE_OK;
-    }
+  // advance the clock 2 secs and poll (t=3) - we expect only element 3a to pop out
+  RedisModule_Call(ctx, "REDE.DEBUG", "ccc", "CLOCK", "ADVANCE", "2000");
+  RedisModuleCallReply *poll_three_rep =
+      RedisModule_Call(ctx, "REDE.poll", "c", "TEST_DEHYDRATOR_poll");
+  RMUtil_Assert(RedisModule_CallReplyType(poll_three_rep) != REDISMODULE_REPLY_ERROR);
+  RMUtil_Assert(RedisModule_CallReplyLength(poll_three_rep) == 1);
+  RedisModuleCallReply *subreply_b = RedisModule_CallReplyArrayElement(poll_three_rep, 0);
+  RMUtil_AssertReplyEquals(subreply_b, "element_3a");
 
-    RedisModule_ReplyWithArray(ctx, REDISMODULE_POSTPONED_ARRAY_LEN);
-    int expired_element_num = 0;
-    time_t now = current_time_ms();
-    // for each timeout_queue in timeout_queues
-    khiter_t k;
-    for (k = kh_begin(dehydrator->timeout_queues); k != kh_end(dehydrator->timeout_queues); ++k)
-    {
-        if (!kh_exist(dehydrator->timeout_queues, k)) continue;
-        ElementList* list = kh_value(dehydrator->timeout_queues, k);
-        int done_with_queue = 0;
-        while ((list != NULL) && (!done_with_queue))
-        {
-            ElementListNode* head = list->head;
-            if ((head != NULL) && (head->expiration <= now))
-            {
-                ElementListNode* node = _listPop(list);
-                _removeNodeFromMapping(dehydrator, node);
-                RedisModule_ReplyWithString(ctx, node->element); // append node->element to output
-                deleteNode(node);
-                ++expired_element_num;
-            }
-            else
-            {
-                if (list->len == 0)
-                {
-                    deleteList(list);
-                    kh_del(16, dehydrator->timeout_queues, k);
-                }
-                done_with_queue = 1;
-            }
-        }
-    }
-    RedisModule_ReplySetArrayLength(ctx, expired_element_num);
-    RedisModule_CloseKey(key);
-    return REDISMODULE_OK;
+
+  // advance the clock 2 secs and poll (t=5) - we expect elements 4 and 3b to pop out
+  RedisModule_Call(ctx, "REDE.DEBUG", "ccc", "CLOCK", "ADVANCE", "2000");
+  RedisModuleCallReply *poll_four_rep =
+      RedisModule_Call(ctx, "REDE.poll", "c", "TEST_DEHYDRATOR_poll");
+  RMUtil_Assert(RedisModule_CallReplyType(poll_four_rep) != REDISMODULE_REPLY_ERROR);
+  RMUtil_Assert(RedisModule_CallReplyLength(poll_four_rep) == 2);
+  RedisModuleCallReply *subreply_c_first = RedisModule_CallReplyArrayElement(poll_four_rep, 0);
+  RedisModuleCallReply *subreply_c_second = RedisModule_CallReplyArrayElement(poll_four_rep, 1);
+  RedisModuleString * first_str =  RedisModule_CreateStringFromCallReply(subreply_c_first);
+  RedisModuleString * second_str = RedisModule_CreateStringFromCallReply(subreply_c_second);
+  RedisModuleString * element_3b_str = RedisModule_CreateString(ctx, "element_3b", strlen("element_3b"));
+  RedisModuleString * element_4_str = RedisModule_CreateString(ctx, "element_4", strlen("element_4"));
+  RMUtil_Assert(
+    (
+        RMUtil_StringEquals(first_str, element_3b_str) &&
+        RMUtil_StringEquals(second_str, element_4_str)
+    ) ||
+    (
+        RMUtil_StringEquals(first_str, element_4_str) &&
+        RMUtil_StringEquals(second_str, element_3b_str)
+    )
+  );
+
+  // advance the clock 6 secs and poll (t=11) - we expect that element 7 will NOT pop out, because we already pulled it
+  RedisModule_Call(ctx, "REDE.DEBUG", "ccc", "CLOCK", "ADVANCE", "6000");
+  RedisModuleCallReply *poll_five_rep = RedisModule_Call(ctx, "REDE.poll", "c", "TEST_DEHYDRATOR_poll");
+  RMUtil_Assert(RedisModule_CallReplyType(poll_five_rep) != REDISMODULE_REPLY_ERROR);
+  RMUtil_Assert(RedisModule_CallReplyLength(poll_five_rep) == 0);
+
+  // clear dehydrator
+  // RedisModule_Call(ctx, "DEL", "c", "TEST_DEHYDRATOR_poll");
+  printf("Passed.\n");
+  return REDISMODULE_OK;
 }
 
-int TestLook(RedisModuleCtx *ctx)
+
+int TestWheel(RedisModuleCtx *ctx)
 {
-    // RedisModule_Call(ctx, "DEL", "c", "TEST_DEHYDRATOR_look");
-    printf("Testing Look - ");
+    printf("Testing Wheel - ");
 
-    // size_t len
-    RedisModuleCallReply *check1 =
-        RedisModule_Call(ctx, "REDE.look", "cc", "TEST_DEHYDRATOR_look", "test_element");
-    RMUtil_Assert(!RedisModule_CreateStringFromCallReply(check1));
-    // check if X is dehydtaring (should be false)
-    // RMUtil_Assert(RedisModule_CreateStringFromCallReply(check1) == NULL);
+    RedisModuleCallReply *create1 =
+        RedisModule_Call(ctx, "REDE.create", "ccc", "TEST_DEHYDRATOR_wheel", "ENGINE", "WHEEL");
+    RMUtil_Assert(RedisModule_CallReplyType(create1) != REDISMODULE_REPLY_ERROR);
 
+    // creating it again should fail
+    RedisModuleCallReply *create2 =
+        RedisModule_Call(ctx, "REDE.create", "ccc", "TEST_DEHYDRATOR_wheel", "ENGINE", "WHEEL");
+    RMUtil_Assert(RedisModule_CallReplyType(create2) == REDISMODULE_REPLY_ERROR);
 
+    // push elements landing on different levels of the wheel (300ms, 1s, 70s & 2h)
     RedisModuleCallReply *push1 =
-        RedisModule_Call(ctx, "REDE.push", "cccc", "TEST_DEHYDRATOR_look", "100000", "payload", "test_element");
+        RedisModule_Call(ctx, "REDE.push", "cccc", "TEST_DEHYDRATOR_wheel", "1000", "element_1", "w1");
     RMUtil_Assert(RedisModule_CallReplyType(push1) != REDISMODULE_REPLY_ERROR);
+    RedisModuleCallReply *push2 =
+        RedisModule_Call(ctx, "REDE.push", "cccc", "TEST_DEHYDRATOR_wheel", "300", "element_2", "w2");
+    RMUtil_Assert(RedisModule_CallReplyType(push2) != REDISMODULE_REPLY_ERROR);
+    RedisModuleCallReply *push3 =
+        RedisModule_Call(ctx, "REDE.push", "cccc", "TEST_DEHYDRATOR_wheel", "70000", "element_3", "w3");
+    RMUtil_Assert(RedisModule_CallReplyType(push3) != REDISMODULE_REPLY_ERROR);
+    RedisModuleCallReply *push4 =
+        RedisModule_Call(ctx, "REDE.push", "cccc", "TEST_DEHYDRATOR_wheel", "7200000", "element_4", "w4");
+    RMUtil_Assert(RedisModule_CallReplyType(push4) != REDISMODULE_REPLY_ERROR);
+
+    RedisModuleCallReply *ttn1 =
+        RedisModule_Call(ctx, "REDE.ttn", "c", "TEST_DEHYDRATOR_wheel");
+    RMUtil_Assert(RedisModule_CallReplyInteger(ttn1) <= 300);
+    RMUtil_Assert(RedisModule_CallReplyInteger(ttn1) > 0);
+
+    // pull element 2, so element 1 is the next one out
+    RedisModuleCallReply *pull1 =
+        RedisModule_Call(ctx, "REDE.pull", "cc", "TEST_DEHYDRATOR_wheel", "w2");
+    RMUtil_AssertReplyEquals(pull1, "element_2");
+
+    RedisModuleCallReply *ttn2 =
+        RedisModule_Call(ctx, "REDE.ttn", "c", "TEST_DEHYDRATOR_wheel");
+    RMUtil_Assert(RedisModule_CallReplyInteger(ttn2) > 300);
+
+    RedisModuleCallReply *poll1 =
+        RedisModule_Call(ctx, "REDE.poll", "c", "TEST_DEHYDRATOR_wheel");
+    RMUtil_Assert(RedisModule_CallReplyLength(poll1) == 0);
+
+    // advance the clock 1 sec - only element 1 should pop out
+    RedisModule_Call(ctx, "REDE.DEBUG", "ccc", "CLOCK", "ADVANCE", "1000");
+    RedisModuleCallReply *poll2 =
+        RedisModule_Call(ctx, "REDE.poll", "c", "TEST_DEHYDRATOR_wheel");
+    RMUtil_Assert(RedisModule_CallReplyLength(poll2) == 1);
+    RMUtil_AssertReplyEquals(RedisModule_CallReplyArrayElement(poll2, 0), "element_1");
+
+    // elements far away on the upper levels are still reachable
+    RedisModuleCallReply *look1 =
+        RedisModule_Call(ctx, "REDE.look", "cc", "TEST_DEHYDRATOR_wheel", "w4");
+    RMUtil_AssertReplyEquals(look1, "element_4");
+    RedisModuleCallReply *pull2 =
+        RedisModule_Call(ctx, "REDE.pull", "cc", "TEST_DEHYDRATOR_wheel", "w3");
+    RMUtil_AssertReplyEquals(pull2, "element_3");
+
+    RedisModuleCallReply *ttn3 =
+        RedisModule_Call(ctx, "REDE.ttn", "c", "TEST_DEHYDRATOR_wheel");
+    RMUtil_Assert(RedisModule_CallReplyInteger(ttn3) > 7000000);
+
+    printf("Passed.\n");
+    return REDISMODULE_OK;
+}
 
-    RedisModuleCallReply *check2 =
-        RedisModule_Call(ctx, "REDE.look", "cc", "TEST_DEHYDRATOR_look", "test_element");
-    RMUtil_Assert(RedisModule_CallReplyType(check2) != REDISMODULE_REPLY_ERROR);
-    RMUtil_Assert(RedisModule_CreateStringFromCallReply(check2) != NULL); //TODO: == "payload"
 
+// Unit test entry point for the module
+int TestQueueHeads(RedisModuleCtx *ctx)
+{
+    printf("Testing Queue Heads - ");
 
+    // one element per ttl queue, pushed out of order
+    RedisModuleCallReply *push1 =
+        RedisModule_Call(ctx, "REDE.push", "cccc", "TEST_DEHYDRATOR_heads", "50000", "element_1", "h1");
+    RMUtil_Assert(RedisModule_CallReplyType(push1) != REDISMODULE_REPLY_ERROR);
+    RedisModuleCallReply *push2 =
+        RedisModule_Call(ctx, "REDE.push", "cccc", "TEST_DEHYDRATOR_heads", "10000", "element_2", "h2");
+    RMUtil_Assert(RedisModule_CallReplyType(push2) != REDISMODULE_REPLY_ERROR);
+    RedisModuleCallReply *push3 =
+        RedisModule_Call(ctx, "REDE.push", "cccc", "TEST_DEHYDRATOR_heads", "30000", "element_3", "h3");
+    RMUtil_Assert(RedisModule_CallReplyType(push3) != REDISMODULE_REPLY_ERROR);
+    RedisModuleCallReply *push4 =
+        RedisModule_Call(ctx, "REDE.push", "cccc", "TEST_DEHYDRATOR_heads", "10000", "element_4", "h4");
+    RMUtil_Assert(RedisModule_CallReplyType(push4) != REDISMODULE_REPLY_ERROR);
+
+    RedisModuleCallReply *ttn1 =
+        RedisModule_Call(ctx, "REDE.ttn", "c", "TEST_DEHYDRATOR_heads");
+    RMUtil_Assert(RedisModule_CallReplyInteger(ttn1) <= 10000);
+    RMUtil_Assert(RedisModule_CallReplyInteger(ttn1) > 9000);
+
+    // pulling the head of the 10s queue leaves element 4 as its head
     RedisModuleCallReply *pull1 =
-        RedisModule_Call(ctx, "REDE.pull", "cc", "TEST_DEHYDRATOR_look", "test_element");
-    RMUtil_Assert(RedisModule_CallReplyType(pull1) != REDISMODULE_REPLY_ERROR);
+        RedisModule_Call(ctx, "REDE.pull", "cc", "TEST_DEHYDRATOR_heads", "h2");
+    RMUtil_AssertReplyEquals(pull1, "element_2");
+    RedisModuleCallReply *ttn2 =
+        RedisModule_Call(ctx, "REDE.ttn", "c", "TEST_DEHYDRATOR_heads");
+    RMUtil_Assert(RedisModule_CallReplyInteger(ttn2) <= 10000);
 
-    RedisModuleCallReply *check3 =
-        RedisModule_Call(ctx, "REDE.look", "cc", "TEST_DEHYDRATOR_look", "test_element");
-    RMUtil_Assert(!RedisModule_CreateStringFromCallReply(check3));
+    // emptying the 10s queue makes the 30s queue the next one
+    RedisModuleCallReply *pull2 =
+        RedisModule_Call(ctx, "REDE.pull", "cc", "TEST_DEHYDRATOR_heads", "h4");
+    RMUtil_AssertReplyEquals(pull2, "element_4");
+    RedisModuleCallReply *ttn3 =
+        RedisModule_Call(ctx, "REDE.ttn", "c", "TEST_DEHYDRATOR_heads");
+    RMUtil_Assert(RedisModule_CallReplyInteger(ttn3) <= 30000);
+    RMUtil_Assert(RedisModule_CallReplyInteger(ttn3) > 20000);
+
+    RedisModuleCallReply *pull3 =
+        RedisModule_Call(ctx, "REDE.pull", "cc", "TEST_DEHYDRATOR_heads", "h3");
+    RMUtil_AssertReplyEquals(pull3, "element_3");
+    RedisModuleCallReply *ttn4 =
+        RedisModule_Call(ctx, "REDE.ttn", "c", "TEST_DEHYDRATOR_heads");
+    RMUtil_Assert(RedisModule_CallReplyInteger(ttn4) > 40000);
+
+    // a queue emptied earlier can be indexed again
+    RedisModuleCallReply *push5 =
+        RedisModule_Call(ctx, "REDE.push", "cccc", "TEST_DEHYDRATOR_heads", "10000", "element_5", "h5");
+    RMUtil_Assert(RedisModule_CallReplyType(push5) != REDISMODULE_REPLY_ERROR);
+    RedisModuleCallReply *ttn5 =
+        RedisModule_Call(ctx, "REDE.ttn", "c", "TEST_DEHYDRATOR_heads");
+    RMUtil_Assert(RedisModule_CallReplyInteger(ttn5) <= 10000);
+
+    RedisModuleCallReply *poll1 =
+        RedisModule_Call(ctx, "REDE.poll", "c", "TEST_DEHYDRATOR_heads");
+    RMUtil_Assert(RedisModule_CallReplyLength(poll1) == 0);
 
-    // RedisModule_Call(ctx, "DEL", "c", "TEST_DEHYDRATOR_look");
     printf("Passed.\n");
     return REDISMODULE_OK;
 }
 
 
-int TestUpdate(RedisModuleCtx *ctx)
+int TestEncoding(RedisModuleCtx *ctx)
 {
-    // RedisModule_Call(ctx, "DEL", "c", "TEST_DEHYDRATOR_update");
-    printf("Testing Update - ");
+    printf("Testing Encoding - ");
 
-    RedisModuleCallReply *check1 =
-        RedisModule_Call(ctx, "REDE.update", "ccc", "TEST_DEHYDRATOR_update", "test_element", "text");
-    RMUtil_Assert(RedisModule_CallReplyType(check1) == REDISMODULE_REPLY_ERROR);
+    // an element id and element too long to be embedded in the node
+    char long_str[NODE_EMBED_MAX + 2];
+    memset(long_str, 'x', NODE_EMBED_MAX + 1);
+    long_str[NODE_EMBED_MAX + 1] = '\0';
 
     RedisModuleCallReply *push1 =
-        RedisModule_Call(ctx, "REDE.push", "cccc", "TEST_DEHYDRATOR_update", "100000", "some payload", "test_element");
+        RedisModule_Call(ctx, "REDE.push", "cccc", "TEST_DEHYDRATOR_encoding", "100000", long_str, "enc1");
     RMUtil_Assert(RedisModule_CallReplyType(push1) != REDISMODULE_REPLY_ERROR);
+    RedisModuleCallReply *push2 =
+        RedisModule_Call(ctx, "REDE.push", "cccc", "TEST_DEHYDRATOR_encoding", "100000", "element_2", long_str);
+    RMUtil_Assert(RedisModule_CallReplyType(push2) != REDISMODULE_REPLY_ERROR);
+    RedisModuleCallReply *push3 =
+        RedisModule_Call(ctx, "REDE.push", "cccc", "TEST_DEHYDRATOR_encoding", "100000", "element_3", "enc3");
+    RMUtil_Assert(RedisModule_CallReplyType(push3) != REDISMODULE_REPLY_ERROR);
 
-    RedisModuleCallReply *check2 =
-        RedisModule_Call(ctx, "REDE.update", "ccc", "TEST_DEHYDRATOR_update", "test_element", "some OTHER payload");
-    RMUtil_Assert(RedisModule_CallReplyType(check2) != REDISMODULE_REPLY_ERROR);
-    RMUtil_Assert(RMUtil_StringEqualsC(RedisModule_CreateStringFromCallReply(check2),"some payload"));
-
-    RedisModuleCallReply *check3 =
-        RedisModule_Call(ctx, "REDE.look", "cc", "TEST_DEHYDRATOR_update", "test_element");
-    RMUtil_Assert(RedisModule_CallReplyType(check3) != REDISMODULE_REPLY_ERROR);
-    RMUtil_Assert(RMUtil_StringEqualsC(RedisModule_CreateStringFromCallReply(check3), "some OTHER payload"));
+    RedisModuleCallReply *look1 =
+        RedisModule_Call(ctx, "REDE.look", "cc", "TEST_DEHYDRATOR_encoding", "enc1");
+    RMUtil_AssertReplyEquals(look1, long_str);
+    RedisModuleCallReply *look2 =
+        RedisModule_Call(ctx, "REDE.look", "cc", "TEST_DEHYDRATOR_encoding", long_str);
+    RMUtil_AssertReplyEquals(look2, "element_2");
+
+    // updates move an element out of the node and back in
+    RedisModuleCallReply *update1 =
+        RedisModule_Call(ctx, "REDE.update", "ccc", "TEST_DEHYDRATOR_encoding", "enc3", long_str);
+    RMUtil_AssertReplyEquals(update1, "element_3");
+    RedisModuleCallReply *update2 =
+        RedisModule_Call(ctx, "REDE.update", "ccc", "TEST_DEHYDRATOR_encoding", "enc3", "element_3b");
+    RMUtil_AssertReplyEquals(update2, long_str);
+    RedisModuleCallReply *update3 =
+        RedisModule_Call(ctx, "REDE.update", "ccc", "TEST_DEHYDRATOR_encoding", "enc1", "element_1");
+    RMUtil_AssertReplyEquals(update3, long_str);
 
     RedisModuleCallReply *pull1 =
-        RedisModule_Call(ctx, "REDE.pull", "cc", "TEST_DEHYDRATOR_update", "test_element");
-    RMUtil_Assert(RedisModule_CallReplyType(pull1) != REDISMODULE_REPLY_ERROR);
-
-    RedisModuleCallReply *check4 =
-        RedisModule_Call(ctx, "REDE.update", "ccc", "TEST_DEHYDRATOR_update", "test_element", "text");
-    RMUtil_Assert(RedisModule_CallReplyType(check4) == REDISMODULE_REPLY_ERROR);
+        RedisModule_Call(ctx, "REDE.pull", "cc", "TEST_DEHYDRATOR_encoding", "enc3");
+    RMUtil_AssertReplyEquals(pull1, "element_3b");
+    RedisModuleCallReply *pull2 =
+        RedisModule_Call(ctx, "REDE.pull", "cc", "TEST_DEHYDRATOR_encoding", long_str);
+    RMUtil_AssertReplyEquals(pull2, "element_2");
+    RedisModuleCallReply *pull3 =
+        RedisModule_Call(ctx, "REDE.pull", "cc", "TEST_DEHYDRATOR_encoding", "enc1");
+    RMUtil_AssertReplyEquals(pull3, "element_1");
 
-    // RedisModule_Call(ctx, "DEL", "c", "TEST_DEHYDRATOR_update");
     printf("Passed.\n");
     return REDISMODULE_OK;
 }
 
 
-int TestTimeToNext(RedisModuleCtx *ctx)
+int TestIntIds(RedisModuleCtx *ctx)
 {
-    // RedisModule_Call(ctx, "DEL", "c", "TEST_DEHYDRATOR_ttn");
-    printf("Testing TTN - ");
+    printf("Testing Integer Ids - ");
+
+    RedisModuleCallReply *create1 =
+        RedisModule_Call(ctx, "REDE.create", "ccc", "TEST_DEHYDRATOR_int_ids", "IDS", "INT");
+    RMUtil_Assert(RedisModule_CallReplyType(create1) != REDISMODULE_REPLY_ERROR);
 
     RedisModuleCallReply *push1 =
-        RedisModule_Call(ctx, "REDE.push", "cccc", "TEST_DEHYDRATOR_ttn", "3000", "payload", "ttn_test_element");
+        RedisModule_Call(ctx, "REDE.push", "cccc", "TEST_DEHYDRATOR_int_ids", "100000", "element_1", "42");
     RMUtil_Assert(RedisModule_CallReplyType(push1) != REDISMODULE_REPLY_ERROR);
+    RedisModuleCallReply *push2 =
+        RedisModule_Call(ctx, "REDE.push", "cccc", "TEST_DEHYDRATOR_int_ids", "100000", "element_2", "-9223372036854775808");
+    RMUtil_Assert(RedisModule_CallReplyType(push2) != REDISMODULE_REPLY_ERROR);
+    RedisModuleCallReply *push3 =
+        RedisModule_Call(ctx, "REDE.push", "cccc", "TEST_DEHYDRATOR_int_ids", "100000", "element_3", "id_3");
+    RMUtil_Assert(RedisModule_CallReplyType(push3) == REDISMODULE_REPLY_ERROR);
+    RedisModuleCallReply *push4 =
+        RedisModule_Call(ctx, "REDE.push", "cccc", "TEST_DEHYDRATOR_int_ids", "100000", "element_4", "042");
+    RMUtil_Assert(RedisModule_CallReplyType(push4) == REDISMODULE_REPLY_ERROR);
 
-    RedisModuleCallReply *check1 =
-        RedisModule_Call(ctx, "REDE.ttn", "c", "TEST_DEHYDRATOR_ttn");
-    RMUtil_Assert(RedisModule_CallReplyType(check1) != REDISMODULE_REPLY_ERROR);
-    RMUtil_Assert(RedisModule_CallReplyInteger(check1) >= 3000);
+    RedisModuleCallReply *look1 =
+        RedisModule_Call(ctx, "REDE.look", "cc", "TEST_DEHYDRATOR_int_ids", "-9223372036854775808");
+    RMUtil_AssertReplyEquals(look1, "element_2");
+    RedisModuleCallReply *look2 =
+        RedisModule_Call(ctx, "REDE.look", "cc", "TEST_DEHYDRATOR_int_ids", "42.0");
+    RMUtil_Assert(RedisModule_CallReplyType(look2) == REDISMODULE_REPLY_NULL);
+    RedisModuleCallReply *pull1 =
+        RedisModule_Call(ctx, "REDE.pull", "cc", "TEST_DEHYDRATOR_int_ids", "42");
+    RMUtil_AssertReplyEquals(pull1, "element_1");
+
+    // an AUTO dehydrator switches to string ids on the first non integer id
+    RedisModuleCallReply *push5 =
+        RedisModule_Call(ctx, "REDE.push", "cccc", "TEST_DEHYDRATOR_auto_ids", "100000", "element_5", "5");
+    RMUtil_Assert(RedisModule_CallReplyType(push5) != REDISMODULE_REPLY_ERROR);
+    RedisModuleCallReply *push6 =
+        RedisModule_Call(ctx, "REDE.push", "cccc", "TEST_DEHYDRATOR_auto_ids", "100000", "element_6", "id_6");
+    RMUtil_Assert(RedisModule_CallReplyType(push6) != REDISMODULE_REPLY_ERROR);
+    RedisModuleCallReply *push7 =
+        RedisModule_Call(ctx, "REDE.push", "cccc", "TEST_DEHYDRATOR_auto_ids", "100000", "element_7", "5");
+    RMUtil_Assert(RedisModule_CallReplyType(push7) == REDISMODULE_REPLY_ERROR);
 
-    sleep(2);
+    RedisModuleCallReply *pull2 =
+        RedisModule_Call(ctx, "REDE.pull", "cc", "TEST_DEHYDRATOR_auto_ids", "5");
+    RMUtil_AssertReplyEquals(pull2, "element_5");
+    RedisModuleCallReply *pull3 =
+        RedisModule_Call(ctx, "REDE.pull", "cc", "TEST_DEHYDRATOR_auto_ids", "id_6");
+    RMUtil_AssertReplyEquals(pull3, "element_6");
 
-    RedisModuleCallReply *check2 =
-        RedisModule_Call(ctx, "REDE.ttn", "c", "TEST_DEHYDRATOR_ttn");
-    RMUtil_Assert(RedisModule_CallReplyType(check2) != REDISMODULE_REPLY_ERROR);
-    RMUtil_Assert(RedisModule_CallReplyInteger(check2) >= 1000);
+    printf("Passed.\n");
+    return REDISMODULE_OK;
+}
 
-    sleep(2);
 
-    RedisModuleCallReply *check3 =
-        RedisModule_Call(ctx, "REDE.ttn", "c", "TEST_DEHYDRATOR_ttn");
-    RMUtil_Assert(RedisModule_CallReplyType(check3) != REDISMODULE_REPLY_ERROR);
-    RMUtil_Assert(RedisModule_CallReplyInteger(check3) == 0);
+int TestPollCount(RedisModuleCtx *ctx)
+{
+    printf("Testing Poll Count - ");
 
+    RedisModuleCallReply *create1 =
+        RedisModule_Call(ctx, "REDE.create", "ccc", "TEST_DEHYDRATOR_count_wheel", "ENGINE", "WHEEL");
+    RMUtil_Assert(RedisModule_CallReplyType(create1) != REDISMODULE_REPLY_ERROR);
+
+    const char* dehydrators[] = {"TEST_DEHYDRATOR_count", "TEST_DEHYDRATOR_count_wheel"};
+    int i;
+    for (i = 0; i < 2; ++i)
+    {
+        // five elements spread over two ttls, expiring in the order they are pushed
+        RedisModule_Call(ctx, "REDE.push", "cccc", dehydrators[i], "1", "element_1", "c1");
+        RedisModule_Call(ctx, "REDE.push", "cccc", dehydrators[i], "2", "element_2", "c2");
+        RedisModule_Call(ctx, "REDE.push", "cccc", dehydrators[i], "2", "element_3", "c3");
+        RedisModule_Call(ctx, "REDE.DEBUG", "ccc", "CLOCK", "ADVANCE", "5");
+        RedisModule_Call(ctx, "REDE.push", "cccc", dehydrators[i], "1", "element_4", "c4");
+        RedisModule_Call(ctx, "REDE.push", "cccc", dehydrators[i], "1", "element_5", "c5");
+        RedisModule_Call(ctx, "REDE.DEBUG", "ccc", "CLOCK", "ADVANCE", "5");
+
+        RedisModuleCallReply *poll1 =
+            RedisModule_Call(ctx, "REDE.poll", "ccc", dehydrators[i], "COUNT", "2");
+        RMUtil_Assert(RedisModule_CallReplyLength(poll1) == 2);
+        RMUtil_AssertReplyEquals(RedisModule_CallReplyArrayElement(poll1, 0), "element_1");
+        RedisModuleCallReply *poll2 =
+            RedisModule_Call(ctx, "REDE.poll", "ccc", dehydrators[i], "COUNT", "2");
+        RMUtil_Assert(RedisModule_CallReplyLength(poll2) == 2);
+        RMUtil_AssertReplyEquals(RedisModule_CallReplyArrayElement(poll2, 1), "element_4");
+        RedisModuleCallReply *poll3 =
+            RedisModule_Call(ctx, "REDE.poll", "ccc", dehydrators[i], "COUNT", "2");
+        RMUtil_Assert(RedisModule_CallReplyLength(poll3) == 1);
+        RMUtil_AssertReplyEquals(RedisModule_CallReplyArrayElement(poll3, 0), "element_5");
+
+        RedisModuleCallReply *poll4 =
+            RedisModule_Call(ctx, "REDE.poll", "ccc", dehydrators[i], "COUNT", "0");
+        RMUtil_Assert(RedisModule_CallReplyType(poll4) == REDISMODULE_REPLY_ERROR);
+    }
 
-    // RedisModule_Call(ctx, "DEL", "c", "TEST_DEHYDRATOR_ttn");
     printf("Passed.\n");
     return REDISMODULE_OK;
 }
 
 
-int TestPush(RedisModuleCtx *ctx)
+int TestMPush(RedisModuleCtx *ctx)
 {
-    // RedisModule_Call(ctx, "DEL", "c", "TEST_DEHYDRATOR_push");
-    printf("Testing Push - ");
-    // char * element_id = "push_test_element";
-    // size_t len
-    RedisModuleCallReply *check1 =
-        RedisModule_Call(ctx, "REDE.look", "cc", "TEST_DEHYDRATOR_push", "push_test_element");
-    RMUtil_Assert(!RedisModule_CreateStringFromCallReply(check1));
-    // check if X is dehydtaring (should be false)
-    // RMUtil_Assert(RedisModule_CreateStringFromCallReply(check1) == NULL);
+    printf("Testing MPush - ");
+
+    RedisModuleCallReply *mpush1 =
+        RedisModule_Call(ctx, "REDE.mpush", "cccccccccc", "TEST_DEHYDRATOR_mpush",
+            "100000", "element_1", "m1",
+            "bad_ttl", "element_2", "m2",
+            "200000", "element_3", "m1");
+    RMUtil_Assert(RedisModule_CallReplyType(mpush1) == REDISMODULE_REPLY_ARRAY);
+    RMUtil_Assert(RedisModule_CallReplyLength(mpush1) == 3);
+    RMUtil_AssertReplyEquals(RedisModule_CallReplyArrayElement(mpush1, 0), "OK");
+    RMUtil_Assert(RedisModule_CallReplyType(RedisModule_CallReplyArrayElement(mpush1, 1)) == REDISMODULE_REPLY_ERROR);
+    RMUtil_Assert(RedisModule_CallReplyType(RedisModule_CallReplyArrayElement(mpush1, 2)) == REDISMODULE_REPLY_ERROR);
+
+    RedisModuleCallReply *mpush2 =
+        RedisModule_Call(ctx, "REDE.mpushttl", "cccccccc", "TEST_DEHYDRATOR_mpush", "50000",
+            "element_4", "m4", "element_5", "m5", "element_6", "m6");
+    RMUtil_Assert(RedisModule_CallReplyLength(mpush2) == 3);
+    RMUtil_AssertReplyEquals(RedisModule_CallReplyArrayElement(mpush2, 2), "OK");
+
+    // wrong number of arguments for a group
+    RedisModuleCallReply *mpush3 =
+        RedisModule_Call(ctx, "REDE.mpushttl", "ccccc", "TEST_DEHYDRATOR_mpush", "50000", "element_7", "m7", "element_8");
+    RMUtil_Assert(RedisModule_CallReplyType(mpush3) == REDISMODULE_REPLY_ERROR);
 
-    RedisModuleCallReply *push1 =
-        RedisModule_Call(ctx, "REDE.push", "cccc", "TEST_DEHYDRATOR_push", "1000", "payload", "push_test_element");
-    RMUtil_Assert(RedisModule_CallReplyType(push1) != REDISMODULE_REPLY_ERROR);
+    RedisModuleCallReply *look1 =
+        RedisModule_Call(ctx, "REDE.look", "cc", "TEST_DEHYDRATOR_mpush", "m1");
+    RMUtil_AssertReplyEquals(look1, "element_1");
+    RedisModuleCallReply *look2 =
+        RedisModule_Call(ctx, "REDE.look", "cc", "TEST_DEHYDRATOR_mpush", "m2");
+    RMUtil_Assert(RedisModule_CallReplyType(look2) == REDISMODULE_REPLY_NULL);
+    RedisModuleCallReply *ttn1 =
+        RedisModule_Call(ctx, "REDE.ttn", "c", "TEST_DEHYDRATOR_mpush");
+    RMUtil_Assert(RedisModule_CallReplyInteger(ttn1) <= 50000);
+    RMUtil_Assert(RedisModule_CallReplyInteger(ttn1) > 40000);
 
-    RedisModuleCallReply *check2 =
-        RedisModule_Call(ctx, "REDE.look", "cc", "TEST_DEHYDRATOR_push", "push_test_element");
-    RMUtil_Assert(RedisModule_CallReplyType(check2) != REDISMODULE_REPLY_ERROR);
-    RMUtil_Assert(RedisModule_CreateStringFromCallReply(check2) != NULL); //TODO: == "payload"
+    printf("Passed.\n");
+    return REDISMODULE_OK;
+}
 
-    // TODO: test pushing more then one element
-    // TODO: add fail-case tests
 
-    // RedisModule_Call(ctx, "DEL", "c", "TEST_DEHYDRATOR_push");
+int TestMLook(RedisModuleCtx *ctx)
+{
+    printf("Testing MLook & MPull - ");
+
+    RedisModuleCallReply *mpush1 =
+        RedisModule_Call(ctx, "REDE.mpushttl", "cccccccc", "TEST_DEHYDRATOR_mlook", "100000",
+            "element_1", "l1", "element_2", "l2", "element_3", "l3");
+    RMUtil_Assert(RedisModule_CallReplyType(mpush1) == REDISMODULE_REPLY_ARRAY);
+
+    RedisModuleCallReply *mlook1 =
+        RedisModule_Call(ctx, "REDE.mlook", "cccc", "TEST_DEHYDRATOR_mlook", "l3", "missing", "l1");
+    RMUtil_Assert(RedisModule_CallReplyLength(mlook1) == 3);
+    RMUtil_AssertReplyEquals(RedisModule_CallReplyArrayElement(mlook1, 0), "element_3");
+    RMUtil_Assert(RedisModule_CallReplyType(RedisModule_CallReplyArrayElement(mlook1, 1)) == REDISMODULE_REPLY_NULL);
+    RMUtil_AssertReplyEquals(RedisModule_CallReplyArrayElement(mlook1, 2), "element_1");
+
+    // an id repeated in the batch is only pulled once
+    RedisModuleCallReply *mpull1 =
+        RedisModule_Call(ctx, "REDE.mpull", "cccc", "TEST_DEHYDRATOR_mlook", "l2", "l2", "l1");
+    RMUtil_Assert(RedisModule_CallReplyLength(mpull1) == 3);
+    RMUtil_AssertReplyEquals(RedisModule_CallReplyArrayElement(mpull1, 0), "element_2");
+    RMUtil_Assert(RedisModule_CallReplyType(RedisModule_CallReplyArrayElement(mpull1, 1)) == REDISMODULE_REPLY_NULL);
+    RMUtil_AssertReplyEquals(RedisModule_CallReplyArrayElement(mpull1, 2), "element_1");
+
+    RedisModuleCallReply *mlook2 =
+        RedisModule_Call(ctx, "REDE.mlook", "ccc", "TEST_DEHYDRATOR_mlook", "l1", "l3");
+    RMUtil_Assert(RedisModule_CallReplyType(RedisModule_CallReplyArrayElement(mlook2, 0)) == REDISMODULE_REPLY_NULL);
+    RMUtil_AssertReplyEquals(RedisModule_CallReplyArrayElement(mlook2, 1), "element_3");
+
+    RedisModuleCallReply *mlook3 =
+        RedisModule_Call(ctx, "REDE.mlook", "cc", "TEST_DEHYDRATOR_mlook_missing", "l1");
+    RMUtil_Assert(RedisModule_CallReplyLength(mlook3) == 1);
+
+    printf("Passed.\n");
+    return REDISMODULE_OK;
+}
+
+
+int TestBPoll(RedisModuleCtx *ctx)
+{
+    printf("Testing BPoll - ");
+
+    // the first listed dehydrator with dried elements is served without blocking
+    RedisModule_Call(ctx, "REDE.push", "cccc", "TEST_DEHYDRATOR_bpoll_1", "100000", "element_1", "b1");
+    RedisModule_Call(ctx, "REDE.push", "cccc", "TEST_DEHYDRATOR_bpoll_2", "0", "element_2", "b2");
+    RedisModule_Call(ctx, "REDE.push", "cccc", "TEST_DEHYDRATOR_bpoll_2", "0", "element_3", "b3");
+
+    RedisModuleCallReply *bpoll1 =
+        RedisModule_Call(ctx, "REDE.bpoll", "cccc", "TEST_DEHYDRATOR_bpoll_missing",
+            "TEST_DEHYDRATOR_bpoll_1", "TEST_DEHYDRATOR_bpoll_2", "1000");
+    RMUtil_Assert(RedisModule_CallReplyType(bpoll1) == REDISMODULE_REPLY_ARRAY);
+    RMUtil_Assert(RedisModule_CallReplyLength(bpoll1) == 2);
+    RMUtil_AssertReplyEquals(RedisModule_CallReplyArrayElement(bpoll1, 0), "TEST_DEHYDRATOR_bpoll_2");
+    RedisModuleCallReply *elements1 = RedisModule_CallReplyArrayElement(bpoll1, 1);
+    RMUtil_Assert(RedisModule_CallReplyLength(elements1) == 2);
+    RMUtil_AssertReplyEquals(RedisModule_CallReplyArrayElement(elements1, 0), "element_2");
+    RMUtil_AssertReplyEquals(RedisModule_CallReplyArrayElement(elements1, 1), "element_3");
+
+    RedisModuleCallReply *look1 =
+        RedisModule_Call(ctx, "REDE.look", "cc", "TEST_DEHYDRATOR_bpoll_2", "b2");
+    RMUtil_Assert(RedisModule_CallReplyType(look1) == REDISMODULE_REPLY_NULL);
+
+    RedisModuleCallReply *bpoll2 =
+        RedisModule_Call(ctx, "REDE.bpoll", "cc", "TEST_DEHYDRATOR_bpoll_1", "-1");
+    RMUtil_Assert(RedisModule_CallReplyType(bpoll2) == REDISMODULE_REPLY_ERROR);
+
+    RedisModuleCallReply *bpoll3 =
+        RedisModule_Call(ctx, "REDE.bpoll", "c", "TEST_DEHYDRATOR_bpoll_1");
+    RMUtil_Assert(RedisModule_CallReplyType(bpoll3) == REDISMODULE_REPLY_ERROR);
+
+    printf("Passed.\n");
+    return REDISMODULE_OK;
+}
+
+
+int TestDeliver(RedisModuleCtx *ctx)
+{
+    printf("Testing Deliver - ");
+
+    RedisModuleCallReply *deliver1 =
+        RedisModule_Call(ctx, "REDE.deliver", "ccc", "TEST_DEHYDRATOR_deliver", "RPUSH", "TEST_DEHYDRATOR_deliver_list");
+    RMUtil_AssertReplyEquals(deliver1, "OK");
+    RedisModuleCallReply *deliver2 =
+        RedisModule_Call(ctx, "REDE.deliver", "ccc", "TEST_DEHYDRATOR_deliver", "RPUSH", "TEST_DEHYDRATOR_deliver");
+    RMUtil_Assert(RedisModule_CallReplyType(deliver2) == REDISMODULE_REPLY_ERROR);
+    RedisModuleCallReply *deliver3 =
+        RedisModule_Call(ctx, "REDE.deliver", "ccc", "TEST_DEHYDRATOR_deliver", "LPUSH", "TEST_DEHYDRATOR_deliver_list");
+    RMUtil_Assert(RedisModule_CallReplyType(deliver3) == REDISMODULE_REPLY_ERROR);
+
+    RedisModule_Call(ctx, "REDE.push", "cccc", "TEST_DEHYDRATOR_deliver", "0", "element_1", "d1");
+    RedisModule_Call(ctx, "REDE.push", "cccc", "TEST_DEHYDRATOR_deliver", "0", "element_2", "d2");
+    RedisModule_Call(ctx, "REDE.push", "cccc", "TEST_DEHYDRATOR_deliver", "100000", "element_3", "d3");
+
+    // what the wake timer does once it fires
+    RedisModuleString* dehydrator_name = RedisModule_CreateString(ctx, "TEST_DEHYDRATOR_deliver", 23);
+    RedisModuleKey *key = RedisModule_OpenKey(ctx, dehydrator_name, REDISMODULE_READ|REDISMODULE_WRITE);
+    Dehydrator* dehydrator = RedisModule_ModuleTypeGetValue(key);
+    RMUtil_Assert(dehydrator->delivery == DEHYDRATOR_DELIVERY_RPUSH);
+    RMUtil_Assert(dehydrator->wake_timer != 0);
+    RMUtil_Assert(_deliverExpired(ctx, dehydrator, dehydrator_name) == 2);
+    RedisModule_CloseKey(key);
+
+    // a replica lists a dehydrator once however often its timer fires
+    int pending_len = pending_deliveries_len;
+    _addPendingDelivery(dehydrator_name, RedisModule_GetSelectedDb(ctx));
+    _addPendingDelivery(dehydrator_name, RedisModule_GetSelectedDb(ctx));
+    RMUtil_Assert(pending_deliveries_len == pending_len + 1);
+    RedisModule_FreeString(ctx, dehydrator_name);
+
+    RedisModuleCallReply *llen1 =
+        RedisModule_Call(ctx, "LLEN", "c", "TEST_DEHYDRATOR_deliver_list");
+    RMUtil_Assert(RedisModule_CallReplyInteger(llen1) == 2);
+    RedisModuleCallReply *look1 =
+        RedisModule_Call(ctx, "REDE.look", "cc", "TEST_DEHYDRATOR_deliver", "d1");
+    RMUtil_Assert(RedisModule_CallReplyType(look1) == REDISMODULE_REPLY_NULL);
+
+    // a target that refuses the elements leaves them in the dehydrator, to be
+    // retried once it takes them
+    RedisModule_Call(ctx, "DEL", "c", "TEST_DEHYDRATOR_deliver_list");
+    RedisModule_Call(ctx, "SET", "cc", "TEST_DEHYDRATOR_deliver_list", "not a list");
+    RedisModule_Call(ctx, "REDE.push", "cccc", "TEST_DEHYDRATOR_deliver", "0", "element_4", "d4");
+    dehydrator_name = RedisModule_CreateString(ctx, "TEST_DEHYDRATOR_deliver", 23);
+    key = RedisModule_OpenKey(ctx, dehydrator_name, REDISMODULE_READ|REDISMODULE_WRITE);
+    dehydrator = RedisModule_ModuleTypeGetValue(key);
+    RMUtil_Assert(_deliverExpired(ctx, dehydrator, dehydrator_name) == 0);
+    // the refused element waits in the retry queue, which pushes can't reach
+    RMUtil_Assert(kh_get(16, dehydrator->timeout_queues, DEHYDRATOR_RETRY_TTL) != kh_end(dehydrator->timeout_queues));
+    RMUtil_Assert(kh_get(16, dehydrator->timeout_queues, DELIVERY_RETRY_MS) == kh_end(dehydrator->timeout_queues));
+    RedisModuleCallReply *push_retry =
+        RedisModule_Call(ctx, "REDE.push", "cccc", "TEST_DEHYDRATOR_deliver", "-1", "element_5", "d5");
+    RMUtil_Assert(RedisModule_CallReplyType(push_retry) == REDISMODULE_REPLY_ERROR);
+    RedisModuleCallReply *push_wide =
+        RedisModule_Call(ctx, "REDE.push", "cccc", "TEST_DEHYDRATOR_deliver", "4294967295", "element_5", "d5");
+    RMUtil_Assert(RedisModule_CallReplyType(push_wide) == REDISMODULE_REPLY_ERROR);
+    RedisModuleCallReply *look2 =
+        RedisModule_Call(ctx, "REDE.look", "cc", "TEST_DEHYDRATOR_deliver", "d4");
+    RMUtil_AssertReplyEquals(look2, "element_4");
+    RMUtil_Assert(_deliverExpired(ctx, dehydrator, dehydrator_name) == 0);
+    RedisModule_Call(ctx, "DEL", "c", "TEST_DEHYDRATOR_deliver_list");
+    RedisModule_Call(ctx, "REDE.DEBUG", "ccl", "CLOCK", "ADVANCE", (long long)DELIVERY_RETRY_MS);
+    RMUtil_Assert(_deliverExpired(ctx, dehydrator, dehydrator_name) == 1);
+    RedisModule_CloseKey(key);
+    RedisModule_FreeString(ctx, dehydrator_name);
+    RedisModuleCallReply *llen2 =
+        RedisModule_Call(ctx, "LLEN", "c", "TEST_DEHYDRATOR_deliver_list");
+    RMUtil_Assert(RedisModule_CallReplyInteger(llen2) == 1);
+
+    RedisModuleCallReply *deliver4 =
+        RedisModule_Call(ctx, "REDE.deliver", "cc", "TEST_DEHYDRATOR_deliver", "NONE");
+    RMUtil_AssertReplyEquals(deliver4, "OK");
+    RedisModule_Call(ctx, "DEL", "c", "TEST_DEHYDRATOR_deliver_list");
+
+    printf("Passed.\n");
+    return REDISMODULE_OK;
+}
+
+
+int TestMPushAt(RedisModuleCtx *ctx)
+{
+    printf("Testing MPushAt - ");
+
+    char expiration[32];
+    sprintf(expiration, "%lld", current_time_ms() + 50000);
+    RedisModuleCallReply *mpushat1 =
+        RedisModule_Call(ctx, "REDE.mpushat", "ccccccccc", "TEST_DEHYDRATOR_mpushat",
+            "100000", expiration, "element_1", "a1",
+            "100000", "0", "element_2", "a2");
+    RMUtil_Assert(RedisModule_CallReplyLength(mpushat1) == 2);
+    RMUtil_AssertReplyEquals(RedisModule_CallReplyArrayElement(mpushat1, 0), "OK");
+    // would expire before element_1 in the same timeout queue
+    RMUtil_Assert(RedisModule_CallReplyType(RedisModule_CallReplyArrayElement(mpushat1, 1)) == REDISMODULE_REPLY_ERROR);
+
+    RedisModuleCallReply *ttn1 =
+        RedisModule_Call(ctx, "REDE.ttn", "c", "TEST_DEHYDRATOR_mpushat");
+    RMUtil_Assert(RedisModule_CallReplyInteger(ttn1) <= 50000);
+    RMUtil_Assert(RedisModule_CallReplyInteger(ttn1) > 40000);
+
+    // an expiration in the past is dried right away
+    RedisModuleCallReply *mpushat2 =
+        RedisModule_Call(ctx, "REDE.mpushat", "ccccc", "TEST_DEHYDRATOR_mpushat", "1000", "0", "element_3", "a3");
+    RMUtil_AssertReplyEquals(RedisModule_CallReplyArrayElement(mpushat2, 0), "OK");
+    RedisModuleCallReply *poll1 =
+        RedisModule_Call(ctx, "REDE.poll", "c", "TEST_DEHYDRATOR_mpushat");
+    RMUtil_Assert(RedisModule_CallReplyLength(poll1) == 1);
+    RMUtil_AssertReplyEquals(RedisModule_CallReplyArrayElement(poll1, 0), "element_3");
+
+    RedisModuleCallReply *mpushat3 =
+        RedisModule_Call(ctx, "REDE.mpushat", "cccc", "TEST_DEHYDRATOR_mpushat", "1000", "0", "element_4");
+    RMUtil_Assert(RedisModule_CallReplyType(mpushat3) == REDISMODULE_REPLY_ERROR);
+
+    printf("Passed.\n");
+    return REDISMODULE_OK;
+}
+
+
+int TestRdbChunks(RedisModuleCtx *ctx)
+{
+    printf("Testing RDB Chunks - ");
+
+    long long values[] = {0, 1, -1, 63, 64, 127, 128, -129, 1500000000000LL, LLONG_MAX, LLONG_MIN};
+    int value_num = sizeof(values) / sizeof(values[0]);
+    RdbBuffer buf = {NULL, 0, 0};
+    int i;
+    for (i = 0; i < value_num; ++i)
+    {
+        _rdbPutVarint(&buf, _zigzag(values[i]));
+    }
+    _rdbPutVarint(&buf, 5);
+    _rdbPutBytes(&buf, "bytes", 5);
+    // small deltas take a single byte
+    RMUtil_Assert(buf.data[0] == 0);
+    RMUtil_Assert(buf.data[1] == 2);
+
+    const char* pos = buf.data;
+    const char* end = buf.data + buf.len;
+    uint64_t value;
+    for (i = 0; i < value_num; ++i)
+    {
+        RMUtil_Assert(_rdbGetVarint(&pos, end, &value));
+        RMUtil_Assert(_unzigzag(value) == values[i]);
+    }
+    const char* str;
+    RMUtil_Assert(_rdbGetVarint(&pos, end, &value) && (value == 5));
+    RMUtil_Assert(_rdbGetBytes(&pos, end, value, &str) && (memcmp(str, "bytes", 5) == 0));
+    RMUtil_Assert(pos == end);
+
+    // a chunk cut short is detected rather than read past
+    RMUtil_Assert(!_rdbGetVarint(&pos, end, &value));
+    RMUtil_Assert(!_rdbGetBytes(&pos, end, 1, &str));
+    pos = buf.data;
+    for (i = 0; i < value_num - 1; ++i)
+    {
+        _rdbGetVarint(&pos, end, &value);
+    }
+    RMUtil_Assert(!_rdbGetVarint(&pos, pos + 3, &value));
+    RedisModule_Free(buf.data);
+
+    printf("Passed.\n");
+    return REDISMODULE_OK;
+}
+
+
+int TestReserve(RedisModuleCtx *ctx)
+{
+    printf("Testing Reserve - ");
+
+    Dehydrator* dehy = _createDehydrator(DEHYDRATOR_ENGINE_QUEUES, DEHYDRATOR_IDS_INT, current_time_ms());
+    _reserveDehydrator(dehy, 20000, 0, 3);
+    khint_t buckets = kh_n_buckets(dehy->element_int_nodes);
+    RMUtil_Assert(dehy->queue_heads.cap >= 3);
+
+    TimeoutQueue* queue = _createNewQueue(dehy, 1000);
+    int retval;
+    khiter_t k = kh_put(16, dehy->timeout_queues, 1000, &retval);
+    kh_value(dehy->timeout_queues, k) = queue;
+    ElementListNode* node = NULL;
+    int i;
+    for (i = 0; i < 20000; ++i)
+    {
+        char buf[21];
+        size_t len = sprintf(buf, "%d", i);
+        node = _createNewNode(dehy, "element", 7, buf, len, 1000 + i);
+        _queuePush(queue, node);
+        _addNodeToMapping(dehy, node);
+    }
+    // the map was never rehashed, and the nodes came from a few large slabs
+    RMUtil_Assert(kh_n_buckets(dehy->element_int_nodes) == buckets);
+    RMUtil_Assert(dehy->node_pools[node->size_class].slab_count <= 11);
+    deleteDehydrator(dehy);
+
+    // string ids and generated ones are reserved in their own maps
+    dehy = _createDehydrator(DEHYDRATOR_ENGINE_QUEUES, DEHYDRATOR_IDS_STRING, current_time_ms());
+    _reserveDehydrator(dehy, 20000, 10000, 1);
+    buckets = kh_n_buckets(dehy->element_nodes);
+    khint_t generated_buckets = kh_n_buckets(dehy->element_generated_nodes);
+    queue = _createNewQueue(dehy, 1000);
+    k = kh_put(16, dehy->timeout_queues, 1000, &retval);
+    kh_value(dehy->timeout_queues, k) = queue;
+    for (i = 0; i < 20000; ++i)
+    {
+        char buf[GENERATED_ID_LENGTH + 1];
+        size_t len = (i % 2) ? sprintf(buf, "id-%d", i) : sprintf(buf, "%025d", i);
+        node = _createNewNode(dehy, "element", 7, buf, len, 1000 + i);
+        _queuePush(queue, node);
+        _addNodeToMapping(dehy, node);
+    }
+    RMUtil_Assert(kh_size(dehy->element_generated_nodes) == 10000);
+    RMUtil_Assert(kh_n_buckets(dehy->element_nodes) == buckets);
+    RMUtil_Assert(kh_n_buckets(dehy->element_generated_nodes) == generated_buckets);
+    deleteDehydrator(dehy);
+
     printf("Passed.\n");
     return REDISMODULE_OK;
 }
 
 
-int TestPull(RedisModuleCtx *ctx)
+int TestLazyFree(RedisModuleCtx *ctx)
 {
-    // RedisModule_Call(ctx, "DEL", "c", "TEST_DEHYDRATOR_pull");
-    printf("Testing Pull - ");
-
-    char * store_key = "pull_test_element";
-    char * bad_store_key = "pull_test_bad_element";
+    printf("Testing Lazy Free - ");
 
-    RedisModuleCallReply *push1 =
-        RedisModule_Call(ctx, "REDE.push", "cccc", "TEST_DEHYDRATOR_pull", "100000", "payload", store_key);
-    RMUtil_Assert(RedisModule_CallReplyType(push1) != REDISMODULE_REPLY_ERROR);
+    long long threshold = lazyfree_threshold;
+    lazyfree_threshold = 10;
+    Dehydrator* small = _createDehydrator(DEHYDRATOR_ENGINE_QUEUES, DEHYDRATOR_IDS_AUTO, current_time_ms());
+    Dehydrator* large = _createDehydrator(DEHYDRATOR_ENGINE_WHEEL, DEHYDRATOR_IDS_AUTO, current_time_ms());
+    int i;
+    for (i = 0; i < 100; ++i)
+    {
+        char buf[21];
+        size_t len = sprintf(buf, "%d", i);
+        ElementListNode* node = _createNewNode(large, "element", 7, buf, len, 1000 + i);
+        _wheelInsert(large->wheel, node);
+        _addNodeToMapping(large, node);
+    }
 
+    // only the large dehydrator is handed to the background thread
+    RMUtil_Assert(_lazyFreeDehydrator(small) == REDISMODULE_ERR);
+    deleteDehydrator(small);
+    RMUtil_Assert(_lazyFreeDehydrator(large) == REDISMODULE_OK);
+    for (i = 0; (i < 1000) && (__atomic_load_n(&lazyfree_pending, __ATOMIC_RELAXED) > 0); ++i)
+    {
+        usleep(1000);
+    }
+    RMUtil_Assert(__atomic_load_n(&lazyfree_pending, __ATOMIC_RELAXED) == 0);
+    lazyfree_threshold = threshold;
 
-    RedisModuleCallReply *look1 =
-        RedisModule_Call(ctx, "REDE.look", "cc", "TEST_DEHYDRATOR_pull", store_key);
-    // RMUTIL_ASSERT_NOERROR(look1);
-    RMUtil_Assert(RedisModule_CallReplyType(look1) != REDISMODULE_REPLY_ERROR);
-    // RMUtil_Assert(RedisModule_CallReplyInteger(rep1) == 1);
+    printf("Passed.\n");
+    return REDISMODULE_OK;
+}
 
 
-    RedisModuleCallReply *pull1 =
-        RedisModule_Call(ctx, "REDE.pull", "cc", "TEST_DEHYDRATOR_pull", bad_store_key);
-    RMUtil_Assert(!RedisModule_CreateStringFromCallReply(pull1));
+int TestClock(RedisModuleCtx *ctx)
+{
+    printf("Testing Clock - ");
+
+    // the virtual clock only moves when told to
+    RedisModuleCallReply *set1 =
+        RedisModule_Call(ctx, "REDE.DEBUG", "ccc", "CLOCK", "SET", "1000000");
+    RMUtil_Assert(RedisModule_CallReplyInteger(set1) == 1000000);
+    RedisModuleCallReply *advance1 =
+        RedisModule_Call(ctx, "REDE.DEBUG", "ccc", "CLOCK", "ADVANCE", "500");
+    RMUtil_Assert(RedisModule_CallReplyInteger(advance1) == 1000500);
+    RMUtil_Assert(current_time_ms() == 1000500);
+    RedisModuleCallReply *get1 =
+        RedisModule_Call(ctx, "REDE.DEBUG", "cc", "CLOCK", "GET");
+    RMUtil_Assert(RedisModule_CallReplyInteger(get1) == 1000500);
+    RedisModuleCallReply *advance2 =
+        RedisModule_Call(ctx, "REDE.DEBUG", "ccc", "CLOCK", "ADVANCE", "-1");
+    RMUtil_Assert(RedisModule_CallReplyType(advance2) == REDISMODULE_REPLY_ERROR);
+    RedisModuleCallReply *unknown1 =
+        RedisModule_Call(ctx, "REDE.DEBUG", "ccc", "CLOCK", "REWIND", "1");
+    RMUtil_Assert(RedisModule_CallReplyType(unknown1) == REDISMODULE_REPLY_ERROR);
+
+    // the anchored clock tells unix time, and never goes back
+    long long virtual_ms = clock_virtual_ms;
+    RedisModuleCallReply *reset1 =
+        RedisModule_Call(ctx, "REDE.DEBUG", "cc", "CLOCK", "RESET");
+    RMUtil_Assert(RedisModule_CallReplyType(reset1) != REDISMODULE_REPLY_ERROR);
+    struct timespec spec;
+    clock_gettime(CLOCK_REALTIME, &spec);
+    long long wall_ms = (long long)spec.tv_sec * 1000 + spec.tv_nsec / 1000000;
+    long long now = current_time_ms();
+    RMUtil_Assert(llabs(now - wall_ms) < 1000);
+    int i;
+    for (i = 0; i < 1000; ++i)
+    {
+        long long later = current_time_ms();
+        RMUtil_Assert(later >= now);
+        now = later;
+    }
+    clock_virtual_ms = virtual_ms;
 
+    printf("Passed.\n");
+    return REDISMODULE_OK;
+}
 
-    RedisModuleCallReply *look2 =
-        RedisModule_Call(ctx, "REDE.look", "cc", "TEST_DEHYDRATOR_pull", bad_store_key);
-    RMUtil_Assert(!RedisModule_CreateStringFromCallReply(look2));
-    // RMUtil_Assert(RedisModule_CallReplyInteger(rep2) == 0);
 
+// the value of `field` in a REDE.STATS reply
+static long long _statOf(RedisModuleCallReply* stats, const char* field)
+{
+    size_t i;
+    for (i = 0; i + 1 < RedisModule_CallReplyLength(stats); i += 2)
+    {
+        size_t len;
+        const char* name = RedisModule_CallReplyStringPtr(RedisModule_CallReplyArrayElement(stats, i), &len);
+        if ((len == strlen(field)) && (strncmp(name, field, len) == 0))
+        {
+            return RedisModule_CallReplyInteger(RedisModule_CallReplyArrayElement(stats, i + 1));
+        }
+    }
+    return -1;
+}
 
-    RedisModuleCallReply *pull2 =
-        RedisModule_Call(ctx, "REDE.pull", "cc", "TEST_DEHYDRATOR_pull", store_key);
-    RMUtil_Assert(RedisModule_CallReplyType(pull2) != REDISMODULE_REPLY_ERROR);
 
+int TestStats(RedisModuleCtx *ctx)
+{
+    printf("Testing Stats - ");
 
-    RedisModuleCallReply *look3 =
-        RedisModule_Call(ctx, "REDE.look", "cc", "TEST_DEHYDRATOR_pull", bad_store_key);
-    RMUtil_Assert(!RedisModule_CreateStringFromCallReply(look3));
+    // percentiles are exact for small lags and within 1/16 above them
+    Dehydrator* dehy = _createDehydrator(DEHYDRATOR_ENGINE_QUEUES, DEHYDRATOR_IDS_AUTO, current_time_ms());
+    RMUtil_Assert(_lagPercentile(dehy->lag, 50) == 0);
+    long long lag;
+    for (lag = 0; lag < 10000; ++lag)
+    {
+        _lagRecord(dehy, lag);
+    }
+    RMUtil_Assert(dehy->lag->total == 10000);
+    RMUtil_Assert(_lagPercentile(dehy->lag, 0.1) == 9);
+    long long p50 = _lagPercentile(dehy->lag, 50);
+    RMUtil_Assert((p50 >= 4999) && (p50 <= 4999 + 4999 / 16));
+    long long p99 = _lagPercentile(dehy->lag, 99);
+    RMUtil_Assert((p99 >= 9899) && (p99 <= 9999));
+    RMUtil_Assert(_lagPercentile(dehy->lag, 100) == 9999);
+    _lagRecord(dehy, 1LL << 50); // beyond the last bucket
+    RMUtil_Assert(_lagPercentile(dehy->lag, 100) == 1LL << 50);
+    deleteDehydrator(dehy);
+
+    // the expired backlog is counted the same by both engines
+    int engines[] = {DEHYDRATOR_ENGINE_QUEUES, DEHYDRATOR_ENGINE_WHEEL};
+    long long ttls[] = {5, 300, 20000, 5000000, 300};
+    int e, i;
+    for (e = 0; e < 2; ++e)
+    {
+        long long now = current_time_ms();
+        dehy = _createDehydrator(engines[e], DEHYDRATOR_IDS_AUTO, now);
+        for (i = 0; i < 5; ++i)
+        {
+            char element_id[10];
+            int len = sprintf(element_id, "%d", i);
+            _pushElement(dehy, ttls[i], now + ttls[i], "element", 7, element_id, len, NULL);
+        }
+        RMUtil_Assert(dehy->id_bytes == 5 * sizeof(long long));
+        RMUtil_Assert(dehy->element_bytes == 5 * 7);
+        RMUtil_Assert(_dehydratorCountExpired(dehy, now) == 0);
+        RMUtil_Assert(_dehydratorCountExpired(dehy, now + 10) == 1);
+        RMUtil_Assert(_dehydratorCountExpired(dehy, now + 400) == 3);
+        RMUtil_Assert(_dehydratorCountExpired(dehy, now + 30000) == 4);
+        RMUtil_Assert(_dehydratorCountExpired(dehy, now + 10000000) == 5);
+        ElementList expired = {NULL, NULL, 0};
+        _dehydratorAdvance(dehy, now + 10, &expired, -1);
+        ElementListNode* node = _listPop(&expired);
+        _removeNodeFromMapping(dehy, node);
+        deleteNode(dehy, node);
+        RMUtil_Assert(_dehydratorCountExpired(dehy, now + 30000) == 3);
+        RMUtil_Assert(dehy->element_bytes == 4 * 7);
+        deleteDehydrator(dehy);
+    }
 
+    // the commands keep the counters, POLL counts how late each element was delivered
+    RedisModule_Call(ctx, "DEL", "c", "TEST_DEHYDRATOR_stats");
+    RMUtil_Assert(RedisModule_CallReplyType(
+        RedisModule_Call(ctx, "REDE.STATS", "c", "TEST_DEHYDRATOR_stats")) == REDISMODULE_REPLY_NULL);
+    for (i = 0; i < 10; ++i)
+    {
+        char element_id[10];
+        sprintf(element_id, "%d", i);
+        RedisModule_Call(ctx, "REDE.PUSH", "cccc", "TEST_DEHYDRATOR_stats", (i < 9) ? "10" : "1010", "payload", element_id);
+    }
+    RedisModuleCallReply *stats1 = RedisModule_Call(ctx, "REDE.STATS", "c", "TEST_DEHYDRATOR_stats");
+    RMUtil_Assert(RedisModule_CallReplyLength(stats1) == 32);
+    RMUtil_Assert(_statOf(stats1, "elements") == 10);
+    RMUtil_Assert(_statOf(stats1, "queues") == 2);
+    RMUtil_Assert(_statOf(stats1, "id_bytes") == 10 * sizeof(long long));
+    RMUtil_Assert(_statOf(stats1, "element_bytes") == 10 * 7);
+    RMUtil_Assert(_statOf(stats1, "pushed") == 10);
+    RMUtil_Assert(_statOf(stats1, "expired_backlog") == 0);
+
+    RedisModule_Call(ctx, "REDE.UPDATE", "ccc", "TEST_DEHYDRATOR_stats", "9", "pl");
+    RedisModule_Call(ctx, "REDE.PULL", "cc", "TEST_DEHYDRATOR_stats", "0");
+    RedisModule_Call(ctx, "REDE.DEBUG", "ccc", "CLOCK", "ADVANCE", "20");
+    RedisModuleCallReply *stats2 = RedisModule_Call(ctx, "REDE.STATS", "c", "TEST_DEHYDRATOR_stats");
+    RMUtil_Assert(_statOf(stats2, "elements") == 9);
+    RMUtil_Assert(_statOf(stats2, "element_bytes") == 8 * 7 + 2);
+    RMUtil_Assert(_statOf(stats2, "updated") == 1);
+    RMUtil_Assert(_statOf(stats2, "pulled") == 1);
+    RMUtil_Assert(_statOf(stats2, "expired_backlog") == 8);
+
+    RedisModule_Call(ctx, "REDE.POLL", "c", "TEST_DEHYDRATOR_stats");
+    RedisModule_Call(ctx, "REDE.DEBUG", "ccc", "CLOCK", "ADVANCE", "2000");
+    RedisModule_Call(ctx, "REDE.POLL", "c", "TEST_DEHYDRATOR_stats");
+    RedisModuleCallReply *stats3 = RedisModule_Call(ctx, "REDE.STATS", "c", "TEST_DEHYDRATOR_stats");
+    RMUtil_Assert(_statOf(stats3, "elements") == 0);
+    RMUtil_Assert(_statOf(stats3, "id_bytes") == 0);
+    RMUtil_Assert(_statOf(stats3, "element_bytes") == 0);
+    RMUtil_Assert(_statOf(stats3, "polled") == 9);
+    RMUtil_Assert(_statOf(stats3, "expired_backlog") == 0);
+    RMUtil_Assert(_statOf(stats3, "lag_p50") == 10);
+    RMUtil_Assert(_statOf(stats3, "lag_max") == 1010);
+    RMUtil_Assert(_statOf(stats3, "lag_p99") == 1010);
+
+    // the module totals add up the dehydrators
+    RMUtil_Assert(rede_totals.polled >= 9);
+    RMUtil_Assert(rede_dehydrators >= 1);
+
+    RedisModule_Call(ctx, "DEL", "c", "TEST_DEHYDRATOR_stats");
     printf("Passed.\n");
-    // RedisModule_Call(ctx, "DEL", "c", "TEST_DEHYDRATOR_pull");
     return REDISMODULE_OK;
 }
 
 
-int TestPoll(RedisModuleCtx *ctx)
+int TestGIDPush(RedisModuleCtx *ctx)
 {
-    printf("Testing Poll - ");
+    printf("Testing GIDPush - ");
 
-  // clear dehydrator
-  // RedisModule_Call(ctx, "DEL", "c", "TEST_DEHYDRATOR_poll");
+    // ids of one process are unique, fixed length and increase
+    char previous[GENERATED_ID_LENGTH + 1];
+    char id[GENERATED_ID_LENGTH + 1];
+    _generateId(current_time_ms(), previous);
+    RMUtil_Assert(strlen(previous) == GENERATED_ID_LENGTH);
+    int i;
+    for (i = 0; i < 100000; ++i)
+    {
+        _generateId(current_time_ms(), id);
+        RMUtil_Assert(strlen(id) == GENERATED_ID_LENGTH);
+        RMUtil_Assert(strcmp(previous, id) < 0);
+        memcpy(previous, id, sizeof(id));
+    }
 
-  // start test
-  // push elements 1, 4, 7 & 3a (for 1, 4, 7 & 3 seconds)
-  // 1
-  RedisModuleCallReply *push1 =
-      RedisModule_Call(ctx, "REDE.push", "cccc", "TEST_DEHYDRATOR_poll", "1000", "element_1", "e1");
-  RMUtil_Assert(RedisModule_CallReplyType(push1) != REDISMODULE_REPLY_ERROR);
+    // the largest timestamp still fits
+    _generateId((1LL << 48) - 1, id);
+    RMUtil_Assert(strlen(id) == GENERATED_ID_LENGTH);
+    RMUtil_Assert(strspn(id, "0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZ") == GENERATED_ID_LENGTH);
+
+    // generated ids are kept in binary, and print back the same
+    char binary[GENERATED_ID_BYTES];
+    char printed[ELEMENT_ID_BUF_SIZE];
+    RMUtil_Assert(parse_generated_id(id, GENERATED_ID_LENGTH, binary));
+    RMUtil_Assert(format_generated_id(binary, printed) == GENERATED_ID_LENGTH);
+    RMUtil_Assert(strcmp(printed, id) == 0);
+    RMUtil_Assert(parse_generated_id("0000000000000000000000000", GENERATED_ID_LENGTH, binary));
+    RMUtil_Assert(parse_generated_id("F5LXX1ZZ5PNORYNQGLHZMSP33", GENERATED_ID_LENGTH, binary)); // 2^128 - 1
+    RMUtil_Assert(!parse_generated_id("F5LXX1ZZ5PNORYNQGLHZMSP34", GENERATED_ID_LENGTH, binary));
+    RMUtil_Assert(!parse_generated_id("ZZZZZZZZZZZZZZZZZZZZZZZZZ", GENERATED_ID_LENGTH, binary));
+    RMUtil_Assert(!parse_generated_id("03etgzp3m2c8k7a9q1z0x4w5v", GENERATED_ID_LENGTH, binary));
+    RMUtil_Assert(!parse_generated_id("03ETGZP3M2C8K7A9Q1Z0X4W5", GENERATED_ID_LENGTH - 1, binary));
+
+    Dehydrator* dehy = _createDehydrator(DEHYDRATOR_ENGINE_QUEUES, DEHYDRATOR_IDS_STRING, current_time_ms());
+    ElementListNode* node = _createNewNode(dehy, "element", 7, id, GENERATED_ID_LENGTH, 1000);
+    _addNodeToMapping(dehy, node);
+    RMUtil_Assert(node->has_generated_id);
+    RMUtil_Assert(dehy->id_bytes == GENERATED_ID_BYTES);
+    RMUtil_Assert(node->size_class == 1);
+    RMUtil_Assert(_getNodeForID(dehy, id, GENERATED_ID_LENGTH) == node);
+    RMUtil_Assert(_getNodeForID(dehy, previous, GENERATED_ID_LENGTH) == NULL);
+    size_t len;
+    RMUtil_Assert(strcmp(_nodeElementId(node, printed, &len), id) == 0);
+    RMUtil_Assert(strcmp(node->element, "element") == 0);
+    _nodeSetElement(dehy, node, "an element too long to be embedded along with the id", 52);
+    RMUtil_Assert(_getNodeForID(dehy, id, GENERATED_ID_LENGTH) == node);
+    RMUtil_Assert(_dehydratorLen(dehy) == 1);
+    _removeNodeFromMapping(dehy, node);
+    RMUtil_Assert(_getNodeForID(dehy, id, GENERATED_ID_LENGTH) == NULL);
+    deleteNode(dehy, node);
+    RMUtil_Assert(dehy->id_bytes == 0);
+
+    // an id that is taken keeps its element, the second push is dropped
+    RMUtil_Assert(_pushElement(dehy, 100, 1100, "first", 5, id, GENERATED_ID_LENGTH, NULL) == DEHYDRATOR_OK);
+    RMUtil_Assert(_pushElement(dehy, 100, 1100, "second", 6, id, GENERATED_ID_LENGTH, NULL) == DEHYDRATOR_ERR);
+    RMUtil_Assert(_dehydratorLen(dehy) == 1);
+    RMUtil_Assert(strcmp(_getNodeForID(dehy, id, GENERATED_ID_LENGTH)->element, "first") == 0);
+    RMUtil_Assert(dehy->id_bytes == GENERATED_ID_BYTES);
+    deleteDehydrator(dehy);
+
+    // every pushed element can be found by the id it was given
+    RedisModule_Call(ctx, "DEL", "c", "TEST_DEHYDRATOR_gid");
+    for (i = 0; i < 100; ++i)
+    {
+        RedisModuleCallReply *push1 =
+            RedisModule_Call(ctx, "REDE.GIDPUSH", "ccc", "TEST_DEHYDRATOR_gid", "100", "payload");
+        RMUtil_Assert(RedisModule_CallReplyType(push1) == REDISMODULE_REPLY_STRING);
+        size_t len;
+        const char* element_id = RedisModule_CallReplyStringPtr(push1, &len);
+        RMUtil_Assert(len == GENERATED_ID_LENGTH);
+        RedisModuleCallReply *look1 =
+            RedisModule_Call(ctx, "REDE.LOOK", "cb", "TEST_DEHYDRATOR_gid", element_id, len);
+        RMUtil_AssertReplyEquals(look1, "payload");
+    }
+    RMUtil_Assert(_statOf(RedisModule_Call(ctx, "REDE.STATS", "c", "TEST_DEHYDRATOR_gid"), "elements") == 100);
+    RMUtil_Assert(_statOf(RedisModule_Call(ctx, "REDE.STATS", "c", "TEST_DEHYDRATOR_gid"), "id_bytes") ==
+                  100 * GENERATED_ID_BYTES);
+
+    // ids of the generated form pushed by hand share their map, other ids do not
+    RedisModule_Call(ctx, "REDE.PUSH", "cccc", "TEST_DEHYDRATOR_gid", "100", "by_hand", "0000000000000000000000042");
+    RedisModule_Call(ctx, "REDE.PUSH", "cccc", "TEST_DEHYDRATOR_gid", "100", "lower", "000000000000000000000004a");
+    RMUtil_AssertReplyEquals(RedisModule_Call(ctx, "REDE.LOOK", "cc", "TEST_DEHYDRATOR_gid", "0000000000000000000000042"),
+                             "by_hand");
+    RMUtil_AssertReplyEquals(RedisModule_Call(ctx, "REDE.PULL", "cc", "TEST_DEHYDRATOR_gid", "000000000000000000000004a"),
+                             "lower");
+    RMUtil_Assert(RedisModule_CallReplyType(RedisModule_Call(ctx, "REDE.LOOK", "cc", "TEST_DEHYDRATOR_gid",
+                                            "000000000000000000000004A")) == REDISMODULE_REPLY_NULL);
+
+    // a push with a bad ttl leaves an AUTO dehydrator on integer ids
+    RedisModule_Call(ctx, "DEL", "c", "TEST_DEHYDRATOR_gid");
+    RedisModule_Call(ctx, "REDE.PUSH", "cccc", "TEST_DEHYDRATOR_gid", "100", "payload", "1");
+    RMUtil_Assert(RedisModule_CallReplyType(RedisModule_Call(ctx, "REDE.GIDPUSH", "ccc", "TEST_DEHYDRATOR_gid",
+                                            "soon", "payload")) == REDISMODULE_REPLY_ERROR);
+    RMUtil_Assert(RedisModule_CallReplyType(RedisModule_Call(ctx, "REDE.PUSH", "cccc", "TEST_DEHYDRATOR_gid",
+                                            "soon", "payload", "x")) == REDISMODULE_REPLY_ERROR);
+    RedisModuleString* dehydrator_name = RedisModule_CreateString(ctx, "TEST_DEHYDRATOR_gid", 19);
+    RedisModuleKey *key = RedisModule_OpenKey(ctx, dehydrator_name, REDISMODULE_READ);
+    Dehydrator* dehydrator = RedisModule_ModuleTypeGetValue(key);
+    RMUtil_Assert(dehydrator->id_mode == DEHYDRATOR_IDS_AUTO);
+    RedisModule_CloseKey(key);
+    RedisModule_FreeString(ctx, dehydrator_name);
 
-  // 4
-  RedisModuleCallReply *push4 =
-      RedisModule_Call(ctx, "REDE.push", "cccc", "TEST_DEHYDRATOR_poll", "4000", "element_4", "e4");
-  RMUtil_Assert(RedisModule_CallReplyType(push4) != REDISMODULE_REPLY_ERROR);
+    RedisModule_Call(ctx, "DEL", "c", "TEST_DEHYDRATOR_gid");
+    printf("Passed.\n");
+    return REDISMODULE_OK;
+}
 
-  // 7
-  RedisModuleCallReply *push7 =
-      RedisModule_Call(ctx, "REDE.push", "cccc", "TEST_DEHYDRATOR_poll", "7000", "element_7", "e7");
-  RMUtil_Assert(RedisModule_CallReplyType(push7) != REDISMODULE_REPLY_ERROR);
 
-  // 3a
-  RedisModuleCallReply *push3a =
-      RedisModule_Call(ctx, "REDE.push", "cccc", "TEST_DEHYDRATOR_poll", "3000", "element_3a", "e3a");
-  RMUtil_Assert(RedisModule_CallReplyType(push3a) != REDISMODULE_REPLY_ERROR);
+// the nodes in the queues of `dehy`, dead ones included
+static long long _queuedNodes(Dehydrator* dehy)
+{
+    long long queued = 0;
+    khiter_t k;
+    for (k = kh_begin(dehy->timeout_queues); k != kh_end(dehy->timeout_queues); ++k)
+    {
+        if (!kh_exist(dehy->timeout_queues, k)) continue;
+        TimeoutQueue* queue = kh_value(dehy->timeout_queues, k);
+        long long in_queue = 0;
+        QueueIterator iter;
+        _queueIterInit(queue, &iter);
+        while (_queueIterNext(&iter) != NULL)
+        {
+            ++in_queue;
+        }
+        RMUtil_Assert(in_queue == queue->len);
+        queued += in_queue;
+    }
+    return queued;
+}
 
-  // pull question 7
-  RedisModuleCallReply *pull_seven_rep =
-      RedisModule_Call(ctx, "REDE.pull", "cc", "TEST_DEHYDRATOR_poll", "e7");
-  RMUtil_Assert(RedisModule_CallReplyType(pull_seven_rep) != REDISMODULE_REPLY_ERROR);
 
-  // poll - make sure no element pops right out
-  RedisModuleCallReply *poll1_rep =
-      RedisModule_Call(ctx, "REDE.poll", "c", "TEST_DEHYDRATOR_poll");
-  RMUtil_Assert(RedisModule_CallReplyType(poll1_rep) != REDISMODULE_REPLY_ERROR);
-  RMUtil_Assert(RedisModule_CallReplyLength(poll1_rep) == 0);
+int TestLazyPull(RedisModuleCtx *ctx)
+{
+    printf("Testing Lazy Pull - ");
 
-  // sleep 1 sec
-  sleep(1);
-  // push element 3b (for 3 seconds)
-  // 3b
-  RedisModuleCallReply *push_three_b =
-      RedisModule_Call(ctx, "REDE.push", "cccc", "TEST_DEHYDRATOR_poll", "3000", "element_3b", "e3b");
-  RMUtil_Assert(RedisModule_CallReplyType(push_three_b) != REDISMODULE_REPLY_ERROR);
+    // pulled nodes stay dead in their queues, and are skipped by everything else
+    long long now = 1000000;
+    Dehydrator* dehy = _createDehydrator(DEHYDRATOR_ENGINE_QUEUES, DEHYDRATOR_IDS_AUTO, now);
+    dehy->pull_mode = DEHYDRATOR_PULL_LAZY;
+    int i;
+    for (i = 0; i < 100; ++i)
+    {
+        char element_id[10];
+        int len = sprintf(element_id, "%d", i);
+        long long ttl = (i % 2) ? 100 : 200;
+        _pushElement(dehy, ttl, now + ttl + i, "element", 7, element_id, len, NULL);
+    }
+    for (i = 0; i < 20; i += 2)
+    {
+        char element_id[10];
+        int len = sprintf(element_id, "%d", i);
+        _pullNode(dehy, _getNodeForID(dehy, element_id, len));
+    }
+    RMUtil_Assert(dehy->dead == 10);
+    RMUtil_Assert(_dehydratorLen(dehy) == 90);
+    RMUtil_Assert(_queuedNodes(dehy) == 100);
+    RMUtil_Assert(dehy->id_bytes == 90 * sizeof(long long));
+    RMUtil_Assert(dehy->element_bytes == 90 * 7);
+    RMUtil_Assert(_getNodeForID(dehy, "4", 1) == NULL);
+    RMUtil_Assert(_dehydratorCountExpired(dehy, now + 250) == 50 + 16);
+    // the queue of ttl 100 expires first, and its head is left dead
+    _pullNode(dehy, _getNodeForID(dehy, "1", 1));
+    RMUtil_Assert(_dehydratorNextExpiration(dehy) == now + 100 + 3);
+    RMUtil_Assert(dehy->dead == 10);
+
+    ElementList expired = {NULL, NULL, 0};
+    _dehydratorAdvance(dehy, now + 1000, &expired, 5);
+    RMUtil_Assert(expired.len == 5);
+    ElementListNode* node;
+    while ((node = _listPop(&expired)) != NULL)
+    {
+        RMUtil_Assert(!node->dead);
+        _removeNodeFromMapping(dehy, node);
+        deleteNode(dehy, node);
+    }
+    _dehydratorAdvance(dehy, now + 1000, &expired, -1);
+    RMUtil_Assert(expired.len == 84);
+    while ((node = _listPop(&expired)) != NULL)
+    {
+        RMUtil_Assert(!node->dead);
+        _removeNodeFromMapping(dehy, node);
+        deleteNode(dehy, node);
+    }
+    RMUtil_Assert(dehy->dead == 0);
+    RMUtil_Assert(kh_size(dehy->timeout_queues) == 0);
+    RMUtil_Assert(dehy->queue_heads.len == 0);
 
-  // poll (t=1) - we expect only element 1 to pop out
-  RedisModuleCallReply *poll_two_rep =
-      RedisModule_Call(ctx, "REDE.poll", "c", "TEST_DEHYDRATOR_poll");
-  RMUtil_Assert(RedisModule_CallReplyType(poll_two_rep) != REDISMODULE_REPLY_ERROR);
-  RMUtil_Assert(RedisModule_CallReplyLength(poll_two_rep) == 1);
-  RedisModuleCallReply *subreply_a = RedisModule_CallReplyArrayElement(poll_two_rep, 0);
-  RMUtil_AssertReplyEquals(subreply_a, "element_1")
+    // pulling most of what was pushed keeps the dead nodes in check
+    for (i = 0; i < 10000; ++i)
+    {
+        char element_id[10];
+        int len = sprintf(element_id, "%d", i);
+        long long ttl = 100 + (i % 7) * 10;
+        _pushElement(dehy, ttl, now + ttl + i, "element", 7, element_id, len, NULL);
+    }
+    for (i = 0; i < 10000; ++i)
+    {
+        if (i % 10 == 9) continue;
+        char element_id[10];
+        int len = sprintf(element_id, "%d", i);
+        _pullNode(dehy, _getNodeForID(dehy, element_id, len));
+        RMUtil_Assert(dehy->dead * 100 <=
+                      (dehy->dead + _dehydratorLen(dehy)) * DEHYDRATOR_COMPACT_DEAD_PERCENT + DEHYDRATOR_COMPACT_STEP * 100);
+    }
+    RMUtil_Assert(_dehydratorLen(dehy) == 1000);
+    RMUtil_Assert(_queuedNodes(dehy) == 1000 + dehy->dead);
+    _dehydratorAdvance(dehy, now + 100000, &expired, -1);
+    RMUtil_Assert(expired.len == 1000);
+    while ((node = _listPop(&expired)) != NULL)
+    {
+        _removeNodeFromMapping(dehy, node);
+        deleteNode(dehy, node);
+    }
+    RMUtil_Assert(dehy->dead == 0);
+    deleteDehydrator(dehy);
+
+    // through the commands
+    RedisModule_Call(ctx, "DEL", "c", "TEST_DEHYDRATOR_lazy");
+    RedisModuleCallReply *create1 =
+        RedisModule_Call(ctx, "REDE.CREATE", "ccccc", "TEST_DEHYDRATOR_lazy", "ENGINE", "WHEEL", "PULL", "LAZY");
+    RMUtil_Assert(RedisModule_CallReplyType(create1) == REDISMODULE_REPLY_ERROR);
+    RedisModuleCallReply *create2 =
+        RedisModule_Call(ctx, "REDE.CREATE", "ccc", "TEST_DEHYDRATOR_lazy", "PULL", "LAZY");
+    RMUtil_Assert(RedisModule_CallReplyType(create2) != REDISMODULE_REPLY_ERROR);
+    for (i = 1; i <= 8; ++i)
+    {
+        char element[20];
+        char element_id[10];
+        sprintf(element, "element_%d", i);
+        sprintf(element_id, "%d", i);
+        RedisModule_Call(ctx, "REDE.PUSH", "cccc", "TEST_DEHYDRATOR_lazy", "10", element, element_id);
+    }
+    RMUtil_AssertReplyEquals(RedisModule_Call(ctx, "REDE.PULL", "cc", "TEST_DEHYDRATOR_lazy", "2"), "element_2");
+    RMUtil_Assert(RedisModule_CallReplyType(
+        RedisModule_Call(ctx, "REDE.PULL", "cc", "TEST_DEHYDRATOR_lazy", "2")) == REDISMODULE_REPLY_NULL);
+    RedisModuleCallReply *stats1 = RedisModule_Call(ctx, "REDE.STATS", "c", "TEST_DEHYDRATOR_lazy");
+    RMUtil_Assert(_statOf(stats1, "elements") == 7);
+    RMUtil_Assert(_statOf(stats1, "dead_nodes") == 1);
+    RedisModule_Call(ctx, "REDE.DEBUG", "ccc", "CLOCK", "ADVANCE", "20");
+    RedisModuleCallReply *poll1 = RedisModule_Call(ctx, "REDE.POLL", "c", "TEST_DEHYDRATOR_lazy");
+    RMUtil_Assert(RedisModule_CallReplyLength(poll1) == 7);
+    RMUtil_AssertReplyEquals(RedisModule_CallReplyArrayElement(poll1, 0), "element_1");
+    RMUtil_AssertReplyEquals(RedisModule_CallReplyArrayElement(poll1, 1), "element_3");
+
+    RedisModule_Call(ctx, "DEL", "c", "TEST_DEHYDRATOR_lazy");
+    printf("Passed.\n");
+    return REDISMODULE_OK;
+}
 
-  // sleep 2 secs and poll (t=3) - we expect only element 3a to pop out
-  sleep(2);
-  RedisModuleCallReply *poll_three_rep =
-      RedisModule_Call(ctx, "REDE.poll", "c", "TEST_DEHYDRATOR_poll");
-  RMUtil_Assert(RedisModule_CallReplyType(poll_three_rep) != REDISMODULE_REPLY_ERROR);
-  RMUtil_Assert(RedisModule_CallReplyLength(poll_three_rep) == 1);
-  RedisModuleCallReply *subreply_b = RedisModule_CallReplyArrayElement(poll_three_rep, 0);
-  RMUtil_AssertReplyEquals(subreply_b, "element_3a");
 
+// the blocks chained in `queue`
+static int _queueBlocks(TimeoutQueue* queue)
+{
+    int blocks = 0;
+    QueueBlock* block;
+    for (block = queue->head; block != NULL; block = block->next)
+    {
+        ++blocks;
+    }
+    return blocks;
+}
 
-  // sleep 2 secs and poll (t=5) - we expect elements 4 and 3b to pop out
-  sleep(2);
-  RedisModuleCallReply *poll_four_rep =
-      RedisModule_Call(ctx, "REDE.poll", "c", "TEST_DEHYDRATOR_poll");
-  RMUtil_Assert(RedisModule_CallReplyType(poll_four_rep) != REDISMODULE_REPLY_ERROR);
-  RMUtil_Assert(RedisModule_CallReplyLength(poll_four_rep) == 2);
-  RedisModuleCallReply *subreply_c_first = RedisModule_CallReplyArrayElement(poll_four_rep, 0);
-  RedisModuleCallReply *subreply_c_second = RedisModule_CallReplyArrayElement(poll_four_rep, 1);
-  RedisModuleString * first_str =  RedisModule_CreateStringFromCallReply(subreply_c_first);
-  RedisModuleString * second_str = RedisModule_CreateStringFromCallReply(subreply_c_second);
-  RedisModuleString * element_3b_str = RedisModule_CreateString(ctx, "element_3b", strlen("element_3b"));
-  RedisModuleString * element_4_str = RedisModule_CreateString(ctx, "element_4", strlen("element_4"));
-  RMUtil_Assert(
-    (
-        RMUtil_StringEquals(first_str, element_3b_str) &&
-        RMUtil_StringEquals(second_str, element_4_str)
-    ) ||
-    (
-        RMUtil_StringEquals(first_str, element_4_str) &&
-        RMUtil_StringEquals(second_str, element_3b_str)
-    )
-  );
 
-  // sleep 6 secs and poll (t=11) - we expect that element 7 will NOT pop out, because we already pulled it
-  sleep(6);
-  RedisModuleCallReply *poll_five_rep = RedisModule_Call(ctx, "REDE.poll", "c", "TEST_DEHYDRATOR_poll");
-  RMUtil_Assert(RedisModule_CallReplyType(poll_five_rep) != REDISMODULE_REPLY_ERROR);
-  RMUtil_Assert(RedisModule_CallReplyLength(poll_five_rep) == 0);
+int TestQueueBlocks(RedisModuleCtx *ctx)
+{
+    printf("Testing Queue Blocks - ");
 
-  // clear dehydrator
-  // RedisModule_Call(ctx, "DEL", "c", "TEST_DEHYDRATOR_poll");
-  printf("Passed.\n");
-  return REDISMODULE_OK;
+    // 300 elements take blocks of 4, 8, 16, 32, 64, 128 and 256 entries
+    long long now = 1000000;
+    Dehydrator* dehy = _createDehydrator(DEHYDRATOR_ENGINE_QUEUES, DEHYDRATOR_IDS_AUTO, now);
+    int i;
+    for (i = 0; i < 300; ++i)
+    {
+        char element_id[10];
+        int len = sprintf(element_id, "%d", i);
+        _pushElement(dehy, 100, now + 100 + i, "element", 7, element_id, len, NULL);
+    }
+    RMUtil_Assert(kh_size(dehy->timeout_queues) == 1);
+    TimeoutQueue* queue = kh_val(dehy->timeout_queues, kh_get(16, dehy->timeout_queues, 100));
+    RMUtil_Assert(queue->len == 300);
+    RMUtil_Assert(_queueBlocks(queue) == 7);
+    RMUtil_Assert(queue->head->capacity == QUEUE_BLOCK_MIN_ENTRIES);
+    RMUtil_Assert(queue->tail->capacity == QUEUE_BLOCK_MAX_ENTRIES);
+
+    // pulling every element of the second block releases it
+    for (i = 4; i < 12; ++i)
+    {
+        char element_id[10];
+        int len = sprintf(element_id, "%d", i);
+        _pullNode(dehy, _getNodeForID(dehy, element_id, len));
+    }
+    RMUtil_Assert(_queueBlocks(queue) == 6);
+    RMUtil_Assert(queue->len == 292);
+
+    // pulling the head moves it to the next taken entry
+    _pullNode(dehy, _getNodeForID(dehy, "0", 1));
+    RMUtil_Assert(_dehydratorNextExpiration(dehy) == now + 101);
+
+    // the entry of a pulled tail is appended to again
+    int end = queue->tail->end;
+    _pullNode(dehy, _getNodeForID(dehy, "299", 3));
+    RMUtil_Assert(queue->tail->end == end - 1);
+    _pushElement(dehy, 100, now + 399, "element", 7, "300", 3, NULL);
+    RMUtil_Assert(queue->tail->end == end);
+
+    // polls go through the blocks in order
+    ElementList expired = {NULL, NULL, 0};
+    _dehydratorAdvance(dehy, now + 1000, &expired, 5);
+    RMUtil_Assert(expired.len == 5);
+    long long expected[] = {1, 2, 3, 12, 13};
+    ElementListNode* node;
+    for (i = 0; (node = _listPop(&expired)) != NULL; ++i)
+    {
+        RMUtil_Assert(node->int_id == expected[i]);
+        _removeNodeFromMapping(dehy, node);
+        deleteNode(dehy, node);
+    }
+    _dehydratorAdvance(dehy, now + 1000, &expired, -1);
+    RMUtil_Assert(expired.len == 286);
+    while ((node = _listPop(&expired)) != NULL)
+    {
+        _removeNodeFromMapping(dehy, node);
+        deleteNode(dehy, node);
+    }
+    RMUtil_Assert(kh_size(dehy->timeout_queues) == 0);
+    RMUtil_Assert(_dehydratorLen(dehy) == 0);
+    deleteDehydrator(dehy);
+
+    printf("Passed.\n");
+    return REDISMODULE_OK;
 }
 
 
-// Unit test entry point for the module
-int TestModule(RedisModuleCtx *ctx, RedisModuleString **argv, int argc)
+int TestQueueEpochs(RedisModuleCtx *ctx)
 {
+    printf("Testing Queue Epochs - ");
+
+    // a block takes expirations up to QUEUE_BLOCK_MAX_OFFSET after its first one
+    long long now = 1000000;
+    long long far = now + 100 + QUEUE_BLOCK_MAX_OFFSET;
+    Dehydrator* dehy = _createDehydrator(DEHYDRATOR_ENGINE_QUEUES, DEHYDRATOR_IDS_AUTO, now);
+    _pushElement(dehy, 100, now + 100, "element", 7, "1", 1, NULL);
+    _pushElement(dehy, 100, far, "element", 7, "2", 1, NULL);
+    TimeoutQueue* queue = kh_val(dehy->timeout_queues, kh_get(16, dehy->timeout_queues, 100));
+    RMUtil_Assert(_queueBlocks(queue) == 1);
+    RMUtil_Assert(queue->tail->epoch == now + 100);
+    RMUtil_Assert(queue->tail->offsets[1] == QUEUE_BLOCK_MAX_OFFSET);
+
+    // one further away starts a new block
+    _pushElement(dehy, 100, far + 1, "element", 7, "3", 1, NULL);
+    _pushElement(dehy, 100, far + 1, "element", 7, "4", 1, NULL);
+    RMUtil_Assert(_queueBlocks(queue) == 2);
+    RMUtil_Assert(queue->tail->epoch == far + 1);
+    RMUtil_Assert(queue->tail->offsets[1] == 0);
+    RMUtil_Assert(_checkPushExpiration(dehy, 100, far) != NULL);
+
+    // the queued nodes' own expirations are not read, polls hand the nodes
+    // out with the ones of their entries
+    ElementListNode* node;
+    QueueIterator iter;
+    _queueIterInit(queue, &iter);
+    while ((node = _queueIterNext(&iter)) != NULL)
+    {
+        node->expiration = 0;
+    }
+    _pullNode(dehy, _getNodeForID(dehy, "3", 1));
+    RMUtil_Assert(_dehydratorNextExpiration(dehy) == now + 100);
+    RMUtil_Assert(_dehydratorCountExpired(dehy, far) == 2);
+    RMUtil_Assert(_dehydratorCountExpired(dehy, far + 1) == 3);
+    ElementList expired = {NULL, NULL, 0};
+    _dehydratorAdvance(dehy, far, &expired, -1);
+    RMUtil_Assert(expired.len == 2);
+    while ((node = _listPop(&expired)) != NULL)
+    {
+        RMUtil_Assert(node->expiration == ((node->int_id == 1) ? now + 100 : far));
+        _removeNodeFromMapping(dehy, node);
+        deleteNode(dehy, node);
+    }
+    RMUtil_Assert(_dehydratorNextExpiration(dehy) == far + 1);
+    _dehydratorAdvance(dehy, far + 1, &expired, -1);
+    RMUtil_Assert(expired.len == 1);
+    node = _listPop(&expired);
+    RMUtil_Assert((node->int_id == 4) && (node->expiration == far + 1));
+    _removeNodeFromMapping(dehy, node);
+    deleteNode(dehy, node);
+    RMUtil_Assert(_dehydratorLen(dehy) == 0);
+    deleteDehydrator(dehy);
+
+    printf("Passed.\n");
+    return REDISMODULE_OK;
+}
 
+int _runTests(RedisModuleCtx *ctx, RedisModuleString **argv, int argc)
+{
     RMUtil_Test(TestLook);
     RMUtil_Test(TestPush);
     RMUtil_Test(TestPull);
     RMUtil_Test(TestPoll);
     RMUtil_Test(TestTimeToNext);
     RMUtil_Test(TestUpdate);
+    RMUtil_Test(TestWheel);
+    RMUtil_Test(TestQueueHeads);
+    RMUtil_Test(TestEncoding);
+    RMUtil_Test(TestIntIds);
+    RMUtil_Test(TestPollCount);
+    RMUtil_Test(TestMPush);
+    RMUtil_Test(TestMLook);
+    RMUtil_Test(TestBPoll);
+    RMUtil_Test(TestDeliver);
+    RMUtil_Test(TestMPushAt);
+    RMUtil_Test(TestRdbChunks);
+    RMUtil_Test(TestReserve);
+    RMUtil_Test(TestLazyFree);
+    RMUtil_Test(TestClock);
+    RMUtil_Test(TestStats);
+    RMUtil_Test(TestGIDPush);
+    RMUtil_Test(TestLazyPull);
+    RMUtil_Test(TestQueueBlocks);
+    RMUtil_Test(TestQueueEpochs);
     printf("All Tests Passed Succesfully!\n");
 
     RedisModule_ReplyWithSimpleString(ctx, "PASS");
@@ -1282,7 +3802,19 @@ int TestModule(RedisModuleCtx *ctx, RedisModuleString **argv, int argc)
 }
 
 
-int RedisModule_OnLoad(RedisModuleCtx *ctx)
+int TestModule(RedisModuleCtx *ctx, RedisModuleString **argv, int argc)
+{
+    // the tests run on a frozen clock they advance rather than sleep, the
+    // clock is given back as it was even if a test fails
+    long long clock = clock_virtual_ms;
+    clock_virtual_ms = current_time_ms();
+    int retval = _runTests(ctx, argv, argc);
+    clock_virtual_ms = clock;
+    return retval;
+}
+
+
+int RedisModule_OnLoad(RedisModuleCtx *ctx, RedisModuleString **argv, int argc)
 {
     // Register the module itself
     if (RedisModule_Init(ctx, "REDE", 1, REDISMODULE_APIVER_1) ==
@@ -1290,7 +3822,40 @@ int RedisModule_OnLoad(RedisModuleCtx *ctx)
         return REDISMODULE_ERR;
     }
 
-    DehydratorType = RedisModule_CreateDataType(ctx, "dehy-type", 0,
+    // the engine allocates through Redis, so its memory is accounted for
+    dehydrator_alloc = RedisModule_Alloc;
+    dehydrator_realloc = RedisModule_Realloc;
+    dehydrator_free = RedisModule_Free;
+
+    // module arguments come in <name> <value> pairs
+    int pos;
+    for (pos = 0; pos < argc; pos += 2)
+    {
+        const char* option = RedisModule_StringPtrLen(argv[pos], NULL);
+        if ((strcasecmp(option, "LAZYFREE_THRESHOLD") == 0) && (pos + 1 < argc) &&
+            (RedisModule_StringToLongLong(argv[pos + 1], &lazyfree_threshold) == REDISMODULE_OK) &&
+            (lazyfree_threshold >= 0))
+        {
+            continue;
+        }
+        if ((strcasecmp(option, "DEBUG") == 0) && (pos + 1 < argc))
+        {
+            const char* value = RedisModule_StringPtrLen(argv[pos + 1], NULL);
+            if ((strcasecmp(value, "yes") == 0) || (strcasecmp(value, "no") == 0))
+            {
+                debug_commands = (strcasecmp(value, "yes") == 0);
+                continue;
+            }
+        }
+        RedisModule_Log(ctx, "warning", "REDE: invalid module arguments, expected LAZYFREE_THRESHOLD <elements> or DEBUG yes|no");
+        return REDISMODULE_ERR;
+    }
+    if (_lazyFreeStart() != REDISMODULE_OK)
+    {
+        RedisModule_Log(ctx, "warning", "REDE: could not start the lazy free thread, freeing in the foreground");
+    }
+
+    DehydratorType = RedisModule_CreateDataType(ctx, "dehy-type", DEHYDRATOR_ENCODING_VERSION,
         DehydratorTypeRdbLoad,
         DehydratorTypeRdbSave,
         DehydratorTypeAofRewrite,
@@ -1299,6 +3864,25 @@ int RedisModule_OnLoad(RedisModuleCtx *ctx)
     );
     if (DehydratorType == NULL) return REDISMODULE_ERR;
 
+    // dehydrators loaded with a delivery target are picked up by this sweep,
+    // servers without module timers just can't deliver
+    if (RedisModule_CreateTimer != NULL)
+    {
+        RedisModule_CreateTimer(ctx, DELIVERY_SWEEP_MS, _deliverySweep, NULL);
+    }
+
+    // the rede_stats section of INFO, on servers that support module sections
+    if (RedisModule_RegisterInfoFunc != NULL)
+    {
+        RedisModule_RegisterInfoFunc(ctx, DehydratorInfo);
+    }
+
+    // register dehydrator.create - using the shortened utility registration macro
+    RMUtil_RegisterWriteCmd(ctx, "REDE.CREATE", CreateCommand);
+
+    // register dehydrator.deliver - using the shortened utility registration macro
+    RMUtil_RegisterWriteCmd(ctx, "REDE.DELIVER", DeliverCommand);
+
     // register TimeToNextCommand - using the shortened utility registration macro
     RMUtil_RegisterWriteCmd(ctx, "REDE.TTN", TimeToNextCommand);
 
@@ -1308,21 +3892,63 @@ int RedisModule_OnLoad(RedisModuleCtx *ctx)
     // register dehydrator.push - using the shortened utility registration macro
     RMUtil_RegisterWriteCmd(ctx, "REDE.PUSH", PushCommand);
 
+    // register dehydrator.mpush - using the shortened utility registration macro
+    RMUtil_RegisterWriteCmd(ctx, "REDE.MPUSH", MPushCommand);
+
+    // register dehydrator.mpushttl - using the shortened utility registration macro
+    RMUtil_RegisterWriteCmd(ctx, "REDE.MPUSHTTL", MPushTTLCommand);
+
+    // register dehydrator.mpushat - using the shortened utility registration macro
+    RMUtil_RegisterWriteCmd(ctx, "REDE.MPUSHAT", MPushAtCommand);
+
     // register dehydrator.pull - using the shortened utility registration macro
     RMUtil_RegisterWriteCmd(ctx, "REDE.PULL", PullCommand);
 
     // register dehydrator.poll - using the shortened utility registration macro
     RMUtil_RegisterWriteCmd(ctx, "REDE.POLL", PollCommand);
 
+    // register dehydrator.bpoll - its keys run up to the timeout, so it is registered directly.
+    // servers that can't block module clients on keys (before 6.0) go without it
+    if ((RedisModule_BlockClientOnKeys != NULL) && (RedisModule_GetBlockedClientReadyKey != NULL) &&
+        (RedisModule_SignalKeyAsReady != NULL) && (RedisModule_CreateTimer != NULL))
+    {
+        if (RedisModule_CreateCommand(ctx, "REDE.BPOLL", BPollCommand, "write", 1, -2, 1) == REDISMODULE_ERR)
+        {
+            return REDISMODULE_ERR;
+        }
+    }
+    else
+    {
+        RedisModule_Log(ctx, "notice", "REDE: this server can't block clients on keys, REDE.BPOLL is not available");
+    }
+
     // register dehydrator.look - using the shortened utility registration macro
     RMUtil_RegisterReadCmd(ctx, "REDE.LOOK", LookCommand);
 
+    // register dehydrator.stats - using the shortened utility registration macro
+    RMUtil_RegisterReadCmd(ctx, "REDE.STATS", StatsCommand);
+
+    // register dehydrator.mlook - using the shortened utility registration macro
+    RMUtil_RegisterReadCmd(ctx, "REDE.MLOOK", MLookCommand);
+
+    // register dehydrator.mpull - using the shortened utility registration macro
+    RMUtil_RegisterWriteCmd(ctx, "REDE.MPULL", MPullCommand);
+
     // register dehydrator.gidpush - using the shortened utility registration macro
     RMUtil_RegisterWriteCmd(ctx, "REDE.GIDPUSH", GIDPushCommand);
 
-    //  TEST OUTPUTS TO THE SERVER SIDE, USE WITH CAUTION
-    // register the unit test
-    RMUtil_RegisterWriteCmd(ctx, "REDE.TEST", TestModule);
+    if (debug_commands)
+    {
+        // register dehydrator.debug - it has no keys, so it is registered directly
+        if (RedisModule_CreateCommand(ctx, "REDE.DEBUG", DebugCommand, "admin", 0, 0, 0) == REDISMODULE_ERR)
+        {
+            return REDISMODULE_ERR;
+        }
+
+        //  TEST OUTPUTS TO THE SERVER SIDE, USE WITH CAUTION
+        // register the unit test, it moves the clock with REDE.DEBUG
+        RMUtil_RegisterWriteCmd(ctx, "REDE.TEST", TestModule);
+    }
 
     // PRINT command works OK, but it is meant for debuging perposes, so it will not be listed in the documentation
     // register dehydrator.print - using the shortened utility registration macro
@@ -39,6 +39,7 @@
 #include <sys/time.h>
 #include <signal.h>
 #include <assert.h>
+#include <stdarg.h>
 
 #include <sds.h> /* Use hiredis sds. */
 #include "ae.h"
@@ -48,6 +49,17 @@
 
 #define UNUSED(V) ((void) V)
 #define RANDPTR_INITIAL_SIZE 8
+#define REDE_CYCLE_LEN 1000 /* Commands in a rede workload cycle */
+
+/* Operations of the rede workload, in --rede-mix order. */
+#define REDE_PUSH 0
+#define REDE_GIDPUSH 1
+#define REDE_PULL 2
+#define REDE_LOOK 3
+#define REDE_TTN 4
+#define REDE_UPDATE 5
+#define REDE_POLL 6
+#define REDE_OPS 7
 
 static struct config {
     aeEventLoop *el;
@@ -79,6 +91,17 @@ static struct config {
     sds dbnumstr;
     char *tests;
     char *auth;
+    /* rede workload */
+    int rede_ttl_min;           /* Shortest TTL pushed, in milliseconds */
+    int rede_ttl_max;           /* Longest TTL pushed, in milliseconds */
+    int rede_ttls;              /* Number of different TTLs pushed */
+    int rede_skew;              /* Favor the shorter TTLs instead of uniform */
+    int rede_mix[REDE_OPS];     /* Weight of every operation in rede.mix */
+    int rede_backlog;           /* Expired elements drained by rede.poll */
+    int rede_poll_count;        /* COUNT of every POLL */
+    char **cycle;               /* Commands sent round robin, NULL if not used */
+    int *cyclelen;
+    long long elements_delivered; /* Elements in the array replies of a rede test */
 } config;
 
 typedef struct _client {
@@ -95,6 +118,7 @@ typedef struct _client {
                                such as auth and select are prefixed to the pipeline of
                                benchmark commands and discarded after the first send. */
     int prefixlen;          /* Size in bytes of the pending prefix commands */
+    int cyclepos;           /* Next command of config.cycle to send */
 } *client;
 
 /* Prototypes */
@@ -154,6 +178,39 @@ static void resetClient(client c) {
     c->pending = config.pipeline;
 }
 
+/* Find substrings in the output buffer that need to be randomized. */
+static void findRandPointers(client c) {
+    char *p = c->obuf;
+
+    c->randfree += c->randlen;
+    c->randlen = 0;
+    while ((p = strstr(p,"__rand_int__")) != NULL) {
+        if (c->randfree == 0) {
+            size_t size = c->randlen ? c->randlen*2 : RANDPTR_INITIAL_SIZE;
+            c->randptr = zrealloc(c->randptr,sizeof(char*)*size);
+            c->randfree += size-c->randlen;
+        }
+        c->randptr[c->randlen++] = p;
+        c->randfree--;
+        p += 12; /* 12 is strlen("__rand_int__). */
+    }
+}
+
+/* Refill the output buffer with the next commands of the cycle, one for
+ * every pipelined request. Clients start at random points of the cycle so
+ * that together they send the whole mix at any moment. */
+static void nextCycleCommands(client c) {
+    int j;
+
+    sdsclear(c->obuf);
+    for (j = 0; j < config.pipeline; j++) {
+        c->obuf = sdscatlen(c->obuf,config.cycle[c->cyclepos],
+            config.cyclelen[c->cyclepos]);
+        c->cyclepos = (c->cyclepos+1) % REDE_CYCLE_LEN;
+    }
+    if (config.randomkeys) findRandPointers(c);
+}
+
 static void randomizeClientKey(client c) {
     size_t i;
 
@@ -213,6 +270,11 @@ static void readHandler(aeEventLoop *el, int fd, void *privdata, int mask) {
                     exit(1);
                 }
 
+                /* Count the elements POLL delivered. */
+                if (config.cycle && c->prefix_pending == 0 &&
+                    ((redisReply*)reply)->type == REDIS_REPLY_ARRAY)
+                    config.elements_delivered += ((redisReply*)reply)->elements;
+
                 if (config.showerrors) {
                     static time_t lasterr_time = 0;
                     time_t now = time(NULL);
@@ -269,7 +331,10 @@ static void writeHandler(aeEventLoop *el, int fd, void *privdata, int mask) {
             return;
         }
 
-        /* Really initialize: randomize keys and set start time. */
+        /* Really initialize: randomize keys and set start time. The
+         * commands of a cycle are only switched once the prefix commands
+         * were discarded. */
+        if (config.cycle && c->prefixlen == 0) nextCycleCommands(c);
         if (config.randomkeys) randomizeClientKey(c);
         c->start = ustime();
         c->latency = -1;
@@ -387,22 +452,13 @@ static client createClient(char *cmd, size_t len, client from) {
                 c->randptr[j] += c->prefixlen - from->prefixlen;
             }
         } else {
-            char *p = c->obuf;
-
             c->randlen = 0;
             c->randfree = RANDPTR_INITIAL_SIZE;
             c->randptr = zmalloc(sizeof(char*)*c->randfree);
-            while ((p = strstr(p,"__rand_int__")) != NULL) {
-                if (c->randfree == 0) {
-                    c->randptr = zrealloc(c->randptr,sizeof(char*)*c->randlen*2);
-                    c->randfree += c->randlen;
-                }
-                c->randptr[c->randlen++] = p;
-                c->randfree--;
-                p += 12; /* 12 is strlen("__rand_int__). */
-            }
+            findRandPointers(c);
         }
     }
+    c->cyclepos = config.cycle ? random() % REDE_CYCLE_LEN : 0;
     if (config.idlemode == 0)
         aeCreateFileEvent(config.el,c->context->fd,AE_WRITABLE,writeHandler,c);
     listAddNodeTail(config.clients,c);
@@ -430,9 +486,10 @@ static int compareLatency(const void *a, const void *b) {
 
 static void showLatencyReport(void) {
     int i, curlat = 0;
-    float perc, reqpersec;
+    float perc, reqpersec, elempersec;
 
     reqpersec = (float)config.requests_finished/((float)config.totlatency/1000);
+    elempersec = (float)config.elements_delivered/((float)config.totlatency/1000);
     if (!config.quiet && !config.csv) {
         printf("====== %s ======\n", config.title);
         printf("  %d requests completed in %.2f seconds\n", config.requests_finished,
@@ -450,11 +507,19 @@ static void showLatencyReport(void) {
                 printf("%.2f%% <= %d milliseconds\n", perc, curlat);
             }
         }
-        printf("%.2f requests per second\n\n", reqpersec);
+        printf("%.2f requests per second\n", reqpersec);
+        if (config.elements_delivered)
+            printf("%.2f elements per second delivered\n", elempersec);
+        printf("\n");
     } else if (config.csv) {
         printf("\"%s\",\"%.2f\"\n", config.title, reqpersec);
+        if (config.elements_delivered)
+            printf("\"%s (elements delivered)\",\"%.2f\"\n", config.title, elempersec);
     } else {
-        printf("%s: %.2f requests per second\n", config.title, reqpersec);
+        printf("%s: %.2f requests per second", config.title, reqpersec);
+        if (config.elements_delivered)
+            printf(", %.2f elements per second delivered", elempersec);
+        printf("\n");
     }
 }
 
@@ -464,6 +529,7 @@ static void benchmark(char *title, char *cmd, int len) {
     config.title = title;
     config.requests_issued = 0;
     config.requests_finished = 0;
+    config.elements_delivered = 0;
 
     c = createClient(cmd,len,NULL);
     createMissingClients(c);
@@ -476,6 +542,140 @@ static void benchmark(char *title, char *cmd, int len) {
     freeAllClients();
 }
 
+/* Pick the TTL of a pushed element: one of config.rede_ttls TTLs evenly
+ * spread between the shortest and the longest, chosen uniformly or, when
+ * skewed, favoring the shorter ones. */
+static int redeTtl(void) {
+    long long ttl = random() % config.rede_ttls;
+
+    if (config.rede_skew) ttl = (ttl * (random() % config.rede_ttls)) / config.rede_ttls;
+    if (config.rede_ttls == 1) return config.rede_ttl_min;
+    return config.rede_ttl_min +
+        ttl * (config.rede_ttl_max - config.rede_ttl_min) / (config.rede_ttls - 1);
+}
+
+/* Format the command for one operation of the rede workload. */
+static int redeFormatCommand(char **cmd, int op, const char *key, char *data) {
+    switch(op) {
+    case REDE_PUSH:
+        return redisFormatCommand(cmd,"REDE.PUSH %s %d %s __rand_int__",key,redeTtl(),data);
+    case REDE_GIDPUSH:
+        return redisFormatCommand(cmd,"REDE.GIDPUSH %s %d %s",key,redeTtl(),data);
+    case REDE_PULL:
+        return redisFormatCommand(cmd,"REDE.PULL %s __rand_int__",key);
+    case REDE_LOOK:
+        return redisFormatCommand(cmd,"REDE.LOOK %s __rand_int__",key);
+    case REDE_TTN:
+        return redisFormatCommand(cmd,"REDE.TTN %s",key);
+    case REDE_UPDATE:
+        return redisFormatCommand(cmd,"REDE.UPDATE %s __rand_int__ %s",key,data);
+    default:
+        return redisFormatCommand(cmd,"REDE.POLL %s COUNT %d",key,config.rede_poll_count);
+    }
+}
+
+/* Benchmark a rede workload: a cycle of REDE_CYCLE_LEN commands holding
+ * every operation in proportion to its weight, shuffled, with the pushed
+ * TTLs drawn from the configured distribution. Clients go round the cycle
+ * one request at a time. */
+static void benchmarkRede(char *title, const char *key, char *data, int *weights) {
+    int ops[REDE_CYCLE_LEN];
+    int j, op, total = 0, sum = 0, filled = 0;
+
+    for (op = 0; op < REDE_OPS; op++) total += weights[op];
+    for (op = 0; op < REDE_OPS; op++) {
+        sum += weights[op];
+        while (filled < (long long)sum * REDE_CYCLE_LEN / total) ops[filled++] = op;
+    }
+    for (j = REDE_CYCLE_LEN-1; j > 0; j--) {
+        int k = random() % (j+1), tmp = ops[j];
+        ops[j] = ops[k];
+        ops[k] = tmp;
+    }
+
+    config.cycle = zmalloc(sizeof(char*)*REDE_CYCLE_LEN);
+    config.cyclelen = zmalloc(sizeof(int)*REDE_CYCLE_LEN);
+    for (j = 0; j < REDE_CYCLE_LEN; j++)
+        config.cyclelen[j] = redeFormatCommand(&config.cycle[j],ops[j],key,data);
+
+    benchmark(title,config.cycle[0],config.cyclelen[0]);
+
+    for (j = 0; j < REDE_CYCLE_LEN; j++) free(config.cycle[j]);
+    zfree(config.cycle);
+    zfree(config.cyclelen);
+    config.cycle = NULL;
+    config.cyclelen = NULL;
+}
+
+/* Benchmark a single rede operation. */
+static void benchmarkRedeOp(char *title, const char *key, char *data, int op) {
+    int weights[REDE_OPS] = {0};
+
+    weights[op] = 1;
+    benchmarkRede(title,key,data,weights);
+}
+
+/* Send a command outside of the benchmark, to set up the server for a test.
+ * Returns 0 on success, or -1 after printing the error. */
+static int redeSetup(const char *fmt, ...) {
+    redisContext *ctx;
+    redisReply *reply;
+    va_list ap;
+
+    if (config.hostsocket == NULL)
+        ctx = redisConnect(config.hostip,config.hostport);
+    else
+        ctx = redisConnectUnix(config.hostsocket);
+    if (ctx->err) {
+        fprintf(stderr,"Could not connect to Redis: %s\n",ctx->errstr);
+        exit(1);
+    }
+    if (config.auth) freeReplyObject(redisCommand(ctx,"AUTH %s",config.auth));
+    if (config.dbnum) freeReplyObject(redisCommand(ctx,"SELECT %d",config.dbnum));
+
+    va_start(ap,fmt);
+    reply = redisvCommand(ctx,fmt,ap);
+    va_end(ap);
+    if (reply == NULL || reply->type == REDIS_REPLY_ERROR) {
+        fprintf(stderr,"Error setting up the rede test: %s\n",
+            reply ? reply->str : ctx->errstr);
+        if (reply) freeReplyObject(reply);
+        redisFree(ctx);
+        return -1;
+    }
+    freeReplyObject(reply);
+    redisFree(ctx);
+    return 0;
+}
+
+/* Benchmark POLL in steady state: fill a dehydrator with a backlog of
+ * elements, move the module clock past all of them and time draining it,
+ * so that every POLL delivers a full COUNT of elements. The clock is only
+ * registered when the module is loaded with DEBUG yes, the test is skipped
+ * otherwise. */
+static void benchmarkRedePoll(char *data) {
+    int requests = config.requests;
+
+    if (redeSetup("REDE.DEBUG CLOCK RESET") == -1) {
+        fprintf(stderr,"Skipping rede.poll, it needs the module loaded with DEBUG yes\n");
+        return;
+    }
+    if (redeSetup("DEL rede:backlog") == -1) exit(1);
+    if (config.rede_backlog > requests)
+        config.latency = zrealloc(config.latency,sizeof(long long)*config.rede_backlog);
+    config.requests = config.rede_backlog;
+    benchmarkRedeOp("REDE.GIDPUSH (needed for POLL)","rede:backlog",data,REDE_GIDPUSH);
+
+    if (redeSetup("REDE.DEBUG CLOCK ADVANCE %d",config.rede_ttl_max+1) == -1) exit(1);
+    config.requests = config.rede_backlog / config.rede_poll_count;
+    if (config.requests < 1) config.requests = 1;
+    benchmarkRedeOp("REDE.POLL (expired backlog)","rede:backlog",data,REDE_POLL);
+    if (redeSetup("REDE.DEBUG CLOCK RESET") == -1) exit(1);
+    if (redeSetup("DEL rede:backlog") == -1) exit(1);
+
+    config.requests = requests;
+}
+
 /* Returns number of consumed options. */
 int parseOptions(int argc, const char **argv) {
     int i;
@@ -546,6 +746,41 @@ int parseOptions(int argc, const char **argv) {
             if (lastarg) goto invalid;
             config.dbnum = atoi(argv[++i]);
             config.dbnumstr = sdsfromlonglong(config.dbnum);
+        } else if (!strcmp(argv[i],"--rede-ttl")) {
+            if (lastarg) goto invalid;
+            if (sscanf(argv[++i],"%d:%d",&config.rede_ttl_min,&config.rede_ttl_max) == 1)
+                config.rede_ttl_max = config.rede_ttl_min;
+            if (config.rede_ttl_min < 0 || config.rede_ttl_max < config.rede_ttl_min)
+                goto invalid;
+        } else if (!strcmp(argv[i],"--rede-ttls")) {
+            if (lastarg) goto invalid;
+            config.rede_ttls = atoi(argv[++i]);
+            if (config.rede_ttls < 1) config.rede_ttls = 1;
+        } else if (!strcmp(argv[i],"--rede-skew")) {
+            config.rede_skew = 1;
+        } else if (!strcmp(argv[i],"--rede-mix")) {
+            int j, total = 0;
+            const char *p;
+
+            if (lastarg) goto invalid;
+            p = argv[++i];
+            for (j = 0; j < REDE_OPS; j++) {
+                config.rede_mix[j] = atoi(p);
+                if (config.rede_mix[j] < 0) goto invalid;
+                total += config.rede_mix[j];
+                if ((p = strchr(p,':')) == NULL) break;
+                p++;
+            }
+            for (j++; j < REDE_OPS; j++) config.rede_mix[j] = 0;
+            if (total == 0) goto invalid;
+        } else if (!strcmp(argv[i],"--rede-backlog")) {
+            if (lastarg) goto invalid;
+            config.rede_backlog = atoi(argv[++i]);
+            if (config.rede_backlog < 1) config.rede_backlog = 1;
+        } else if (!strcmp(argv[i],"--rede-poll-count")) {
+            if (lastarg) goto invalid;
+            config.rede_poll_count = atoi(argv[++i]);
+            if (config.rede_poll_count < 1) config.rede_poll_count = 1;
         } else if (!strcmp(argv[i],"--help")) {
             exit_status = 0;
             goto usage;
@@ -589,7 +824,21 @@ usage:
 " -l                 Loop. Run the tests forever\n"
 " -t <tests>         Only run the comma separated list of tests. The test\n"
 "                    names are the same as the ones produced as output.\n"
-" -I                 Idle mode. Just open N idle connections and wait.\n\n"
+" -I                 Idle mode. Just open N idle connections and wait.\n"
+" --rede-ttl <min>[:<max>]  TTLs pushed by the rede tests in milliseconds\n"
+"                    (default 1000:60000)\n"
+" --rede-ttls <n>    Number of different TTLs pushed (default 10)\n"
+" --rede-skew        Push the shorter TTLs more often instead of uniformly\n"
+" --rede-mix <push>:<gidpush>:<pull>:<look>:<ttn>:<update>:<poll>\n"
+"                    Weights of the operations in the rede.mix test\n"
+"                    (default 40:0:20:30:5:5:0)\n"
+" --rede-backlog <n> Expired elements drained by the rede.poll test\n"
+"                    (default 100000)\n"
+" --rede-poll-count <n>  COUNT of every POLL (default 100)\n"
+"  The rede tests use -d for the element size and -r for the element id\n"
+"  keyspace (default the number of requests). A PUSH of an id that is still\n"
+"  dehydrating is refused, use a keyspace larger than the requests to time\n"
+"  fresh pushes only. rede.poll needs the module loaded with DEBUG yes.\n\n"
 "Examples:\n\n"
 " Run the benchmark with the default configuration against 127.0.0.1:6379:\n"
 "   $ redis-benchmark\n\n"
@@ -601,6 +850,8 @@ usage:
 "   $ redis-benchmark -t ping,set,get -n 100000 --csv\n\n"
 " Benchmark a specific command line:\n"
 "   $ redis-benchmark -r 10000 -n 10000 eval 'return redis.call(\"ping\")' 0\n\n"
+" Benchmark a mostly read dehydrator workload over 1000 TTLs:\n"
+"   $ redis-benchmark -t rede.mix -r 100000 -d 64 --rede-ttls 1000 --rede-mix 10:0:10:70:10\n\n"
 " Fill a list with 10000 random elements:\n"
 "   $ redis-benchmark -r 10000 -n 10000 lpush mylist __rand_int__\n\n"
 " On user specified command lines __rand_int__ is replaced with a random integer\n"
@@ -679,6 +930,22 @@ int main(int argc, const char **argv) {
     config.tests = NULL;
     config.dbnum = 0;
     config.auth = NULL;
+    config.rede_ttl_min = 1000;
+    config.rede_ttl_max = 60000;
+    config.rede_ttls = 10;
+    config.rede_skew = 0;
+    config.rede_mix[REDE_PUSH] = 40;
+    config.rede_mix[REDE_GIDPUSH] = 0;
+    config.rede_mix[REDE_PULL] = 20;
+    config.rede_mix[REDE_LOOK] = 30;
+    config.rede_mix[REDE_TTN] = 5;
+    config.rede_mix[REDE_UPDATE] = 5;
+    config.rede_mix[REDE_POLL] = 0;
+    config.rede_backlog = 100000;
+    config.rede_poll_count = 100;
+    config.cycle = NULL;
+    config.cyclelen = NULL;
+    config.elements_delivered = 0;
 
     i = parseOptions(argc,argv);
     argc -= i;
@@ -820,19 +1087,6 @@ int main(int argc, const char **argv) {
             free(cmd);
         }
 
-        if (test_is_selected("rede.push") || test_is_selected("rede")) {
-            len = redisFormatCommand(&cmd,"REDE.PUSH myDehydrator 1000 payload __rand_int__");
-            benchmark("REDE.PUSH",cmd,len);
-            free(cmd);
-        }
-
-
-        if (test_is_selected("rede.pull") || test_is_selected("rede")) {
-            len = redisFormatCommand(&cmd,"REDE.PULL myDehydrator __rand_int__");
-            benchmark("REDE.PUSH",cmd,len);
-            free(cmd);
-        }
-
         if (test_is_selected("mset")) {
             const char *argv[21];
             argv[0] = "MSET";
@@ -845,22 +1099,40 @@ int main(int argc, const char **argv) {
             free(cmd);
         }
 
-        if (test_is_selected("rede.poll") || test_is_selected("rede")) {
-        	len = redisFormatCommand(&cmd,"REDE.PUSH myDehydrator 10000000 payload __rand_int__");
-        	benchmark("REDE.PUSH - 10000 second elements (needed for POLL)",cmd,len);
-            free(cmd);
-        	len = redisFormatCommand(&cmd,"REDE.PUSH myDehydrator 15000 payload __rand_int__");
-            benchmark("REDE.PUSH - 15 second elements (needed for POLL)",cmd,len);
-            free(cmd);
-  			len = redisFormatCommand(&cmd,"REDE.PUSH myDehydrator 10000 payload __rand_int__");
-        	benchmark("REDE.PUSH - 10 second elements (needed for POLL)",cmd,len);
-            free(cmd);
-        	len = redisFormatCommand(&cmd,"REDE.PUSH myDehydrator 5000 payload __rand_int__");
-        	benchmark("REDE.PUSH - 5 second elements (needed for POLL)",cmd,len);
-            free(cmd);
-            len = redisFormatCommand(&cmd,"REDE.POLL myDehydrator");
-            benchmark("REDE.POLL",cmd,len);
-            free(cmd);
+        /* The rede tests hit random element ids, so make sure there are. */
+        int randomkeys = config.randomkeys;
+        if (!config.randomkeys) {
+            config.randomkeys = 1;
+            config.randomkeys_keyspacelen = config.requests;
+        }
+
+        if (test_is_selected("rede.push") || test_is_selected("rede"))
+            benchmarkRedeOp("REDE.PUSH","myDehydrator",data,REDE_PUSH);
+
+        if (test_is_selected("rede.gidpush") || test_is_selected("rede"))
+            benchmarkRedeOp("REDE.GIDPUSH","myDehydrator",data,REDE_GIDPUSH);
+
+        if (test_is_selected("rede.look") || test_is_selected("rede"))
+            benchmarkRedeOp("REDE.LOOK","myDehydrator",data,REDE_LOOK);
+
+        if (test_is_selected("rede.update") || test_is_selected("rede"))
+            benchmarkRedeOp("REDE.UPDATE","myDehydrator",data,REDE_UPDATE);
+
+        if (test_is_selected("rede.ttn") || test_is_selected("rede"))
+            benchmarkRedeOp("REDE.TTN","myDehydrator",data,REDE_TTN);
+
+        if (test_is_selected("rede.pull") || test_is_selected("rede"))
+            benchmarkRedeOp("REDE.PULL","myDehydrator",data,REDE_PULL);
+
+        if (test_is_selected("rede.mix") || test_is_selected("rede"))
+            benchmarkRede("REDE mix","myDehydrator",data,config.rede_mix);
+
+        if (test_is_selected("rede.poll") || test_is_selected("rede"))
+            benchmarkRedePoll(data);
+
+        if (!randomkeys) {
+            config.randomkeys = 0;
+            config.randomkeys_keyspacelen = 0;
         }
 
         if (!config.csv) printf("\n");
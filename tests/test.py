@@ -2,17 +2,46 @@
 import redis
 import time
 import random
+import subprocess
 import sys
+import os
+
+MODULE_PATH = os.path.join(os.path.dirname(os.path.abspath(__file__)), "..", "module.so")
+
+def start_server(server_path):
+    # REDE.DEBUG and REDE.TEST are only there when the module is loaded with DEBUG yes
+    server = subprocess.Popen([server_path, "--port", "6379", "--save", "",
+                               "--loadmodule", MODULE_PATH, "DEBUG", "yes"])
+    r = redis.StrictRedis(host='localhost', port=6379, db=0)
+    for _ in range(50):
+        try:
+            r.ping()
+            return server
+        except redis.ConnectionError:
+            time.sleep(0.1)
+    server.kill()
+    sys.exit("redis-server did not start")
+
+def check_debug_commands(redis_service):
+    try:
+        redis_service.execute_command("rede.debug", "clock", "get")
+    except redis.ResponseError:
+        sys.exit("the tests need REDE.DEBUG, load the module with: --loadmodule module.so DEBUG yes")
 
 def run_internal_test(redis_service):
     sys.stdout.write("module functional test (internal) - ")
     sys.stdout.flush()
     print(redis_service.execute_command("rede.test"))
 
+def advance_clock(redis_service, seconds):
+    # the module clock is frozen from the first advance on, instead of sleeping for real
+    redis_service.execute_command("rede.debug", "clock", "advance", int(seconds * 1000))
+
 def function_test_dehydrator(redis_service):
     # redis_service.execute_command("DEL", "python_test_dehydrator")
     sys.stdout.write("module functional test (external) - ")
     sys.stdout.flush()
+    advance_clock(redis_service, 0)
     #  "push elements a,b & c (for 1,3 & 7 seconds)"
     redis_service.execute_command("rede.push", "python_test_dehydrator", 1000, "test_element a", "a")
     redis_service.execute_command("rede.push", "python_test_dehydrator", 3000, "test_element b", "b")
@@ -21,22 +50,23 @@ def function_test_dehydrator(redis_service):
     redis_service.execute_command("rede.pull", "python_test_dehydrator", "b")
     #  "poll (t=0) - no element should pop out right away"
     assert(len(redis_service.execute_command("rede.poll", "python_test_dehydrator")) == 0)
-    #  "sleep 1"
-    time.sleep(1)
+    #  "advance the clock 1 sec"
+    advance_clock(redis_service, 1)
     #  "poll (t=1) - we expect only element a to pop out"
     t1_poll_result = redis_service.execute_command("rede.poll", "python_test_dehydrator")
     # (t1_poll_result)
     assert(len(t1_poll_result) == 1 and t1_poll_result[0] == "test_element a")
-    #  "sleep 1"
-    time.sleep(1)
+    #  "advance the clock 1 sec"
+    advance_clock(redis_service, 1)
     #  "poll (t=2) - no element should pop out right now"
     assert(len(redis_service.execute_command("rede.poll", "python_test_dehydrator")) == 0)
-    #  "sleep 8"
-    time.sleep(8)
+    #  "advance the clock 8 secs"
+    advance_clock(redis_service, 8)
     # "poll (t=1) - we expect only element c to pop out (3 was already pulled)"
     t1_poll_result = redis_service.execute_command("rede.poll", "python_test_dehydrator")
     # (t1_poll_result)
     assert(len(t1_poll_result) == 1 and t1_poll_result[0] == "test_element c")
+    redis_service.execute_command("rede.debug", "clock", "reset")
     print("PASS")
     # redis_service.execute_command("DEL", "python_test_dehydrator")
 
@@ -72,16 +102,17 @@ def load_test_dehydrator(redis_service, cycles=1000000, timeouts=[1,2,4,16,32,10
             redis_service.execute_command("rede.push", "python_load_test_dehydrator", "%d" % i, "payload", 1000*(3-j+random.choice([1,2,3])))
         start_i += cycles/3
         end_i += cycles/3
-        time.sleep(1)
+        advance_clock(redis_service, 1)
 
     print "measuring POLL"
     poll_sum = 0
     for j in range(10):
-        time.sleep(1)
+        advance_clock(redis_service, 1)
         poll_start = time.time()
         redis_service.execute_command("rede.poll", "python_load_test_dehydrator")
         poll_end = time.time()
         poll_sum += poll_end-poll_start
+    redis_service.execute_command("rede.debug", "clock", "reset")
 
     print "mean push velocity =", cycles/(push_end-start), "per second"
     print "mean push(generating ids) velocity =", cycles/(gid_push_end-push_end), "per second"
@@ -90,8 +121,14 @@ def load_test_dehydrator(redis_service, cycles=1000000, timeouts=[1,2,4,16,32,10
     # redis_service.execute_command("DEL", "python_load_test_dehydrator")
 
 if __name__ == "__main__":
-    r = redis.StrictRedis(host='localhost', port=6379, db=0)
     args = sys.argv[1:]
+    server = None
+    if "--server" in args:
+        # --server path/to/redis-server runs the tests on a server of their own
+        i = args.index("--server")
+        server = start_server(args[i + 1])
+        del args[i:i + 2]
+    r = redis.StrictRedis(host='localhost', port=6379, db=0)
     test_internal = False
     test_external = False
     load_test = False
@@ -112,9 +149,13 @@ if __name__ == "__main__":
             elif arg == "--external":
                 test_external = True
 
+    if test_internal or test_external:
+        check_debug_commands(r)
     if test_internal:
         run_internal_test(r)
     if test_external:
         function_test_dehydrator(r)
     if load_test:
         load_test_dehydrator(r)
+    if server is not None:
+        server.terminate()